@@ -0,0 +1,53 @@
+// Small timing helpers shared by the benchmarks. Each benchmark includes
+// shellington.c directly (built with SHELLINGTON_NO_MAIN) so it measures the
+// same code the shell runs.
+#ifndef SHELLINGTON_BENCH_H
+#define SHELLINGTON_BENCH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Iteration counts can be overridden with BENCH_WARMUP and BENCH_REPS.
+static int bench_warmup=100;
+static int bench_reps=2000;
+
+static inline uint64_t bench_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ull+ts.tv_nsec;
+}
+static void bench_init(void)
+{
+	const char *env;
+	if ((env=getenv("BENCH_WARMUP"))) bench_warmup=atoi(env);
+	if ((env=getenv("BENCH_REPS"))) bench_reps=atoi(env);
+	if (bench_reps<1) bench_reps=1;
+}
+static int bench_cmp_u64(const void *a, const void *b)
+{
+	uint64_t x=*(const uint64_t *)a, y=*(const uint64_t *)b;
+	return x<y?-1:x>y;
+}
+/**
+ * Print one result line: name, sample count, p50, p99 and mean in nanoseconds.
+ * Sorts samples in place.
+ * @param out     [description]
+ * @param name    [description]
+ * @param samples [description]
+ * @param n       [description]
+ */
+static void bench_report(FILE *out, const char *name, uint64_t *samples, size_t n)
+{
+	uint64_t sum=0;
+	qsort(samples, n, sizeof(uint64_t), bench_cmp_u64);
+	for (size_t i=0;i<n;++i) sum+=samples[i];
+	fprintf(out, "%-32s n=%-7zu p50=%-10llu p99=%-10llu mean=%llu ns\n", name, n,
+		(unsigned long long)samples[n/2],
+		(unsigned long long)samples[n*99/100],
+		(unsigned long long)(sum/n));
+}
+
+#endif
@@ -0,0 +1,75 @@
+// Batch mode: commands per second through the built shell, reading a script
+// file and piped stdin, for builtins (no process) and for external commands.
+// BENCH_SHELL sets the shell binary, BENCH_LINES the length of each script.
+#include <fcntl.h>
+#include <spawn.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "bench.h"
+
+extern char **environ;
+const char *shell="../shellington";
+
+/**
+ * Run the shell once over a script, as an argument or on stdin.
+ * @return elapsed ns
+ */
+uint64_t bench_run(const char *script, int piped)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+	if (piped)
+		posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, script, O_RDONLY, 0);
+	char *argv[]={(char *)shell, piped?NULL:(char *)script, NULL};
+	pid_t pid;
+	int status;
+	uint64_t start=bench_now_ns();
+	if (posix_spawn(&pid, shell, &actions, NULL, argv, environ)!=0)
+	{
+		perror(shell);
+		exit(1);
+	}
+	waitpid(pid, &status, 0);
+	uint64_t elapsed=bench_now_ns()-start;
+	posix_spawn_file_actions_destroy(&actions);
+	return elapsed;
+}
+
+void bench_script(FILE *out, const char *name, const char *line, int lines, int piped)
+{
+	char path[]="/tmp/bench_batchXXXXXX";
+	FILE *file=fdopen(mkstemp(path), "w");
+	for (int i=0;i<lines;++i)
+		fprintf(file, "%s\n", line);
+	fclose(file);
+
+	int reps=bench_reps<10?bench_reps:10; // each run is a whole script
+	uint64_t *samples=malloc(sizeof(uint64_t)*reps), total=0;
+	bench_run(path, piped);
+	for (int i=0;i<reps;++i)
+		total+=samples[i]=bench_run(path, piped);
+	bench_report(out, name, samples, reps);
+	fprintf(out, "%-32s %.0f commands/s\n", "", (double)lines*reps*1e9/total);
+	free(samples);
+	unlink(path);
+}
+
+int main()
+{
+	bench_init();
+	const char *env;
+	if ((env=getenv("BENCH_SHELL"))) shell=env;
+	int lines=(env=getenv("BENCH_LINES"))?atoi(env):20000;
+	if (access(shell, X_OK)==-1)
+	{
+		fprintf(stderr, "%s: not built, run make in the top directory\n", shell);
+		return 1;
+	}
+	bench_script(stdout, "batch/builtin/script", "hash -r", lines, 0);
+	bench_script(stdout, "batch/builtin/stdin", "hash -r", lines, 1);
+	bench_script(stdout, "batch/external/script", "true", lines/20, 0);
+	bench_script(stdout, "batch/pipeline/script", "true | true", lines/40, 0);
+	return 0;
+}
@@ -0,0 +1,135 @@
+// Builtin dispatch latency: "short jump" run in-process through process_command,
+// against the old path that forked and waited for a child before doing the work,
+// and "bookmark -i" replaying a bookmark with and without its cached parse.
+#define SHELLINGTON_NO_MAIN
+#include "../shellington.c"
+#include "bench.h"
+
+#include <fcntl.h>
+
+// What process_command used to do for short and rps: fork a child that exits straight away.
+int dispatch_forked(struct command_t *command)
+{
+	fflush(stdout);
+	pid_t pid=fork();
+	if (pid==0)
+		exit(0);
+	waitpid(pid, NULL, 0);
+	return find_builtin(command)->fn(command);
+}
+
+int main()
+{
+	bench_init();
+	// short set saves its snapshot in init_dir, keep it out of the tree
+	char dir[]="/tmp/bench_builtinsXXXXXX";
+	if (!mkdtemp(dir)) return 1;
+	strcpy(init_dir, dir);
+	malloc_rps();
+
+	// builtins print, keep their output off the results
+	FILE *out=fdopen(dup(STDOUT_FILENO), "w");
+	int devnull=open("/dev/null", O_WRONLY);
+	dup2(devnull, STDOUT_FILENO);
+
+	char line[]="short set bench";
+	struct command_t *set=new_command(&line_arena);
+	parse_command(line, set);
+	process_command(set);
+	free_command(set);
+
+	char jump_line[]="short jump bench";
+	struct command_t *jump=new_command(&line_arena);
+	parse_command(jump_line, jump);
+
+	uint64_t *samples=malloc(sizeof(uint64_t)*bench_reps);
+	for (int i=0;i<bench_warmup;++i)
+		dispatch_forked(jump);
+	for (int i=0;i<bench_reps;++i)
+	{
+		uint64_t start=bench_now_ns();
+		dispatch_forked(jump);
+		samples[i]=bench_now_ns()-start;
+	}
+	fflush(stdout);
+	bench_report(out, "builtin/short-jump/fork", samples, bench_reps);
+
+	for (int i=0;i<bench_warmup;++i)
+		process_command(jump);
+	for (int i=0;i<bench_reps;++i)
+	{
+		uint64_t start=bench_now_ns();
+		process_command(jump);
+		samples[i]=bench_now_ns()-start;
+	}
+	fflush(stdout);
+	bench_report(out, "builtin/short-jump/in-process", samples, bench_reps);
+
+	// BENCH_ALIASES more aliases in the table, jump should not slow down
+	const char *env=getenv("BENCH_ALIASES");
+	int aliases=env?atoi(env):1000;
+	char name[32];
+	for (int i=0;i<aliases;++i)
+	{
+		snprintf(name, sizeof(name), "alias%d", i);
+		alias_put(strdup(name), strdup(dir));
+	}
+	for (int i=0;i<bench_warmup;++i)
+		process_command(jump);
+	for (int i=0;i<bench_reps;++i)
+	{
+		uint64_t start=bench_now_ns();
+		process_command(jump);
+		samples[i]=bench_now_ns()-start;
+	}
+	fflush(stdout);
+	snprintf(name, sizeof(name), "builtin/short-jump/%d-aliases", aliases);
+	bench_report(out, name, samples, bench_reps);
+
+	uint64_t start=bench_now_ns();
+	alias_save();
+	uint64_t saved=bench_now_ns();
+	alias_free();
+	alias_load();
+	fprintf(out, "%-32s save %.1f us, load %.1f us, %zu aliases\n", "builtin/short/snapshot",
+		(saved-start)/1e3, (bench_now_ns()-saved)/1e3, alias_table_used);
+	// replaying a bookmark, parsed once and then run from its template
+	char add_line[]="bookmark cd .", replay_line[]="bookmark -i 0";
+	struct command_t *add=new_command(&line_arena);
+	parse_command(add_line, add);
+	process_command(add);
+	free_command(add);
+	struct arena_t replay_arena={0};
+	struct command_t *replay=new_command(&replay_arena);
+	parse_command(replay_line, replay);
+	for (int i=0;i<bench_warmup;++i)
+		process_command(replay);
+	for (int i=0;i<bench_reps;++i)
+	{
+		uint64_t start=bench_now_ns();
+		process_command(replay);
+		samples[i]=bench_now_ns()-start;
+	}
+	bench_report(out, "builtin/bookmark-replay/cached", samples, bench_reps);
+	for (int i=0;i<bench_reps;++i)
+	{
+		template_free(bookmarks.templates[0]); // as on the first run
+		bookmarks.templates[0]=NULL;
+		uint64_t start=bench_now_ns();
+		process_command(replay);
+		samples[i]=bench_now_ns()-start;
+	}
+	bench_report(out, "builtin/bookmark-replay/parsed", samples, bench_reps);
+	arena_free(&replay_arena);
+
+	char path[1100];
+	alias_path(path, sizeof(path));
+	unlink(path);
+	unlink(bookmarks.path);
+	rmdir(dir);
+
+	free(samples);
+	free_command(jump);
+	fclose(out);
+	return 0;
+}
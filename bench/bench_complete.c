@@ -0,0 +1,77 @@
+// Completion: time for one tab over a generated directory with many entries,
+// cold (read a frame at a time) and warm (cached listing), and over the real PATH.
+#define SHELLINGTON_NO_MAIN
+#include "../shellington.c"
+#include "bench.h"
+
+// Tab presses on line until every candidate is in, returns the time of the first.
+uint64_t bench_tab(const char *text, int *tabs)
+{
+	struct line_t line={0};
+	struct completion_t comp={0};
+	line_set(&line, text, strlen(text));
+	uint64_t start=bench_now_ns();
+	complete_start(&comp, &line);
+	complete_run(&comp);
+	uint64_t elapsed=bench_now_ns()-start;
+	for (*tabs=1; !comp.done; ++*tabs)
+		complete_run(&comp);
+	complete_clear(&comp);
+	free(line.buf);
+	return elapsed;
+}
+// A directory read cold takes several tabs, each within the frame budget.
+void bench_cold(FILE *out, const char *name, const char *text)
+{
+	int tabs;
+	uint64_t start=bench_now_ns();
+	uint64_t first=bench_tab(text, &tabs);
+	fprintf(out, "%-32s first tab %.1f ms, %d tabs, %.1f ms in all\n", name, first/1e6, tabs,
+		(bench_now_ns()-start)/1e6);
+}
+
+void bench_complete(FILE *out, const char *name, const char *text)
+{
+	uint64_t *samples=malloc(sizeof(uint64_t)*bench_reps);
+	for (int i=-bench_warmup;i<bench_reps;++i)
+	{
+		int tabs;
+		uint64_t elapsed=bench_tab(text, &tabs);
+		if (i>=0) samples[i]=elapsed;
+	}
+	bench_report(out, name, samples, bench_reps);
+	free(samples);
+}
+
+int main()
+{
+	bench_init();
+	// BENCH_FILES sets the number of entries in the generated directory.
+	const char *env=getenv("BENCH_FILES");
+	int files=env?atoi(env):50000;
+	char dir[]="/tmp/bench_completeXXXXXX";
+	if (!mkdtemp(dir)) return 1;
+	char path[256];
+	for (int i=0;i<files;++i)
+	{
+		snprintf(path, sizeof(path), "%s/report-%06d.csv", dir, i*7919%1000003);
+		close(open(path, O_WRONLY|O_CREAT, 0644));
+	}
+	prompt_init();
+	free(prompt_cwd);
+	prompt_cwd=strdup(dir);
+
+	bench_cold(stdout, "complete/files/cold", "cat report-00");
+	bench_complete(stdout, "complete/files/warm", "cat report-00");
+	bench_complete(stdout, "complete/files/unique", "cat report-0000");
+	bench_cold(stdout, "complete/path/cold", "c");
+	bench_complete(stdout, "complete/path/warm", "c");
+
+	for (int i=0;i<files;++i)
+	{
+		snprintf(path, sizeof(path), "%s/report-%06d.csv", dir, i*7919%1000003);
+		unlink(path);
+	}
+	rmdir(dir);
+	return 0;
+}
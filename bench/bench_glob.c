@@ -0,0 +1,72 @@
+// Glob expansion over a generated directory with many entries: a pattern
+// matching half of them and one narrowed by its literal prefix, with the
+// listing cached and read afresh each time, against glob(3).
+#define SHELLINGTON_NO_MAIN
+#include "../shellington.c"
+#include "bench.h"
+
+#include <glob.h>
+
+void bench_glob(FILE *out, const char *name, const char *pattern, int reps, bool libc)
+{
+	uint64_t *samples=malloc(sizeof(uint64_t)*reps);
+	struct arena_t arena={0};
+	size_t count=0;
+	for (int i=-1;i<reps;++i) // one warmup, the runs are long
+	{
+		uint64_t start=bench_now_ns();
+		if (libc)
+		{
+			glob_t g;
+			glob(pattern, 0, NULL, &g);
+			count=g.gl_pathc;
+			globfree(&g);
+		}
+		else
+		{
+			free(glob_expand(pattern, &arena, &count));
+			arena_reset(&arena);
+		}
+		if (i>=0) samples[i]=bench_now_ns()-start;
+	}
+	bench_report(out, name, samples, reps);
+	fprintf(out, "%-32s %zu matches\n", "", count);
+	arena_free(&arena);
+	free(samples);
+}
+
+int main()
+{
+	bench_init();
+	// BENCH_FILES sets the number of entries in the generated directory.
+	const char *env=getenv("BENCH_FILES");
+	int files=env?atoi(env):100000;
+	char dir[]="/tmp/bench_globXXXXXX";
+	if (!mkdtemp(dir)) return 1;
+	char path[256];
+	for (int i=0;i<files;++i)
+	{
+		snprintf(path, sizeof(path), "%s/app-%06d.%s", dir, i*7919%1000003, i%2?"log":"gz");
+		close(open(path, O_WRONLY|O_CREAT, 0644));
+	}
+	prompt_init();
+	shell_chdir(dir);
+	// every run goes over the whole directory, far fewer of them
+	int reps=bench_reps/20?bench_reps/20:1;
+
+	bench_glob(stdout, "glob/all/cached", "*.log", reps, false);
+	dir_cache_off=true;
+	bench_glob(stdout, "glob/all/uncached", "*.log", reps, false);
+	dir_cache_off=false;
+	bench_glob(stdout, "glob/all/glob3", "*.log", reps, true);
+	bench_glob(stdout, "glob/prefix/cached", "app-0012*.log", bench_reps, false);
+	bench_glob(stdout, "glob/prefix/glob3", "app-0012*.log", reps, true);
+
+	for (int i=0;i<files;++i)
+	{
+		snprintf(path, sizeof(path), "%s/app-%06d.%s", dir, i*7919%1000003, i%2?"log":"gz");
+		unlink(path);
+	}
+	rmdir(dir);
+	return 0;
+}
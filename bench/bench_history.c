@@ -0,0 +1,71 @@
+// History: load time of a large history file and reverse search latency,
+// with the trigram filters and with a plain scan of every entry.
+#define SHELLINGTON_NO_MAIN
+#include "../shellington.c"
+#include "bench.h"
+
+// Every entry, newest first, the way the search walked before the index.
+long linear_search(const char *query, size_t qlen)
+{
+	for (long i=(long)history.count-1; i>=0; i--)
+	{
+		size_t len;
+		const char *text=history_entry(i, &len);
+		if (memmem(text, len, query, qlen)) return i;
+	}
+	return -1;
+}
+
+volatile long search_result;
+
+void bench_search(FILE *out, const char *name, const char *query, bool indexed)
+{
+	size_t qlen=strlen(query);
+	uint64_t *samples=malloc(sizeof(uint64_t)*bench_reps);
+	for (int i=-bench_warmup;i<bench_reps;++i)
+	{
+		uint64_t start=bench_now_ns();
+		search_result=indexed?history_search(query, qlen, history.count-1):linear_search(query, qlen);
+		uint64_t elapsed=bench_now_ns()-start;
+		if (i>=0) samples[i]=elapsed;
+	}
+	bench_report(out, name, samples, bench_reps);
+	free(samples);
+}
+
+int main()
+{
+	bench_init();
+	// BENCH_HISTORY sets the number of entries in the generated file.
+	const char *env=getenv("BENCH_HISTORY");
+	long entries=env?atol(env):1000000;
+	char path[]="/tmp/bench_historyXXXXXX";
+	int fd=mkstemp(path);
+	FILE *file=fdopen(fd, "w");
+	const char *verbs[]={"git log --oneline", "make -j8", "ls -la", "cd src/module", "grep -rn TODO", "ssh build"};
+	for (long i=0;i<entries;++i)
+		fprintf(file, "%s %ld-%ld\n", verbs[i%6], i*7919%100003, i);
+	fprintf(file, "kubectl rollout restart deploy/payments\n");
+	for (long i=0;i<1000;++i)
+		fprintf(file, "%s %ld\n", verbs[i%6], i);
+	fclose(file);
+
+	setenv("SHELLINGTON_HISTFILE", path, 1);
+	uint64_t start=bench_now_ns();
+	history_load();
+	uint64_t loaded=bench_now_ns();
+	history_index();
+	uint64_t indexed=bench_now_ns();
+	fprintf(stdout, "%-32s %zu entries, load %.1f ms, index %.1f ms\n", "history/file", history.count,
+		(loaded-start)/1e6, (indexed-loaded)/1e6);
+
+	// a plain scan takes tens of ms, so fewer rounds unless BENCH_REPS says otherwise
+	if (!getenv("BENCH_REPS")) bench_reps=50, bench_warmup=5;
+	bench_search(stdout, "history/rare/indexed", "rollout restart", true);
+	bench_search(stdout, "history/rare/linear", "rollout restart", false);
+	bench_search(stdout, "history/missing/indexed", "terraform apply", true);
+	bench_search(stdout, "history/missing/linear", "terraform apply", false);
+	bench_search(stdout, "history/recent/indexed", "make -j8", true);
+	unlink(path);
+	return 0;
+}
@@ -0,0 +1,52 @@
+// Parser throughput: lines per second through parse_command and free_command
+// for a short interactive line, a quoted pipeline and a generated line with
+// thousands of file arguments.
+#define SHELLINGTON_NO_MAIN
+#include "../shellington.c"
+#include "bench.h"
+
+void bench_line(FILE *out, const char *name, const char *line)
+{
+	size_t len=strlen(line);
+	char *buf=malloc(len+1);
+	uint64_t *samples=malloc(sizeof(uint64_t)*bench_reps);
+	uint64_t total=0;
+
+	for (int i=-bench_warmup;i<bench_reps;++i)
+	{
+		memcpy(buf, line, len+1); // parse_command may write to its input
+		uint64_t start=bench_now_ns();
+		struct command_t *command=new_command(&line_arena);
+		parse_command(buf, command);
+		free_command(command);
+		uint64_t elapsed=bench_now_ns()-start;
+		if (i<0) continue;
+		samples[i]=elapsed;
+		total+=elapsed;
+	}
+	bench_report(out, name, samples, bench_reps);
+	fprintf(out, "%-32s %.0f lines/s, %.1f MB/s\n", "", bench_reps*1e9/total,
+		(double)len*bench_reps*1e3/total);
+	free(samples);
+	free(buf);
+}
+
+int main()
+{
+	bench_init();
+	bench_line(stdout, "parse/short", "ls -l /tmp");
+	bench_line(stdout, "parse/pipeline", "grep -v \"some thing\" 'file name.log' | sort -k2 > \"out put.txt\" &");
+
+	// BENCH_ARGS sets the number of file arguments in the generated line.
+	const char *env=getenv("BENCH_ARGS");
+	int args=env?atoi(env):5000;
+	char *line=malloc(args*32+16), *p=line;
+	p+=sprintf(p, "tar czf out.tgz");
+	for (int i=0;i<args;++i)
+		p+=sprintf(p, " logs/2024/app-%06d.log", i);
+	char name[64];
+	snprintf(name, sizeof(name), "parse/args%d", args);
+	bench_line(stdout, name, line);
+	free(line);
+	return 0;
+}
@@ -0,0 +1,85 @@
+// Pipelines through process_command: latency of a two stage pipeline of
+// trivial commands, throughput of BENCH_PIPE_MB (default 64) MB pushed
+// through cat stages, builtin and external, and parallel fanning out tasks.
+#define SHELLINGTON_NO_MAIN
+#include "../shellington.c"
+#include "bench.h"
+
+#include <fcntl.h>
+
+/**
+ * Run one line through process_command, parsing it once.
+ * @return elapsed ns of each run in samples
+ */
+void bench_pipeline(FILE *out, const char *name, const char *line, int reps, uint64_t *samples)
+{
+	char *buf=strdup(line);
+	struct arena_t arena={0};
+	struct command_t *command=new_command(&arena);
+	parse_command(buf, command);
+	for (int i=-bench_warmup;i<reps;++i)
+	{
+		uint64_t start=bench_now_ns();
+		process_command(command);
+		if (i>=0) samples[i]=bench_now_ns()-start;
+	}
+	bench_report(out, name, samples, reps);
+	free_command(command);
+	arena_free(&arena);
+	free(buf);
+}
+
+int main()
+{
+	bench_init();
+	jobs_init(); // children are reaped through the SIGCHLD signalfd
+	// the last stage writes to the shell's stdout, which is /dev/null here
+	FILE *out=fdopen(dup(STDOUT_FILENO), "w");
+	int devnull=open("/dev/null", O_WRONLY);
+	dup2(devnull, STDOUT_FILENO);
+	uint64_t *samples=malloc(sizeof(uint64_t)*bench_reps);
+
+	bench_pipeline(out, "pipeline/true|true", "/bin/true | /bin/true", bench_reps, samples);
+
+	const char *env=getenv("BENCH_PIPE_MB");
+	size_t mb=env?atoi(env):64;
+	char path[]="/tmp/bench_pipelineXXXXXX";
+	int fd=mkstemp(path);
+	char block[1<<16];
+	memset(block, 'x', sizeof(block));
+	for (size_t i=0;i<mb*16;++i)
+		write_all(fd, block, sizeof(block));
+	close(fd);
+
+	// each run moves the whole file, a handful is enough
+	int reps=bench_reps<20?bench_reps:20, warmup=bench_warmup;
+	bench_warmup=1;
+	const char *lines[][2]={
+		{"pipeline/cat|cat", "cat %s | cat"},
+		{"pipeline/cat|/bin/cat", "cat %s | /bin/cat"},
+		{"pipeline/cat|cat|cat|cat", "cat %s | cat | cat | cat"},
+	};
+	for (size_t i=0;i<sizeof(lines)/sizeof(lines[0]);++i)
+	{
+		char line[256];
+		snprintf(line, sizeof(line), lines[i][1], path);
+		bench_pipeline(out, lines[i][0], line, reps, samples);
+		fprintf(out, "%-32s %.0f MB/s\n", "", mb*1e9/samples[reps/2]);
+	}
+	bench_warmup=warmup;
+	unlink(path);
+
+	// 64 short tasks through parallel, one at a time and a CPU each
+	char items[64*4+16]=":::", *p=items+3;
+	for (int i=0;i<64;++i)
+		p+=sprintf(p, " %d", i);
+	char line[512];
+	snprintf(line, sizeof(line), "parallel -j 1 /bin/true %s", items);
+	bench_pipeline(out, "parallel/64-true/-j1", line, reps, samples);
+	snprintf(line, sizeof(line), "parallel /bin/true %s", items);
+	bench_pipeline(out, "parallel/64-true/-jcpus", line, reps, samples);
+
+	fclose(out);
+	free(samples);
+	return 0;
+}
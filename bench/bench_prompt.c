@@ -0,0 +1,37 @@
+// Prompt rendering: show_prompt with the rendered prompt reused, and with it
+// rebuilt every time as after a cd. The prompt goes to /dev/null.
+#define SHELLINGTON_NO_MAIN
+#include "../shellington.c"
+#include "bench.h"
+
+#include <fcntl.h>
+
+int main()
+{
+	bench_init();
+	FILE *out=fdopen(dup(STDOUT_FILENO), "w");
+	int devnull=open("/dev/null", O_WRONLY);
+	dup2(devnull, STDOUT_FILENO);
+	uint64_t *samples=malloc(sizeof(uint64_t)*bench_reps);
+
+	for (int i=-bench_warmup;i<bench_reps;++i)
+	{
+		uint64_t start=bench_now_ns();
+		show_prompt();
+		if (i>=0) samples[i]=bench_now_ns()-start;
+	}
+	bench_report(out, "prompt/cached", samples, bench_reps);
+
+	for (int i=-bench_warmup;i<bench_reps;++i)
+	{
+		uint64_t start=bench_now_ns();
+		shell_chdir(".");
+		show_prompt();
+		if (i>=0) samples[i]=bench_now_ns()-start;
+	}
+	bench_report(out, "prompt/after-cd", samples, bench_reps);
+
+	fclose(out);
+	free(samples);
+	return 0;
+}
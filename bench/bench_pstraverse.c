@@ -0,0 +1,72 @@
+// pstraverse: taking a snapshot of /proc, and walking a cached one, with
+// BENCH_PROCS extra processes (default 1000) sleeping under this one.
+#define SHELLINGTON_NO_MAIN
+#include "../shellington.c"
+#include "bench.h"
+
+#include <fcntl.h>
+
+int main()
+{
+	bench_init();
+	const char *env=getenv("BENCH_PROCS");
+	int procs=env?atoi(env):1000;
+	pid_t *kids=malloc(sizeof(pid_t)*(procs?procs:1));
+	for (int i=0;i<procs;++i)
+		if ((kids[i]=fork())==0)
+		{
+			pause();
+			_exit(0);
+		}
+
+	FILE *out=fdopen(dup(STDOUT_FILENO), "w");
+	int devnull=open("/dev/null", O_WRONLY);
+	dup2(devnull, STDOUT_FILENO);
+
+	char line[64];
+	snprintf(line, sizeof(line), "pstraverse %d -m", getpid());
+	struct command_t *cached=new_command(&line_arena);
+	parse_command(line, cached);
+	char fresh_line[64];
+	snprintf(fresh_line, sizeof(fresh_line), "pstraverse %d -m -r", getpid());
+	struct command_t *fresh=new_command(&line_arena);
+	parse_command(fresh_line, fresh);
+
+	uint64_t *samples=malloc(sizeof(uint64_t)*bench_reps);
+	char name[64];
+	for (int i=0;i<bench_warmup;++i)
+		process_command(fresh);
+	for (int i=0;i<bench_reps;++i)
+	{
+		uint64_t start=bench_now_ns();
+		process_command(fresh);
+		samples[i]=bench_now_ns()-start;
+	}
+	fflush(stdout);
+	bench_report(out, "pstraverse/snapshot", samples, bench_reps);
+	fprintf(out, "%-32s %zu processes\n", "", ps_snapshot.count);
+
+	for (int i=0;i<bench_warmup;++i)
+		process_command(cached);
+	for (int i=0;i<bench_reps;++i)
+	{
+		uint64_t start=bench_now_ns();
+		process_command(cached);
+		samples[i]=bench_now_ns()-start;
+	}
+	fflush(stdout);
+	snprintf(name, sizeof(name), "pstraverse/cached/%d-children", procs);
+	bench_report(out, name, samples, bench_reps);
+
+	for (int i=0;i<procs;++i)
+	{
+		kill(kids[i], SIGKILL);
+		waitpid(kids[i], NULL, 0);
+	}
+	free(kids);
+	free(samples);
+	free_command(cached);
+	free_command(fresh);
+	fclose(out);
+	return 0;
+}
@@ -0,0 +1,86 @@
+// Spawn latency of external commands: posix_spawn, fork+execv and the zygote,
+// first with the shell's heap as it is at startup and again after growing it,
+// the way a long session with many aliases, bookmarks and history entries would.
+// Also run's settings applied in the child, against wrapping the command in
+// taskset, nice and ionice.
+#define SHELLINGTON_NO_MAIN
+#include "../shellington.c"
+#include "bench.h"
+
+typedef int (*launcher_fn)(struct launch_t *launch, pid_t *pid);
+
+void bench_launcher(FILE *out, const char *name, launcher_fn fn, struct launch_t *launch)
+{
+	uint64_t *samples=malloc(sizeof(uint64_t)*bench_reps);
+	pid_t pid;
+	for (int i=0;i<bench_warmup;++i)
+	{
+		fn(launch, &pid);
+		waitpid(pid, NULL, 0);
+	}
+	for (int i=0;i<bench_reps;++i)
+	{
+		uint64_t start=bench_now_ns();
+		if (fn(launch, &pid)!=0)
+		{
+			fprintf(stderr, "%s: launch failed\n", name);
+			exit(1);
+		}
+		waitpid(pid, NULL, 0);
+		samples[i]=bench_now_ns()-start;
+	}
+	bench_report(out, name, samples, bench_reps);
+	free(samples);
+}
+
+int main()
+{
+	bench_init();
+	zygote_start(); // as the shell does at startup, while the heap is small
+	// BENCH_HEAP_MB sets how much the heap is grown for the second round.
+	const char *env=getenv("BENCH_HEAP_MB");
+	size_t heap_mb=env?atoi(env):256;
+
+	const char *path=resolve_command("true");
+	if (!path)
+	{
+		fprintf(stderr, "true: not found in PATH\n");
+		return 1;
+	}
+	char *argv[]={"true", NULL};
+	struct launch_t launch={.path=path, .argv=argv, .fds={-1, -1, -1}, .pgid=-1};
+
+	bench_launcher(stdout, "spawn/posix_spawn", launch_spawn, &launch);
+	bench_launcher(stdout, "spawn/fork", launch_fork, &launch);
+	bench_launcher(stdout, "spawn/zygote", launch_zygote, &launch);
+
+	// run -c 0 -n 5 -i idle true
+	struct run_t run={.affinity=true, .nice=true, .nice_value=5, .policy=-1,
+		.ioprio=RUN_IOPRIO_CLASS_IDLE<<RUN_IOPRIO_CLASS_SHIFT};
+	CPU_ZERO(&run.cpus);
+	CPU_SET(0, &run.cpus);
+	launch.run=&run;
+	bench_launcher(stdout, "spawn/run/fork", launch_fork, &launch);
+	bench_launcher(stdout, "spawn/run/zygote", launch_zygote, &launch);
+	launch.run=NULL;
+	const char *taskset=resolve_command("taskset");
+	if (taskset && resolve_command("nice") && resolve_command("ionice"))
+	{
+		char *wrapped[]={"taskset", "-c", "0", "nice", "-n", "5", "ionice", "-c", "3", "true", NULL};
+		struct launch_t wrapper={.path=taskset, .argv=wrapped, .fds={-1, -1, -1}, .pgid=-1};
+		bench_launcher(stdout, "spawn/run/taskset-nice-ionice", launch_spawn, &wrapper);
+	}
+
+	// touch every page so the heap is really mapped
+	char *heap=malloc(heap_mb<<20);
+	memset(heap, 1, heap_mb<<20);
+	char name[64];
+	snprintf(name, sizeof(name), "spawn/posix_spawn/heap%zuM", heap_mb);
+	bench_launcher(stdout, name, launch_spawn, &launch);
+	snprintf(name, sizeof(name), "spawn/fork/heap%zuM", heap_mb);
+	bench_launcher(stdout, name, launch_fork, &launch);
+	snprintf(name, sizeof(name), "spawn/zygote/heap%zuM", heap_mb);
+	bench_launcher(stdout, name, launch_zygote, &launch);
+	free(heap);
+	return 0;
+}
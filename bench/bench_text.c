@@ -0,0 +1,120 @@
+// Text builtins: GB/s of the newline, word and fixed string kernels for each
+// instruction set, then wc -l, grep -F, head and tail on a BENCH_TEXT_MB
+// (default 64) MB log file, builtin against the program in /usr/bin. grep
+// writes to a file: GNU grep stops at the first match when output is /dev/null.
+#define SHELLINGTON_NO_MAIN
+#include "../shellington.c"
+#include "bench.h"
+
+#include <fcntl.h>
+
+void bench_kernel(FILE *out, const char *name, int kind, const char *data, size_t len, uint64_t *samples, int reps)
+{
+	volatile size_t sink=0;
+	for (int i=-1;i<reps;++i)
+	{
+		bool word=false;
+		uint64_t start=bench_now_ns();
+		if (kind==0) sink+=count_byte(data, len, '\n');
+		else if (kind==1) sink+=count_words(data, len, &word);
+		else sink+=(size_t)find_fixed(data, len, "no such line", 12);
+		if (i>=0) samples[i]=bench_now_ns()-start;
+	}
+	bench_report(out, name, samples, reps);
+	fprintf(out, "%-32s %.2f GB/s\n", "", len/(double)samples[reps/2]);
+}
+
+void bench_line(FILE *out, const char *name, const char *line, uint64_t *samples, int reps)
+{
+	char *buf=strdup(line);
+	struct arena_t arena={0};
+	struct command_t *command=new_command(&arena);
+	parse_command(buf, command);
+	for (int i=-1;i<reps;++i)
+	{
+		uint64_t start=bench_now_ns();
+		process_command(command);
+		if (i>=0) samples[i]=bench_now_ns()-start;
+	}
+	bench_report(out, name, samples, reps);
+	free_command(command);
+	arena_free(&arena);
+	free(buf);
+}
+
+int main()
+{
+	bench_init();
+	jobs_init();
+	FILE *out=fdopen(dup(STDOUT_FILENO), "w");
+	int devnull=open("/dev/null", O_WRONLY);
+	dup2(devnull, STDOUT_FILENO);
+
+	const char *env=getenv("BENCH_TEXT_MB");
+	size_t mb=env?atoi(env):64;
+	char path[]="/tmp/bench_textXXXXXX";
+	FILE *file=fdopen(mkstemp(path), "w");
+	const char *levels[]={"INFO", "DEBUG", "WARN", "INFO"};
+	for (size_t i=0;ftell(file)<(long)(mb<<20);++i)
+		fprintf(file, "2024-05-01T12:%02zu:%02zu %s worker-%zu request %zu took %zu ms\n",
+			i/60%60, i%60, levels[i%4], i%16, i, i*7%500);
+	fclose(file);
+
+	int fd=open(path, O_RDONLY);
+	size_t len=mb<<20;
+	char *data=mmap(NULL, len, PROT_READ, MAP_PRIVATE|MAP_POPULATE, fd, 0);
+	int reps=bench_reps<20?bench_reps:20;
+	uint64_t *samples=malloc(sizeof(uint64_t)*reps);
+
+	const char *sets[]={"scalar", "sse2", "avx2"};
+	for (int set=0;set<3;++set)
+	{
+#if defined(__x86_64__)
+		if (set==0) count_byte=count_byte_scalar, count_words=count_words_scalar, find_fixed=find_fixed_scalar;
+		if (set==1) count_byte=count_byte_sse2, count_words=count_words_sse2, find_fixed=find_fixed_sse2;
+		if (set==2 && !__builtin_cpu_supports("avx2")) continue;
+		if (set==2) count_byte=count_byte_avx2, count_words=count_words_avx2, find_fixed=find_fixed_avx2;
+#else
+		if (set>0) continue;
+		text_kernels_init();
+#endif
+		const char *kernels[]={"lines", "words", "find"};
+		for (int kind=0;kind<3;++kind)
+		{
+			char name[64];
+			snprintf(name, sizeof(name), "text/%s/%s", kernels[kind], sets[set]);
+			bench_kernel(out, name, kind, data, len, samples, reps);
+		}
+	}
+	munmap(data, len);
+	close(fd);
+	count_byte=NULL;
+	text_kernels_init();
+
+	const char *lines[][2]={
+		{"text/wc-l/builtin", "wc -l %s"},
+		{"text/wc-l/external", "/usr/bin/wc -l %s"},
+		{"text/grep-F/builtin", "grep -F WARN %s > %s.out"},
+		{"text/grep-F/external", "/usr/bin/grep -F WARN %s > %s.out"},
+		{"text/grep-c/builtin", "grep -c \"request 123\" %s > %s.out"},
+		{"text/grep-c/external", "/usr/bin/grep -c \"request 123\" %s > %s.out"},
+		{"text/cat|wc-l/builtin", "cat %s | wc -l"},
+		{"text/cat|wc-l/external", "cat %s | /usr/bin/wc -l"},
+		{"text/head/builtin", "head -n 1000 %s"},
+		{"text/head/external", "/usr/bin/head -n 1000 %s"},
+		{"text/tail/builtin", "tail -n 1000 %s"},
+		{"text/tail/external", "/usr/bin/tail -n 1000 %s"},
+	};
+	for (size_t i=0;i<sizeof(lines)/sizeof(lines[0]);++i)
+	{
+		char line[256];
+		snprintf(line, sizeof(line), lines[i][1], path, path);
+		bench_line(out, lines[i][0], line, samples, reps);
+	}
+	unlink(path);
+	strcat(path, ".out");
+	unlink(path);
+	fclose(out);
+	free(samples);
+	return 0;
+}
@@ -0,0 +1,61 @@
+// Reminders: one added with remindme fires through the notifier command,
+// here notify_stub.sh, once its timer expires, and a one-shot reminder is
+// gone from the heap and the log afterwards. Runs in a fresh directory so
+// no reminders of a real session are touched. Exits 1 on failure.
+#define SHELLINGTON_NO_MAIN
+#include "../shellington.c"
+
+int main()
+{
+	char stub[PATH_MAX], dir[]="/tmp/check_reminders.XXXXXX", notified[PATH_MAX+16];
+	if (!realpath("notify_stub.sh", stub) || !mkdtemp(dir) || chdir(dir)==-1)
+	{
+		perror("check_reminders");
+		return 1;
+	}
+	getcwd(init_dir, sizeof(init_dir));
+	snprintf(notified, sizeof(notified), "%s/notified", dir);
+	setenv("SHELLINGTON_NOTIFIER", stub, 1);
+	setenv("NOTIFY_STUB_LOG", notified, 1);
+	jobs_init();
+	reminders_init();
+
+	char *args[]={"in", "1s", "stub", "message", NULL};
+	struct command_t command={0};
+	command.name="remindme";
+	command.args=args;
+	command.arg_count=4;
+	if (builtin_remindme(&command)!=SUCCESS || reminders.count!=1)
+	{
+		fprintf(stderr, "reminders: remindme did not add the reminder\n");
+		return 1;
+	}
+	struct pollfd pfd={reminder_fd, POLLIN, 0};
+	if (poll(&pfd, 1, 5000)!=1)
+	{
+		fprintf(stderr, "reminders: the timer did not expire\n");
+		return 1;
+	}
+	reminders_fire();
+	while (wait(NULL)>0); // the notifier
+
+	char line[64]="";
+	FILE *f=fopen(notified, "r");
+	if (!f || !fgets(line, sizeof(line), f) || strcmp(line, "stub message\n")!=0)
+	{
+		fprintf(stderr, "reminders: the notifier got \"%s\", not \"stub message\"\n", line);
+		return 1;
+	}
+	fclose(f);
+	if (reminders.count!=0 || reminders.removed!=1)
+	{
+		fprintf(stderr, "reminders: the fired reminder is still scheduled\n");
+		return 1;
+	}
+	unlink(notified);
+	unlink("reminders.log");
+	unlink("reminders.lock");
+	rmdir(dir);
+	printf("reminders: fired through the stub notifier\n");
+	return 0;
+}
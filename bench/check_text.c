@@ -0,0 +1,78 @@
+// Text kernels: the scalar, SSE2 and AVX2 versions of count_byte, count_words
+// and find_fixed must agree. Inputs of many lengths and alignments, dense and
+// sparse in the byte counted, and one long enough to fold every counter lane
+// more than once. Exits 1 on the first disagreement.
+#define SHELLINGTON_NO_MAIN
+#include "../shellington.c"
+
+struct kernels_t {
+	const char *name;
+	size_t (*count_byte)(const char *p, size_t n, unsigned char c);
+	size_t (*count_words)(const char *p, size_t n, bool *in_word);
+	const char *(*find_fixed)(const char *p, size_t n, const char *needle, size_t m);
+};
+
+int failures;
+
+void check(const struct kernels_t *k, const char *data, size_t len, const char *what)
+{
+	size_t lines=count_byte_scalar(data, len, '\n');
+	bool word=false, in_word=false;
+	size_t words=count_words_scalar(data, len, &word);
+	const char *needles[]={"x", "needle", "\n\n", "no such text anywhere"};
+	if (k->count_byte(data, len, '\n')!=lines)
+	{
+		fprintf(stderr, "%s: count_byte differs on %s (%zu bytes)\n", k->name, what, len);
+		failures++;
+	}
+	if (k->count_words(data, len, &in_word)!=words || in_word!=word)
+	{
+		fprintf(stderr, "%s: count_words differs on %s (%zu bytes)\n", k->name, what, len);
+		failures++;
+	}
+	for (size_t i=0;i<sizeof(needles)/sizeof(needles[0]);++i)
+		if (k->find_fixed(data, len, needles[i], strlen(needles[i]))!=find_fixed_scalar(data, len, needles[i], strlen(needles[i])))
+		{
+			fprintf(stderr, "%s: find_fixed \"%s\" differs on %s (%zu bytes)\n", k->name, needles[i], what, len);
+			failures++;
+		}
+}
+
+int main()
+{
+	struct kernels_t sets[3];
+	int count=0;
+#if defined(__x86_64__)
+	sets[count++]=(struct kernels_t){"sse2", count_byte_sse2, count_words_sse2, find_fixed_sse2};
+	if (__builtin_cpu_supports("avx2"))
+		sets[count++]=(struct kernels_t){"avx2", count_byte_avx2, count_words_avx2, find_fixed_avx2};
+#endif
+	// past 255 blocks per fold in both lanes, the case that once lost counts
+	size_t big=2000000;
+	char *data=malloc(big+64);
+	memset(data, '\n', big+64);
+	for (int k=0;k<count;++k)
+		check(&sets[k], data, big, "newlines only");
+
+	unsigned seed=1;
+	const char alphabet[]="ab x\n\t needle\r\v";
+	for (size_t i=0;i<big+64;++i)
+	{
+		seed=seed*1103515245+12345;
+		data[i]=alphabet[(seed>>16)%(sizeof(alphabet)-1)];
+	}
+	for (int k=0;k<count;++k)
+	{
+		check(&sets[k], data, big, "mixed text");
+		for (size_t len=0;len<300;++len)
+			for (size_t offset=0;offset<32;offset+=7)
+				check(&sets[k], data+offset, len, "short text");
+	}
+	free(data);
+	if (failures) return 1;
+	printf("text kernels: scalar");
+	for (int k=0;k<count;++k)
+		printf(", %s", sets[k].name);
+	printf(" agree\n");
+	return 0;
+}
@@ -0,0 +1,36 @@
+#!/bin/sh
+# Compare two bench outputs by the p50 of each result. Prints every result
+# with its change and exits 1 if any got slower by more than BENCH_TOLERANCE
+# percent (default 15). Results missing from either side are listed, not failed.
+# usage: compare.sh baseline.txt results.txt
+base=${1:-baseline.txt}
+new=${2:-results.txt}
+tolerance=${BENCH_TOLERANCE:-15}
+
+awk -v tolerance="$tolerance" '
+	function p50(line,  i, n, f) {
+		n=split(line, f, " ")
+		for (i=1;i<=n;i++)
+			if (f[i] ~ /^p50=/) return substr(f[i], 5)+0
+		return -1
+	}
+	FNR==1 { file++ }
+	/p50=/ {
+		if (file==1) base[$1]=p50($0)
+		else { now[$1]=p50($0); order[++count]=$1 }
+	}
+	END {
+		failed=0
+		for (i=1;i<=count;i++) {
+			name=order[i]
+			if (!(name in base)) { printf "%-32s %12d ns  (new)\n", name, now[name]; continue }
+			change=base[name]?(now[name]-base[name])*100/base[name]:0
+			mark=""
+			if (change>tolerance) { mark="  REGRESSION"; failed=1 }
+			printf "%-32s %12d ns  %12d ns  %+6.1f%%%s\n", name, base[name], now[name], change, mark
+		}
+		for (name in base)
+			if (!(name in now)) printf "%-32s %12d ns  (missing)\n", name, base[name]
+		exit failed
+	}
+' "$base" "$new"
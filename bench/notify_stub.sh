@@ -0,0 +1,4 @@
+#!/bin/sh
+# Stand-in for notify-send in checks: SHELLINGTON_NOTIFIER points here, and
+# each notification is appended as a line to $NOTIFY_STUB_LOG.
+printf '%s\n' "$*" >> "$NOTIFY_STUB_LOG"
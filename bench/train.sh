@@ -0,0 +1,22 @@
+# Training run for "make pgo": the shell runs this in batch mode from an empty
+# directory, so the profile covers parsing, builtins, pipelines and spawning
+# the way an ordinary session would.
+cd .
+short set here
+short jump here
+bookmark "ls -l /tmp"
+bookmark "echo 'a quoted argument' | cat"
+bookmark -l
+bookmark -i 1
+bookmark -d 0
+hash
+ls -l /tmp > /dev/null
+echo one two three | cat | cat > /dev/null
+grep -v "some thing" /etc/passwd | sort -k2 > sorted.txt
+cat sorted.txt sorted.txt | tee copy.txt | wc -l
+head -c 1048576 /dev/zero | cat | cat | cat > /dev/null
+/bin/true | /bin/true
+pstraverse 1 -m > /dev/null
+pstraverse 1 -b -r > /dev/null
+sleep 0 &
+exit 0
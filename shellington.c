@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <sys/wait.h>
 #include <stdio.h>
@@ -10,6 +11,33 @@
 // Additional includes
 #include <time.h>
 #include <ctype.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <spawn.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pwd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/uio.h>
+#include <sys/timerfd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sched.h>
+#include <sys/inotify.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 // Color definations for printf colorizing
 #define COLOR_RED     "\x1b[31m"
@@ -26,10 +54,6 @@ const char * sysname = "shellington";
 // Save the directory where first shellington is executed.
 char init_dir[1024];
 
-//Variables for storing data for short command.
-char **alias, **wd;
-int *saveCount;
-
 // Counter for custom command rps
 int *rps_counter;
 
@@ -38,15 +62,122 @@ enum return_codes {
 	EXIT = 1,
 	UNKNOWN = 2,
 };
+// Bump allocator for everything that lives as long as one input line.
+// Resetting it releases a whole parsed command at once.
+struct arena_block_t {
+	struct arena_block_t *next;
+	size_t size, used;
+	_Alignas(max_align_t) char data[];
+};
+struct arena_t {
+	struct arena_block_t *first, *current;
+};
+#define ARENA_BLOCK_SIZE 8192
+#define ARENA_KEEP_SIZE (1<<20) // memory kept for reuse across resets
+
 struct command_t {
 	char *name;
 	bool background;
 	bool auto_complete;
 	int arg_count;
-	char **args;
+	char **args; // arguments after the name, args[arg_count] is NULL
+	char **argv; // name followed by args, ready for exec
+	char **patterns; // glob pattern of each argv word that has one, NULL if none do
 	char *redirects[3]; // in/out redirection
 	struct command_t *next; // for piping
+	struct arena_t *arena; // owns the command, its strings and the next stages
 };
+struct arena_t line_arena;
+
+/**
+ * Allocate size bytes from the arena, aligned for any type.
+ * @param  arena [description]
+ * @param  size  [description]
+ * @return       [description]
+ */
+void *arena_alloc(struct arena_t *arena, size_t size)
+{
+	size=(size+_Alignof(max_align_t)-1)&~(_Alignof(max_align_t)-1);
+	struct arena_block_t *block=arena->current;
+	while (block && block->used+size>block->size)
+	{
+		// blocks kept from before a reset are empty, move on to the next one
+		if (!block->next || block->next->size<size) break;
+		block=block->next;
+	}
+	if (!block || block->used+size>block->size)
+	{
+		size_t block_size=ARENA_BLOCK_SIZE;
+		if (block && block->size*2>block_size) block_size=block->size*2;
+		if (size>block_size) block_size=size;
+		struct arena_block_t *fresh=malloc(sizeof(struct arena_block_t)+block_size);
+		fresh->size=block_size;
+		fresh->used=0;
+		if (block)
+		{
+			fresh->next=block->next;
+			block->next=fresh;
+		}
+		else
+		{
+			fresh->next=arena->first;
+			arena->first=fresh;
+		}
+		block=fresh;
+	}
+	arena->current=block;
+	void *ptr=block->data+block->used;
+	block->used+=size;
+	return ptr;
+}
+char *arena_strdup(struct arena_t *arena, const char *str)
+{
+	size_t len=strlen(str)+1;
+	return memcpy(arena_alloc(arena, len), str, len);
+}
+// Release everything allocated from the arena in one step.
+void arena_reset(struct arena_t *arena)
+{
+	size_t kept=0;
+	struct arena_block_t **link=&arena->first;
+	while (*link)
+	{
+		struct arena_block_t *block=*link;
+		if (kept+block->size>ARENA_KEEP_SIZE && kept>0)
+		{
+			*link=block->next;
+			free(block);
+			continue;
+		}
+		kept+=block->size;
+		block->used=0;
+		link=&block->next;
+	}
+	arena->current=arena->first;
+}
+// Give all of the arena's memory back.
+void arena_free(struct arena_t *arena)
+{
+	while (arena->first)
+	{
+		struct arena_block_t *next=arena->first->next;
+		free(arena->first);
+		arena->first=next;
+	}
+	arena->current=NULL;
+}
+/**
+ * Allocate an empty command owned by the arena.
+ * @param  arena [description]
+ * @return       [description]
+ */
+struct command_t *new_command(struct arena_t *arena)
+{
+	struct command_t *command=arena_alloc(arena, sizeof(struct command_t));
+	memset(command, 0, sizeof(struct command_t));
+	command->arena=arena;
+	return command;
+}
 /**
  * Prints a command struct
  * @param struct command_t *
@@ -72,794 +203,6991 @@ void print_command(struct command_t * command)
 
 }
 /**
- * Release allocated memory of a command
+ * Release allocated memory of a command. Everything it points to lives in
+ * its arena, so this resets the arena and frees any other command in it too.
  * @param  command [description]
  * @return         [description]
  */
 int free_command(struct command_t *command)
 {
-	if (command->arg_count)
-	{
-		for (int i=0; i<command->arg_count; ++i)
-			free(command->args[i]);
-		free(command->args);
-	}
-	for (int i=0;i<3;++i)
-		if (command->redirects[i])
-			free(command->redirects[i]);
-	if (command->next)
-	{
-		free_command(command->next);
-		command->next=NULL;
-	}
-	free(command->name);
-	free(command);
+	arena_reset(command->arena);
 	return 0;
 }
 /**
- * Show the command prompt
- * @return [description]
+ * FNV-1a hash of a string, used by the shell's hash tables.
+ * @param  s [description]
+ * @return   [description]
  */
-int show_prompt()
+unsigned long hash_string(const char *s)
 {
-	char cwd[1024], hostname[1024];
-    gethostname(hostname, sizeof(hostname));
-	getcwd(cwd, sizeof(cwd));
-
-	// Colorizing the promp.
-	printf(COLOR_GREEN);
-	printf("%s@%s:", getenv("USER"), hostname); 
-	printf(COLOR_RESET);
-	printf(COLOR_BLUE);
-	printf("%s ", cwd);
-	printf(COLOR_RESET);
-	printf(COLOR_CYAN);
-	printf("%s$ ", sysname);
-	printf(COLOR_RESET);
-	return 0;
+	unsigned long h=14695981039346656037UL;
+	for (; *s; ++s)
+	{
+		h^=(unsigned char)*s;
+		h*=1099511628211UL;
+	}
+	return h;
+}
+
+// PATH resolution cache. Maps a command name to the absolute path it resolved to.
+// Every entry remembers the $PATH directory it was found in, so when a directory's
+// mtime changes only the entries that directory could shadow or remove are dropped.
+struct path_dir_t {
+	char *path;
+	struct timespec mtime;
+	bool exists;
+};
+struct path_entry_t {
+	char *name; // NULL marks an empty slot
+	char *path;
+	int dir; // index into path_dirs
+	unsigned hits;
+};
+char *path_env; // copy of $PATH the directory list was split from
+struct path_dir_t *path_dirs;
+int path_dir_count;
+struct path_entry_t *path_table; // open addressing, size is a power of two
+size_t path_table_size, path_table_used;
+
+// Insert without checking for duplicates, the caller knows the name is not present.
+void path_table_put(struct path_entry_t entry)
+{
+	size_t mask=path_table_size-1;
+	size_t i=hash_string(entry.name)&mask;
+	while (path_table[i].name)
+		i=(i+1)&mask;
+	path_table[i]=entry;
+	path_table_used++;
 }
 /**
- * Parse a command string into a command struct
- * @param  buf     [description]
- * @param  command [description]
- * @return         0
+ * Rebuild the table with the given size, dropping entries that came
+ * from directory drop_from or any directory after it.
+ * @param size      [description]
+ * @param drop_from [description]
  */
-int parse_command(char *buf, struct command_t *command)
+void path_table_rehash(size_t size, int drop_from)
 {
-	const char *splitters=" \t"; // split at whitespace
-	int index, len;
-	len=strlen(buf);
-	while (len>0 && strchr(splitters, buf[0])!=NULL) // trim left whitespace
+	struct path_entry_t *old=path_table;
+	size_t old_size=path_table_size;
+
+	path_table=calloc(size, sizeof(struct path_entry_t));
+	path_table_size=size;
+	path_table_used=0;
+	for (size_t i=0;i<old_size;++i)
 	{
-		buf++;
-		len--;
+		if (!old[i].name) continue;
+		if (old[i].dir>=drop_from)
+		{
+			free(old[i].name);
+			free(old[i].path);
+			continue;
+		}
+		path_table_put(old[i]);
 	}
-	while (len>0 && strchr(splitters, buf[len-1])!=NULL)
-		buf[--len]=0; // trim right whitespace
+	free(old);
+}
+// Forget every cached command.
+void path_cache_clear()
+{
+	path_table_rehash(path_table_size?path_table_size:64, 0);
+}
+// Stat a PATH directory, returns true if its mtime changed since it was last seen.
+bool path_dir_refresh(struct path_dir_t *dir)
+{
+	struct stat st;
+	bool exists=stat(dir->path, &st)==0;
+	bool changed=exists!=dir->exists;
+	if (exists && (st.st_mtim.tv_sec!=dir->mtime.tv_sec || st.st_mtim.tv_nsec!=dir->mtime.tv_nsec))
+		changed=true;
+	dir->exists=exists;
+	if (exists)
+		dir->mtime=st.st_mtim;
+	return changed;
+}
+// Split $PATH again if it changed since the last lookup. Resets the cache when it did.
+void path_dirs_load()
+{
+	const char *env=getenv("PATH");
+	if (env==NULL) env="/usr/local/bin:/usr/bin:/bin";
+	if (path_env && strcmp(path_env, env)==0) return;
 
-	if (len>0 && buf[len-1]=='?') // auto-complete
-		command->auto_complete=true;
-	if (len>0 && buf[len-1]=='&') // background
-		command->background=true;
+	for (int i=0;i<path_dir_count;++i)
+		free(path_dirs[i].path);
+	free(path_dirs);
+	free(path_env);
+	path_env=strdup(env);
+	path_dirs=NULL;
+	path_dir_count=0;
 
-	char *pch = strtok(buf, splitters);
-	command->name=(char *)malloc(strlen(pch)+1);
-	if (pch==NULL) {
-		command->name[0]=0;
+	const char *start=env;
+	while (1)
+	{
+		const char *end=strchr(start, ':');
+		size_t len=end?(size_t)(end-start):strlen(start);
+		path_dirs=realloc(path_dirs, sizeof(struct path_dir_t)*(path_dir_count+1));
+		struct path_dir_t *dir=&path_dirs[path_dir_count++];
+		memset(dir, 0, sizeof(*dir));
+		dir->path=len?strndup(start, len):strdup("."); // empty entry means current directory
+		path_dir_refresh(dir);
+		if (!end) break;
+		start=end+1;
 	}
-	else {
-		strcpy(command->name, pch);
+	path_cache_clear();
+}
+/**
+ * Check PATH directories 0..upto for changes, dropping every cached entry
+ * a changed directory could have shadowed or removed.
+ * @param  upto [description]
+ * @return      true if anything was dropped
+ */
+bool path_dirs_validate(int upto)
+{
+	int changed=-1;
+	for (int i=0;i<=upto && i<path_dir_count;++i)
+		if (path_dir_refresh(&path_dirs[i]) && changed==-1)
+			changed=i;
+	if (changed==-1) return false;
+	path_table_rehash(path_table_size, changed);
+	return true;
+}
+// Is path a regular file we are allowed to execute?
+bool is_executable(const char *path)
+{
+	struct stat st;
+	return stat(path, &st)==0 && S_ISREG(st.st_mode) && access(path, X_OK)==0;
+}
+struct path_entry_t *path_cache_find(const char *name)
+{
+	if (!path_table_size) return NULL;
+	size_t mask=path_table_size-1;
+	size_t i=hash_string(name)&mask;
+	while (path_table[i].name)
+	{
+		if (strcmp(path_table[i].name, name)==0)
+			return &path_table[i];
+		i=(i+1)&mask;
 	}
-	command->args=(char **)malloc(sizeof(char *));
-
-	int redirect_index;
-	int arg_index=0;
-	char temp_buf[1024], *arg;
-	while (1)
+	return NULL;
+}
+/**
+ * Search the PATH directories for name and cache the result.
+ * @param  name [description]
+ * @return      the cached entry, NULL if not found
+ */
+struct path_entry_t *path_cache_add(const char *name)
+{
+	char full[4096];
+	for (int i=0;i<path_dir_count;++i)
 	{
-		// tokenize input on splitters
-		pch = strtok(NULL, splitters);
-		if (!pch) break;
-		arg=temp_buf;
-		strcpy(arg, pch);
-		len=strlen(arg);
+		if (!path_dirs[i].exists) continue;
+		if (snprintf(full, sizeof(full), "%s/%s", path_dirs[i].path, name)>=(int)sizeof(full))
+			continue;
+		if (!is_executable(full)) continue;
 
-		if (len==0) continue; // empty arg, go for next
-		while (len>0 && strchr(splitters, arg[0])!=NULL) // trim left whitespace
-		{
-			arg++;
-			len--;
-		}
-		while (len>0 && strchr(splitters, arg[len-1])!=NULL) arg[--len]=0; // trim right whitespace
-		if (len==0) continue; // empty arg, go for next
+		if ((path_table_used+1)*4>path_table_size*3) // keep load factor under 3/4
+			path_table_rehash(path_table_size*2, path_dir_count);
+		struct path_entry_t entry={strdup(name), strdup(full), i, 0};
+		path_table_put(entry);
+		return path_cache_find(name);
+	}
+	return NULL;
+}
+/**
+ * Resolve a command name to the absolute path execv should run.
+ * Names containing a slash are used as they are.
+ * @param  name [description]
+ * @return      path, NULL if the command does not exist
+ */
+const char *resolve_command(const char *name)
+{
+	if (strchr(name, '/'))
+		return is_executable(name)?name:NULL;
 
-		// piping to another command
-		if (strcmp(arg, "|")==0)
+	path_dirs_load();
+	struct path_entry_t *entry=path_cache_find(name);
+	if (entry)
+	{
+		// a directory earlier in PATH may have gained a binary with the same name
+		if (!path_dirs_validate(entry->dir))
 		{
-			struct command_t *c=malloc(sizeof(struct command_t));
-			int l=strlen(pch);
-			pch[l]=splitters[0]; // restore strtok termination
-			index=1;
-			while (pch[index]==' ' || pch[index]=='\t') index++; // skip whitespaces
-
-			parse_command(pch+index, c);
-			pch[l]=0; // put back strtok termination
-			command->next=c;
-			continue;
+			entry->hits++;
+			return entry->path;
 		}
+	}
+	else
+		path_dirs_validate(path_dir_count-1); // search against fresh mtimes
 
-		// background process
-		if (strcmp(arg, "&")==0)
-			continue; // handled before
-
-		// handle input redirection
-		redirect_index=-1;
-		if (arg[0]=='<')
-			redirect_index=0;
-		if (arg[0]=='>')
+	entry=path_cache_add(name);
+	if (!entry) return NULL;
+	entry->hits++;
+	return entry->path;
+}
+// Cache every executable found in PATH, earlier directories win.
+void path_cache_warm()
+{
+	path_dirs_load();
+	path_dirs_validate(path_dir_count-1);
+	for (int i=0;i<path_dir_count;++i)
+	{
+		DIR *dir=opendir(path_dirs[i].path);
+		if (!dir) continue;
+		struct dirent *ent;
+		while ((ent=readdir(dir)))
 		{
-			if (len>1 && arg[1]=='>')
-			{
-				redirect_index=2;
-				arg++;
-				len--;
-			}
-			else redirect_index=1;
+			if (ent->d_name[0]=='.' || path_cache_find(ent->d_name)) continue;
+			char full[4096];
+			if (snprintf(full, sizeof(full), "%s/%s", path_dirs[i].path, ent->d_name)>=(int)sizeof(full))
+				continue;
+			if (!is_executable(full)) continue;
+			if ((path_table_used+1)*4>path_table_size*3)
+				path_table_rehash(path_table_size*2, path_dir_count);
+			struct path_entry_t entry={strdup(ent->d_name), strdup(full), i, 0};
+			path_table_put(entry);
 		}
-		if (redirect_index != -1)
+		closedir(dir);
+	}
+}
+/**
+ * hash builtin: list the cache, clear it with -r, fill it from every PATH
+ * directory with -a, or resolve and remember the given names.
+ * @param  command [description]
+ * @return         [description]
+ */
+int builtin_hash(struct command_t *command)
+{
+	path_dirs_load();
+	if (command->arg_count==0)
+	{
+		if (path_table_used==0)
 		{
-			command->redirects[redirect_index]=malloc(len);
-			strcpy(command->redirects[redirect_index], arg+1);
-			continue;
+			printf("%s: hash table empty\n", command->name);
+			return SUCCESS;
 		}
-
-		// normal arguments
-		if (len>2 && ((arg[0]=='"' && arg[len-1]=='"')
-			|| (arg[0]=='\'' && arg[len-1]=='\''))) // quote wrapped arg
+		printf("hits\tcommand\n");
+		for (size_t i=0;i<path_table_size;++i)
+			if (path_table[i].name)
+				printf("%4u\t%s\n", path_table[i].hits, path_table[i].path);
+		return SUCCESS;
+	}
+	if (strcmp(command->args[0], "-r")==0)
+	{
+		path_cache_clear();
+		return SUCCESS;
+	}
+	if (strcmp(command->args[0], "-a")==0)
+	{
+		path_cache_warm();
+		return SUCCESS;
+	}
+	int r=SUCCESS;
+	for (int i=0;i<command->arg_count;++i)
+	{
+		const char *name=command->args[i];
+		if (strchr(name, '/')) continue; // nothing to remember
+		if (!path_cache_find(name) && !path_cache_add(name))
 		{
-			arg[--len]=0;
-			arg++;
+			printf("-%s: %s: %s: not found\n", sysname, command->name, name);
+			r=UNKNOWN;
 		}
-		command->args=(char **)realloc(command->args, sizeof(char *)*(arg_index+1));
-		command->args[arg_index]=(char *)malloc(len+1);
-		strcpy(command->args[arg_index++], arg);
 	}
-	command->arg_count=arg_index;
-	return 0;
-}
-void prompt_backspace()
-{
-	putchar(8); // go back 1
-	putchar(' '); // write empty over
-	putchar(8); // go back 1 again
+	return r;
 }
 /**
- * Prompt a command from the user
- * @param  buf      [description]
- * @param  buf_size [description]
- * @return          [description]
+ * Write a command back out as text, the way jobs shows it.
+ * @param  command [description]
+ * @return         malloc'd string
  */
-int prompt(struct command_t *command)
+char *command_string(struct command_t *command)
 {
-	int index=0;
-	char c;
-	char buf[4096];
-	static char oldbuf[4096];
-
-    // tcgetattr gets the parameters of the current terminal
-    // STDIN_FILENO will tell tcgetattr that it should write the settings
-    // of stdin to oldt
-    static struct termios backup_termios, new_termios;
-    tcgetattr(STDIN_FILENO, &backup_termios);
-    new_termios = backup_termios;
-    // ICANON normally takes care that one line at a time will be processed
-    // that means it will return if it sees a "\n" or an EOF or an EOL
-    new_termios.c_lflag &= ~(ICANON | ECHO); // Also disable automatic echo. We manually echo each char.
-    // Those new settings will be set to STDIN
-    // TCSANOW tells tcsetattr to change attributes immediately.
-    tcsetattr(STDIN_FILENO, TCSANOW, &new_termios);
-
-
-    //FIXME: backspace is applied before printing chars
-	show_prompt();
-	int multicode_state=0;
-	buf[0]=0;
-  	while (1)
-  	{
-		c=getchar();
-		// printf("Keycode: %u\n", c); // DEBUG: uncomment for debugging
+	size_t len=1;
+	for (struct command_t *c=command;c;c=c->next)
+	{
+		len+=strlen(c->name)+4;
+		for (int i=0;i<c->arg_count;++i)
+			len+=strlen(c->args[i])+1;
+		for (int i=0;i<3;++i)
+			if (c->redirects[i])
+				len+=strlen(c->redirects[i])+4;
+	}
+	char *str=malloc(len), *p=str;
+	for (struct command_t *c=command;c;c=c->next)
+	{
+		p+=sprintf(p, "%s", c->name);
+		for (int i=0;i<c->arg_count;++i)
+			p+=sprintf(p, " %s", c->args[i]);
+		if (c->redirects[0]) p+=sprintf(p, " <%s", c->redirects[0]);
+		if (c->redirects[1]) p+=sprintf(p, " >%s", c->redirects[1]);
+		if (c->redirects[2]) p+=sprintf(p, " >>%s", c->redirects[2]);
+		if (c->next) p+=sprintf(p, " | ");
+	}
+	*p=0;
+	return str;
+}
 
-		if (c==9) // handle tab
-		{
-			buf[index++]='?'; // autocomplete
-			break;
-		}
+// Job control. Every pipeline runs in its own process group and is tracked as a
+// job until all of its processes are reaped. SIGCHLD is blocked and read through
+// a signalfd, so children are reaped from the shell's poll loops with
+// waitpid(WNOHANG) instead of from a signal handler.
+struct process_t {
+	pid_t pid;
+	char *name; // the command the process runs, for stats
+	int status;
+	bool completed;
+	bool stopped;
+	uint64_t ended; // monotonic_ns when it was reaped
+	struct rusage usage; // from wait4, once completed
+};
+struct job_t {
+	int id; // the number used in %n job specs
+	pid_t pgid;
+	char *cmdline;
+	uint64_t started;
+	struct process_t *procs;
+	int proc_count;
+	bool background;
+	bool notified; // the user has been told the job stopped
+};
+struct job_t **jobs;
+int job_count;
+int signal_fd=-1;
+bool interactive; // reading commands from a terminal, not from -c, a script or a pipe
+bool job_control; // stdin is a terminal, so jobs get their own process groups
+pid_t shell_pgid;
+sigset_t job_signals; // ignored by the shell, reset to default in children
+int last_status; // exit status of the last foreground command
+
+void jobs_init()
+{
+	sigset_t chld;
+	sigemptyset(&chld);
+	sigaddset(&chld, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &chld, NULL);
+	signal_fd=signalfd(-1, &chld, SFD_NONBLOCK|SFD_CLOEXEC);
 
-		if (c==127) // handle backspace
+	sigemptyset(&job_signals);
+	int signals[]={SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGCHLD};
+	for (int i=0;i<6;++i)
+		sigaddset(&job_signals, signals[i]);
+
+	job_control=interactive && isatty(STDIN_FILENO);
+	if (!job_control) return;
+	// wait until we are in the foreground before taking the terminal over
+	while (tcgetpgrp(STDIN_FILENO)!=(shell_pgid=getpgrp()))
+		kill(-shell_pgid, SIGTTIN);
+	for (int i=0;i<5;++i)
+		signal(signals[i], SIG_IGN);
+	shell_pgid=getpid();
+	setpgid(shell_pgid, shell_pgid);
+	tcsetpgrp(STDIN_FILENO, shell_pgid);
+}
+/**
+ * Undo the shell's signal setup in a freshly forked child and move it
+ * to its job's process group. pgid 0 starts a new group, -1 keeps the shell's.
+ * @param pgid       [description]
+ * @param foreground [description]
+ */
+void child_setup(pid_t pgid, bool foreground)
+{
+	if (pgid!=-1)
+	{
+		setpgid(0, pgid);
+		if (foreground && job_control)
+			tcsetpgrp(STDIN_FILENO, pgid?pgid:getpid());
+	}
+	for (int sig=1;sig<NSIG;++sig)
+		if (sigismember(&job_signals, sig)==1)
+			signal(sig, SIG_DFL);
+	sigset_t empty;
+	sigemptyset(&empty);
+	sigprocmask(SIG_SETMASK, &empty, NULL);
+}
+uint64_t monotonic_ns();
+// Record a wait4 status and, once it has exited, the resources used on whichever job owns pid.
+void job_mark(pid_t pid, int status, const struct rusage *usage)
+{
+	for (int i=0;i<job_count;++i)
+		for (int j=0;j<jobs[i]->proc_count;++j)
 		{
-			if (index>0)
+			struct process_t *proc=&jobs[i]->procs[j];
+			if (proc->pid!=pid) continue;
+			proc->status=status;
+			proc->stopped=WIFSTOPPED(status);
+			proc->completed=WIFEXITED(status) || WIFSIGNALED(status);
+			if (proc->completed)
 			{
-				prompt_backspace();
-				index--;
+				proc->ended=monotonic_ns();
+				proc->usage=*usage;
 			}
-			continue;
-		}
-		if (c==27 && multicode_state==0) // handle multi-code keys
-		{
-			multicode_state=1;
-			continue;
-		}
-		if (c==91 && multicode_state==1)
-		{
-			multicode_state=2;
-			continue;
+			if (WIFCONTINUED(status))
+				proc->stopped=false;
+			if (proc->stopped)
+				jobs[i]->notified=false;
+			return;
 		}
-		if (c==65 && multicode_state==2) // up arrow
+}
+// Collect every child that changed state. Safe to call at any time.
+void jobs_reap()
+{
+	struct signalfd_siginfo info;
+	while (signal_fd!=-1 && read(signal_fd, &info, sizeof(info))==sizeof(info))
+		; // just drain it, wait4 tells us who it was
+	int status;
+	pid_t pid;
+	struct rusage usage;
+	while ((pid=wait4(-1, &status, WNOHANG|WUNTRACED|WCONTINUED, &usage))>0)
+		job_mark(pid, status, &usage);
+}
+bool job_completed(struct job_t *job)
+{
+	for (int i=0;i<job->proc_count;++i)
+		if (!job->procs[i].completed) return false;
+	return true;
+}
+bool job_stopped(struct job_t *job)
+{
+	for (int i=0;i<job->proc_count;++i)
+		if (!job->procs[i].completed && !job->procs[i].stopped) return false;
+	return !job_completed(job);
+}
+/**
+ * Add a launched pipeline to the job table.
+ * @param  pgid    [description]
+ * @param  pids    [description]
+ * @param  names   what each process runs
+ * @param  count   [description]
+ * @param  command [description]
+ * @return         [description]
+ */
+struct job_t *job_add(pid_t pgid, pid_t *pids, const char **names, int count, struct command_t *command)
+{
+	struct job_t *job=calloc(1, sizeof(struct job_t));
+	job->id=1;
+	for (int i=0;i<job_count;++i)
+		if (jobs[i]->id>=job->id)
+			job->id=jobs[i]->id+1;
+	job->pgid=pgid;
+	job->cmdline=command_string(command);
+	job->background=command->background;
+	job->started=monotonic_ns();
+	job->procs=calloc(count, sizeof(struct process_t));
+	for (int i=0;i<count;++i)
+	{
+		job->procs[i].pid=pids[i];
+		job->procs[i].name=strdup(names[i]);
+		job->proc_count++;
+	}
+	jobs=realloc(jobs, sizeof(struct job_t *)*(job_count+1));
+	jobs[job_count++]=job;
+	return job;
+}
+void job_remove(struct job_t *job)
+{
+	for (int i=0;i<job_count;++i)
+		if (jobs[i]==job)
 		{
-			int i;
-			while (index>0)
-			{
-				prompt_backspace();
-				index--;
-			}
-			for (i=0;oldbuf[i];++i)
-			{
-				putchar(oldbuf[i]);
-				buf[i]=oldbuf[i];
-			}
-			index=i;
-			continue;
-		}
-		else
-			multicode_state=0;
-
-		putchar(c); // echo the character
-		buf[index++]=c;
-		if (index>=sizeof(buf)-1) break;
-		if (c=='\n') // enter key
+			memmove(&jobs[i], &jobs[i+1], sizeof(struct job_t *)*(job_count-i-1));
+			job_count--;
 			break;
-		if (c==4) // Ctrl+D
-			return EXIT;
-  	}
-  	if (index>0 && buf[index-1]=='\n') // trim newline from the end
-  		index--;
-  	buf[index++]=0; // null terminate string
-
-  	strcpy(oldbuf, buf);
-
-  	parse_command(buf, command);
-
-  	// print_command(command); // DEBUG: uncomment for debugging
-
-    // restore the old settings
-    tcsetattr(STDIN_FILENO, TCSANOW, &backup_termios);
-  	return SUCCESS;
-}
-
-// Dynamic memory allocating used to store data of the short command.
-void mallocShort(){
-	int i; int j;
-	alias = (char**)malloc(sizeof(char*)*50);
-    for(i=0; i<50; i++)
-    {
-       alias[i] = (char*)malloc(sizeof(char)*50);
-    }
-
-	wd = (char**)malloc(sizeof(char*)*50);
-    for(j=0; j<50; j++)
-    {
-       wd[j] = (char*)malloc(sizeof(char)*50);
-
-    }
-	saveCount = (int*)malloc(sizeof(int));
-	(*saveCount) = 0;
+		}
+	free(job->cmdline);
+	for (int i=0;i<job->proc_count;++i)
+		free(job->procs[i].name);
+	free(job->procs);
+	free(job);
 }
-//Malloc to keep the scores, user score is index0 and shellington score is index1
-void malloc_rps() {
-	rps_counter = (int*)malloc(sizeof(int)*2); 
+// Exit status of a job, taken from its last process like other shells do.
+int job_status(struct job_t *job)
+{
+	int status=job->procs[job->proc_count-1].status;
+	if (WIFEXITED(status)) return WEXITSTATUS(status);
+	if (WIFSIGNALED(status)) return 128+WTERMSIG(status);
+	return 128+WSTOPSIG(status);
 }
-// Freeing the allocated space for data storage units of short command.
-void freeShort() {
-	int i; int j;
-	for(i=0; i<50; i++)
-    {
-       free(alias[i]);
-    }
-	for(j=0; j<50; j++)
-    {
-       free(wd[i]);
-    }
-	free(alias);
-	free(wd);
-	free(saveCount);
+// The job %+ refers to: the most recently started one.
+struct job_t *job_current()
+{
+	return job_count?jobs[job_count-1]:NULL;
 }
-// Free allocated space for custom command
-void free_rps() {
-	free(rps_counter);
+/**
+ * Find a job from a spec: %n, %+, %% or a pid of one of its processes.
+ * @param  spec [description]
+ * @return      NULL if there is no such job
+ */
+struct job_t *job_find(const char *spec)
+{
+	if (spec==NULL || strcmp(spec, "%+")==0 || strcmp(spec, "%%")==0)
+		return job_current();
+	if (spec[0]=='%')
+	{
+		int id=atoi(spec+1);
+		for (int i=0;i<job_count;++i)
+			if (jobs[i]->id==id) return jobs[i];
+		return NULL;
+	}
+	pid_t pid=atoi(spec);
+	for (int i=0;i<job_count;++i)
+		for (int j=0;j<jobs[i]->proc_count;++j)
+			if (jobs[i]->procs[j].pid==pid) return jobs[i];
+	return NULL;
 }
-int process_command(struct command_t *command);
-int main()
+// The reminder scheduler's timer, watched wherever the shell waits.
+int reminder_fd=-1;
+void reminders_fire();
+void reminders_sync();
+void reminders_init();
+void zygote_start();
+void stats_job(struct job_t *job);
+/**
+ * Wait until a job completes or stops, reaping anything else that
+ * finishes in the meantime.
+ * @param job [description]
+ */
+void job_wait(struct job_t *job)
 {
-	getcwd(init_dir, 1024); // Getting the directory that shell first executed.
-	malloc_rps(); // Malloc for rps custom command
-	mallocShort(); // Calling the function the allocate space for short command.
-	while (1)
+	jobs_reap();
+	while (!job_completed(job) && (job->background || !job_stopped(job)))
 	{
-		struct command_t *command=malloc(sizeof(struct command_t));
-		memset(command, 0, sizeof(struct command_t)); // set all bytes to 0
-
-		int code;
-		code = prompt(command);
-		if (code==EXIT) break;
-
-		code = process_command(command);
-		if (code==EXIT) break;
-
-		free_command(command);
+		struct pollfd fds[2]={{signal_fd, POLLIN, 0}, {reminder_fd, POLLIN, 0}};
+		if (poll(fds, 2, -1)==-1 && errno!=EINTR) break;
+		if (fds[1].revents)
+			reminders_fire();
+		jobs_reap();
 	}
-	free_rps(); // Free allocated space for rps custom command
-	freeShort(); // Freeing space allocated for the short command.
-	printf("\n");
-	return 0;
 }
-
-int process_command(struct command_t *command)
+/**
+ * Give the terminal to a job, wait for it and take the terminal back.
+ * Stopped jobs stay in the table, finished ones are removed.
+ * @param  job [description]
+ * @return     the job's exit status
+ */
+int job_foreground(struct job_t *job)
 {
-	int r;
-	if (strcmp(command->name, "")==0) return SUCCESS;
-
-	if (strcmp(command->name, "exit")==0)
-		return EXIT;
+	job->background=false;
+	if (job_control)
+		tcsetpgrp(STDIN_FILENO, job->pgid);
+	job_wait(job);
+	if (job_control)
+		tcsetpgrp(STDIN_FILENO, shell_pgid);
 
-	if (strcmp(command->name, "cd")==0)
+	int status=job_status(job);
+	if (job_stopped(job))
+	{
+		job->notified=true;
+		printf("\n[%d]+  Stopped\t\t%s\n", job->id, job->cmdline);
+	}
+	else
+	{
+		if (status==128+SIGINT) // ^C was echoed without a newline
+			printf("\n");
+		stats_job(job);
+		job_remove(job);
+	}
+	return status;
+}
+// Report background jobs that finished or stopped since the last prompt.
+void jobs_notify()
+{
+	jobs_reap();
+	for (int i=0;i<job_count;++i)
 	{
-		if (command->arg_count > 0)
+		struct job_t *job=jobs[i];
+		if (job_completed(job))
 		{
-			r=chdir(command->args[0]);
-			if (r==-1)
-				printf("-%s: %s: %s\n", sysname, command->name, strerror(errno));
-			return SUCCESS;
+			int status=job_status(job);
+			if (interactive && status==0)
+				printf("[%d]+  Done\t\t\t%s\n", job->id, job->cmdline);
+			else if (interactive)
+				printf("[%d]+  Exit %d\t\t%s\n", job->id, status, job->cmdline);
+			stats_job(job);
+			job_remove(job);
+			i--;
+		}
+		else if (job_stopped(job) && !job->notified)
+		{
+			printf("[%d]+  Stopped\t\t%s\n", job->id, job->cmdline);
+			job->notified=true;
+		}
+	}
+}
+// write until everything is out or an error happens
+int write_all(int fd, const char *buf, size_t len)
+{
+	while (len>0)
+	{
+		ssize_t w=write(fd, buf, len);
+		if (w==-1)
+		{
+			if (errno==EINTR) continue;
+			return -1;
 		}
+		buf+=w;
+		len-=w;
 	}
+	return 0;
+}
+// Monotonic clock in nanoseconds, for the shell's own timings.
+uint64_t monotonic_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000ull+ts.tv_nsec;
+}
 
+// Resource accounting. Every finished command, a builtin run in the shell or a
+// process of a job reaped with wait4, is added to the session's stats under
+// its name: wall time as a log2 histogram, CPU time, peak RSS and context
+// switches. With SHELLINGTON_STATS_LOG set each one is also appended to that
+// file as a JSON line. Percentiles come from a reservoir of wall times: exact
+// up to STATS_SAMPLES runs, estimated from a uniform sample of them after that.
+#define STATS_BUCKETS 36 // bucket b counts wall times in [2^(b-1), 2^b) us
+#define STATS_SAMPLES 1024
+struct usage_t {
+	uint64_t wall_ns, user_ns, sys_ns;
+	long maxrss_kb, nvcsw, nivcsw;
+};
+struct command_stats_t {
+	char *name;
+	uint64_t count;
+	struct usage_t total; // maxrss_kb is the largest seen, the rest are sums
+	uint32_t buckets[STATS_BUCKETS];
+	uint64_t *samples; // wall_ns, min(count, STATS_SAMPLES) of them
+};
+struct command_stats_t *stats;
+size_t stats_count, stats_size;
+size_t *stats_slots; // open addressing by name, index into stats plus one, 0 empty
+size_t stats_slots_size; // a power of two, at least twice stats_count
+uint64_t stats_random=0x9e3779b97f4a7c15ull; // xorshift state for the reservoirs
+int stats_log_fd=-2; // -2 until SHELLINGTON_STATS_LOG is looked at
+bool stats_timing; // inside time: print the stages of every job as they finish
+struct usage_t stats_last; // the last command, summed over its processes
+
+uint64_t timeval_ns(struct timeval tv)
+{
+	return (uint64_t)tv.tv_sec*1000000000ull+tv.tv_usec*1000ull;
+}
+// Resources a finished child used, or what the shell used between two getrusage calls.
+void usage_from(struct usage_t *usage, const struct rusage *end, const struct rusage *start, uint64_t wall_ns)
+{
+	usage->wall_ns=wall_ns;
+	usage->user_ns=timeval_ns(end->ru_utime)-(start?timeval_ns(start->ru_utime):0);
+	usage->sys_ns=timeval_ns(end->ru_stime)-(start?timeval_ns(start->ru_stime):0);
+	usage->maxrss_kb=end->ru_maxrss;
+	usage->nvcsw=end->ru_nvcsw-(start?start->ru_nvcsw:0);
+	usage->nivcsw=end->ru_nivcsw-(start?start->ru_nivcsw:0);
+}
+// Short human readable duration, "850us", "12.3ms", "4.02s".
+const char *format_ns(char *buf, size_t size, uint64_t ns)
+{
+	if (ns<1000000) snprintf(buf, size, "%.0fus", ns/1e3);
+	else if (ns<1000000000) snprintf(buf, size, "%.1fms", ns/1e6);
+	else snprintf(buf, size, "%.2fs", ns/1e9);
+	return buf;
+}
+/**
+ * Write a string as a JSON string literal.
+ * @param  out  [description]
+ * @param  size room in out, at least 8
+ * @param  str  [description]
+ * @return      bytes written
+ */
+size_t json_string(char *out, size_t size, const char *str)
+{
+	size_t n=0;
+	out[n++]='"';
+	for (; *str && n+8<size; str++)
+	{
+		unsigned char c=*str;
+		if (c=='"' || c=='\\')
+		{
+			out[n++]='\\';
+			out[n++]=c;
+		}
+		else if (c<0x20)
+			n+=sprintf(out+n, "\\u%04x", c);
+		else
+			out[n++]=c;
+	}
+	out[n++]='"';
+	return n;
+}
+void stats_log(const char *name, int status, const struct usage_t *usage)
+{
+	if (stats_log_fd==-2)
+	{
+		const char *path=getenv("SHELLINGTON_STATS_LOG");
+		stats_log_fd=path?open(path, O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0644):-1;
+	}
+	if (stats_log_fd==-1) return;
+	char line[1024];
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	int n=snprintf(line, sizeof(line), "{\"time\":%lld.%03ld,\"command\":", (long long)now.tv_sec, now.tv_nsec/1000000);
+	n+=json_string(line+n, sizeof(line)-n-256, name);
+	n+=snprintf(line+n, sizeof(line)-n, ",\"status\":%d,\"wall_us\":%llu,\"user_us\":%llu,\"sys_us\":%llu,"
+		"\"maxrss_kb\":%ld,\"nvcsw\":%ld,\"nivcsw\":%ld}\n", status,
+		(unsigned long long)usage->wall_ns/1000, (unsigned long long)usage->user_ns/1000,
+		(unsigned long long)usage->sys_ns/1000, usage->maxrss_kb, usage->nvcsw, usage->nivcsw);
+	write_all(stats_log_fd, line, n); // one write, so concurrent shells do not interleave
+}
+struct command_stats_t *stats_find(const char *name)
+{
+	if (!stats_slots_size) return NULL;
+	size_t mask=stats_slots_size-1;
+	for (size_t i=hash_string(name)&mask; stats_slots[i]; i=(i+1)&mask)
+		if (strcmp(stats[stats_slots[i]-1].name, name)==0)
+			return &stats[stats_slots[i]-1];
+	return NULL;
+}
+// Index stats[index], the caller knows its name is not in the table yet.
+void stats_slot_put(size_t index)
+{
+	size_t mask=stats_slots_size-1, i=hash_string(stats[index].name)&mask;
+	while (stats_slots[i])
+		i=(i+1)&mask;
+	stats_slots[i]=index+1;
+}
+/**
+ * Add one finished command to the session's stats.
+ * @param name   the command as it was typed
+ * @param status exit status
+ * @param usage  [description]
+ */
+void stats_add(const char *name, int status, const struct usage_t *usage)
+{
+	struct command_stats_t *entry=stats_find(name);
+	if (!entry)
+	{
+		if (stats_count==stats_size)
+			stats=realloc(stats, sizeof(struct command_stats_t)*(stats_size=stats_size?stats_size*2:16));
+		entry=&stats[stats_count++];
+		memset(entry, 0, sizeof(*entry));
+		entry->name=strdup(name);
+		if (stats_count*2>stats_slots_size)
+		{
+			free(stats_slots);
+			stats_slots_size=stats_slots_size?stats_slots_size*2:64;
+			stats_slots=calloc(stats_slots_size, sizeof(size_t));
+			for (size_t i=0;i<stats_count;++i)
+				stats_slot_put(i);
+		}
+		else
+			stats_slot_put(stats_count-1);
+	}
+	uint64_t us=usage->wall_ns/1000;
+	int bucket=us?64-__builtin_clzll(us):0;
+	entry->buckets[bucket<STATS_BUCKETS?bucket:STATS_BUCKETS-1]++;
+	if (!entry->samples)
+		entry->samples=malloc(sizeof(uint64_t)*STATS_SAMPLES);
+	if (entry->count<STATS_SAMPLES)
+		entry->samples[entry->count]=usage->wall_ns;
+	else
+	{
+		// keep this run with probability STATS_SAMPLES/(count+1)
+		stats_random^=stats_random<<13;
+		stats_random^=stats_random>>7;
+		stats_random^=stats_random<<17;
+		uint64_t slot=stats_random%(entry->count+1);
+		if (slot<STATS_SAMPLES)
+			entry->samples[slot]=usage->wall_ns;
+	}
+	entry->count++;
+	entry->total.wall_ns+=usage->wall_ns;
+	entry->total.user_ns+=usage->user_ns;
+	entry->total.sys_ns+=usage->sys_ns;
+	entry->total.nvcsw+=usage->nvcsw;
+	entry->total.nivcsw+=usage->nivcsw;
+	if (usage->maxrss_kb>entry->total.maxrss_kb)
+		entry->total.maxrss_kb=usage->maxrss_kb;
+	stats_log(name, status, usage);
+}
+// One line of time's report, for a whole command or one stage of it.
+void stats_print_usage(const char *label, const struct usage_t *usage)
+{
+	char wall[32], user[32], sys[32];
+	fprintf(stderr, "%-16s real %-8s user %-8s sys %-8s maxrss %ldk  csw %ld/%ld\n", label,
+		format_ns(wall, sizeof(wall), usage->wall_ns), format_ns(user, sizeof(user), usage->user_ns),
+		format_ns(sys, sizeof(sys), usage->sys_ns), usage->maxrss_kb, usage->nvcsw, usage->nivcsw);
+}
+/**
+ * Account for a finished job: every process is added to the stats under its
+ * own name, and stats_last gets the job as a whole, wall time from its start
+ * to the last process.
+ * @param job [description]
+ */
+void stats_job(struct job_t *job)
+{
+	memset(&stats_last, 0, sizeof(stats_last));
+	for (int i=0;i<job->proc_count;++i)
+	{
+		struct process_t *proc=&job->procs[i];
+		struct usage_t usage;
+		usage_from(&usage, &proc->usage, NULL, proc->ended-job->started);
+		int status=WIFEXITED(proc->status)?WEXITSTATUS(proc->status):128+WTERMSIG(proc->status);
+		stats_add(proc->name, status, &usage);
+		if (stats_timing && job->proc_count>1)
+		{
+			char label[32];
+			snprintf(label, sizeof(label), "  %d %.12s", i+1, proc->name);
+			stats_print_usage(label, &usage);
+		}
+		if (usage.wall_ns>stats_last.wall_ns) stats_last.wall_ns=usage.wall_ns;
+		stats_last.user_ns+=usage.user_ns;
+		stats_last.sys_ns+=usage.sys_ns;
+		stats_last.nvcsw+=usage.nvcsw;
+		stats_last.nivcsw+=usage.nivcsw;
+		if (usage.maxrss_kb>stats_last.maxrss_kb) stats_last.maxrss_kb=usage.maxrss_kb;
+	}
+}
+
+// The prompt is rendered once into a buffer and reused until the shell changes
+// directory. User and hostname are looked up once, the cwd only after a chdir.
+char prompt_user[256], prompt_host[256];
+char *prompt_cwd;
+char *prompt_text; // rendered prompt, NULL when it has to be rebuilt
+size_t prompt_len, prompt_width; // bytes, and columns it takes on screen
+bool prompt_timing; // SHELLINGTON_PROMPT_TIMING is set: show how long rendering takes
+uint64_t prompt_last_ns, prompt_total_ns, prompt_max_ns, prompt_renders;
+
+// Remember the directory the shell is in now, for the prompt and $PWD.
+void prompt_update_cwd()
+{
+	free(prompt_cwd);
+	prompt_cwd=getcwd(NULL, 0);
+	if (prompt_cwd==NULL) prompt_cwd=strdup("?");
+	setenv("PWD", prompt_cwd, 1);
+	free(prompt_text);
+	prompt_text=NULL;
+}
+void prompt_init()
+{
+	const char *user=getenv("USER");
+	if (user==NULL)
+	{
+		struct passwd *pw=getpwuid(getuid());
+		user=pw?pw->pw_name:"?";
+	}
+	snprintf(prompt_user, sizeof(prompt_user), "%s", user);
+	if (gethostname(prompt_host, sizeof(prompt_host)-1)==-1)
+		strcpy(prompt_host, "?");
+	prompt_timing=getenv("SHELLINGTON_PROMPT_TIMING")!=NULL;
+	prompt_update_cwd();
+}
+/**
+ * Change the shell's directory, keeping the prompt's cwd in sync.
+ * @param  dir [description]
+ * @return     what chdir returned
+ */
+int shell_chdir(const char *dir)
+{
+	int r=chdir(dir);
+	if (r==0)
+		prompt_update_cwd();
+	return r;
+}
+/**
+ * The rendered prompt, rebuilt only if the directory changed.
+ * @param  len [description]
+ * @return     [description]
+ */
+const char *prompt_string(size_t *len)
+{
+	if (!prompt_cwd) prompt_init();
+	if (!prompt_text)
+	{
+		// Colorizing the promp.
+		const char *format=COLOR_GREEN "%s@%s:" COLOR_RESET COLOR_BLUE "%s " COLOR_RESET COLOR_CYAN "%s$ " COLOR_RESET;
+		prompt_len=snprintf(NULL, 0, format, prompt_user, prompt_host, prompt_cwd, sysname);
+		prompt_text=malloc(prompt_len+1);
+		snprintf(prompt_text, prompt_len+1, format, prompt_user, prompt_host, prompt_cwd, sysname);
+		prompt_width=strlen(prompt_user)+strlen(prompt_host)+strlen(prompt_cwd)+strlen(sysname)+5;
+	}
+	*len=prompt_len;
+	return prompt_text;
+}
+// What show_prompt wrote last, the line editor redraws it in front of the line.
+char *prompt_frame;
+size_t prompt_frame_len, prompt_frame_width, prompt_frame_size;
+/**
+ * Show the command prompt with a single write.
+ * @return [description]
+ */
+int show_prompt()
+{
+	uint64_t start=prompt_timing?monotonic_ns():0;
+	size_t len;
+	const char *text=prompt_string(&len);
+
+	// timing mode shows the previous render's latency in front of the prompt
+	char prefix[64]="";
+	int n=prompt_timing?snprintf(prefix, sizeof(prefix), "[%.1fus] ", prompt_last_ns/1000.0):0;
+	if (prompt_frame_size<n+len)
+		prompt_frame=realloc(prompt_frame, prompt_frame_size=n+len);
+	memcpy(prompt_frame, prefix, n);
+	memcpy(prompt_frame+n, text, len);
+	prompt_frame_len=n+len;
+	prompt_frame_width=n+prompt_width;
+
+	fflush(stdout); // whatever was printf'd so far goes first
+	write_all(STDOUT_FILENO, prompt_frame, prompt_frame_len);
+
+	if (prompt_timing)
+	{
+		prompt_last_ns=monotonic_ns()-start;
+		prompt_total_ns+=prompt_last_ns;
+		if (prompt_last_ns>prompt_max_ns) prompt_max_ns=prompt_last_ns;
+		prompt_renders++;
+	}
+	return 0;
+}
+/**
+ * Close off a pipeline stage: copy the words collected for it into the
+ * arena as its argv.
+ * @param command [description]
+ * @param words   [description]
+ * @param count   [description]
+ */
+void parse_finish_stage(struct command_t *command, char **words, size_t count)
+{
+	char **argv=arena_alloc(command->arena, sizeof(char *)*(count+2));
+	memcpy(argv, words, sizeof(char *)*count);
+	if (count==0)
+		argv[count++]="";
+	argv[count]=NULL;
+	command->name=argv[0];
+	command->argv=argv;
+	command->args=argv+1;
+	command->arg_count=count-1;
+}
+// What the tokenizer does with a byte, plain word characters are 0.
+enum parse_class {
+	PARSE_SPACE = 1,
+	PARSE_OPERATOR = 2,
+	PARSE_QUOTE = 3, // quotes and backslash
+	PARSE_GLOB = 4, // makes the word a glob pattern when unquoted
+};
+const unsigned char parse_classes[256]={
+	[' ']=PARSE_SPACE, ['\t']=PARSE_SPACE, ['\n']=PARSE_SPACE,
+	['|']=PARSE_OPERATOR, ['&']=PARSE_OPERATOR, ['<']=PARSE_OPERATOR, ['>']=PARSE_OPERATOR,
+	['\'']=PARSE_QUOTE, ['"']=PARSE_QUOTE, ['\\']=PARSE_QUOTE,
+	['*']=PARSE_GLOB, ['?']=PARSE_GLOB, ['[']=PARSE_GLOB,
+};
+/**
+ * The glob pattern of a word, from its text in the line: unquoted parts
+ * are kept as they are, quoted metacharacters and backslashes are escaped
+ * so that they only match themselves.
+ * @param  p     start of the word in the line
+ * @param  end   end of the word
+ * @param  arena [description]
+ * @return       the pattern
+ */
+char *parse_glob_pattern(const char *p, const char *end, struct arena_t *arena)
+{
+	char *pattern=arena_alloc(arena, 2*(end-p)+1), *out=pattern;
+	while (p<end)
+	{
+		if (*p=='\'' || *p=='"')
+		{
+			char quote=*p++;
+			for (;p<end && *p!=quote;p++)
+			{
+				if (quote=='"' && *p=='\\' && p+1<end && strchr("\"\\$`", p[1])) p++;
+				if (parse_classes[(unsigned char)*p]==PARSE_GLOB || *p=='\\')
+					*out++='\\';
+				*out++=*p;
+			}
+			if (p<end) p++;
+		}
+		else if (*p=='\\' && p+1<end) // already an escape
+		{
+			*out++=*p++;
+			*out++=*p++;
+		}
+		else
+			*out++=*p++;
+	}
+	*out=0;
+	return pattern;
+}
+/**
+ * Hand a finished stage the patterns of its glob words, indexed like its
+ * argv, and clear them for the next stage.
+ * @param stage    [description]
+ * @param patterns [description]
+ * @param count    words in the stage
+ */
+void parse_finish_globs(struct command_t *stage, char **patterns, size_t count)
+{
+	stage->patterns=arena_alloc(stage->arena, sizeof(char *)*(count+1));
+	memcpy(stage->patterns, patterns, sizeof(char *)*count);
+	stage->patterns[count]=NULL;
+	memset(patterns, 0, sizeof(char *)*count);
+}
+/**
+ * Parse a command string into a command struct. Single pass over the line:
+ * quotes and backslashes are resolved while the words are copied, and every
+ * string, argv array and piped stage is allocated from command->arena
+ * (the line arena if the command has none).
+ * @param  buf     [description]
+ * @param  command [description]
+ * @return         0
+ */
+int parse_command(char *buf, struct command_t *command)
+{
+	if (!command->arena) command->arena=&line_arena;
+	struct arena_t *arena=command->arena;
+
+	// unquoting and the terminators never make the words longer than the line
+	size_t len=strlen(buf);
+	char *out=arena_alloc(arena, len+1);
+
+	// words of the current stage, on the stack unless there are many
+	char *stack_words[64], **words=stack_words;
+	size_t word_count=0, word_cap=64;
+	// glob patterns by word, allocated once the line has a glob word
+	char **patterns=NULL;
+	bool stage_globs=false;
+
+	struct command_t *stage=command;
+	int redirect_index=-1;
+	bool trailing_amp=false;
+	const char *p=buf;
+	while (1)
+	{
+		while (parse_classes[(unsigned char)*p]==PARSE_SPACE) p++; // split at whitespace
+		if (!*p) break;
+		trailing_amp=false;
+
+		if (*p=='|') // piping to another command
+		{
+			parse_finish_stage(stage, words, word_count);
+			if (stage_globs)
+				parse_finish_globs(stage, patterns, word_count);
+			stage_globs=false;
+			word_count=0;
+			stage->next=new_command(arena);
+			stage=stage->next;
+			p++;
+			continue;
+		}
+		if (*p=='&') // background, only counts at the end of the line
+		{
+			trailing_amp=true;
+			p++;
+			continue;
+		}
+		if (*p=='<') // handle input redirection
+		{
+			redirect_index=0;
+			p++;
+			continue;
+		}
+		if (*p=='>')
+		{
+			redirect_index=p[1]=='>'?2:1;
+			p+=redirect_index;
+			continue;
+		}
+
+		// a word, possibly made of several quoted and unquoted parts
+		char *word=out;
+		const char *source=p;
+		bool glob=false;
+		while (*p && parse_classes[(unsigned char)*p]!=PARSE_SPACE && parse_classes[(unsigned char)*p]!=PARSE_OPERATOR)
+		{
+			if (!parse_classes[(unsigned char)*p])
+			{
+				// copy the plain run in one go
+				const char *run=p;
+				while (*p && !parse_classes[(unsigned char)*p]) p++;
+				memcpy(out, run, p-run);
+				out+=p-run;
+			}
+			else if (parse_classes[(unsigned char)*p]==PARSE_GLOB)
+			{
+				glob=true;
+				*out++=*p++;
+			}
+			else if (*p=='\'')
+			{
+				for (p++;*p && *p!='\'';)
+					*out++=*p++;
+				if (*p) p++;
+			}
+			else if (*p=='"')
+			{
+				for (p++;*p && *p!='"';)
+				{
+					if (*p=='\\' && p[1] && strchr("\"\\$`", p[1])) p++;
+					*out++=*p++;
+				}
+				if (*p) p++;
+			}
+			else
+			{
+				if (*p=='\\' && p[1]) p++;
+				*out++=*p++;
+			}
+		}
+		*out++=0;
+
+		if (redirect_index!=-1)
+		{
+			stage->redirects[redirect_index]=word;
+			redirect_index=-1;
+			continue;
+		}
+		if (word_count==word_cap)
+		{
+			word_cap*=2;
+			if (words==stack_words)
+				words=memcpy(malloc(sizeof(char *)*word_cap), stack_words, sizeof(stack_words));
+			else
+				words=realloc(words, sizeof(char *)*word_cap);
+			if (patterns)
+			{
+				patterns=realloc(patterns, sizeof(char *)*word_cap);
+				memset(patterns+word_count, 0, sizeof(char *)*(word_cap-word_count));
+			}
+		}
+		if (glob)
+		{
+			if (!patterns) patterns=calloc(word_cap, sizeof(char *));
+			patterns[word_count]=parse_glob_pattern(source, p, arena);
+			stage_globs=true;
+		}
+		words[word_count++]=word;
+	}
+	parse_finish_stage(stage, words, word_count);
+	if (stage_globs)
+		parse_finish_globs(stage, patterns, word_count);
+	if (words!=stack_words) free(words);
+	free(patterns);
+
+	while (len>0 && parse_classes[(unsigned char)buf[len-1]]==PARSE_SPACE) len--;
+	if (len>0 && buf[len-1]=='?') // auto-complete
+		command->auto_complete=true;
+	if (trailing_amp) // background
+		for (stage=command;stage;stage=stage->next)
+			stage->background=true;
+	return 0;
+}
+// Terminal modes. The cooked settings are read once per session. The editor
+// switches to raw mode when it starts reading, and the terminal is only
+// switched back when something else is about to read from it.
+struct termios term_cooked, term_raw;
+enum term_mode { TERM_UNKNOWN, TERM_COOKED, TERM_RAW } term_mode;
+bool term_ok; // stdin is a terminal and its settings were read
+
+void term_init()
+{
+	if (!isatty(STDIN_FILENO) || tcgetattr(STDIN_FILENO, &term_cooked)==-1) return;
+	term_ok=true;
+	term_mode=TERM_COOKED;
+	term_raw=term_cooked;
+	// ICANON normally takes care that one line at a time will be processed,
+	// the editor does that itself. Echo is manual, and ^C/^Z/^V reach the editor as keys.
+	term_raw.c_lflag&=~(ICANON|ECHO|ISIG|IEXTEN);
+	term_raw.c_iflag&=~(IXON);
+	term_raw.c_cc[VMIN]=1;
+	term_raw.c_cc[VTIME]=0;
+}
+void term_set_raw()
+{
+	if (term_ok && term_mode!=TERM_RAW && tcsetattr(STDIN_FILENO, TCSADRAIN, &term_raw)==0)
+		term_mode=TERM_RAW;
+}
+// Put the terminal back the way we found it, before anything else reads from it.
+void term_set_cooked()
+{
+	if (term_ok && term_mode!=TERM_COOKED && tcsetattr(STDIN_FILENO, TCSADRAIN, &term_cooked)==0)
+		term_mode=TERM_COOKED;
+}
+
+// Input is read in chunks. Bytes after the end of a line (a paste of several
+// lines) stay here for the next prompt.
+char input_buf[1<<16];
+int input_fd=STDIN_FILENO; // a script is read from its own descriptor
+size_t input_pos, input_len;
+
+/**
+ * Make sure there is unread input, waiting for it if needed and reaping
+ * children in the meantime.
+ * @param  timeout ms to wait, -1 for ever
+ * @return         1 if there is input, 0 on timeout, -1 at end of input
+ */
+int input_fill(int timeout)
+{
+	if (input_pos<input_len) return 1;
+	while (1)
+	{
+		// negative descriptors are skipped by poll
+		struct pollfd fds[3]={{input_fd, POLLIN, 0}, {signal_fd, POLLIN, 0}, {reminder_fd, POLLIN, 0}};
+		int r=poll(fds, 3, timeout);
+		if (r==-1)
+		{
+			if (errno==EINTR) continue;
+			return -1;
+		}
+		if (r==0) return 0;
+		if (fds[1].revents)
+			jobs_reap();
+		if (fds[2].revents)
+			reminders_fire();
+		if (fds[0].revents)
+		{
+			ssize_t n=read(input_fd, input_buf, sizeof(input_buf));
+			if (n==-1 && errno==EINTR) continue;
+			if (n<=0) return -1;
+			input_pos=0;
+			input_len=n;
+			return 1;
+		}
+	}
+}
+
+// The line being edited.
+struct line_t {
+	char *buf;
+	size_t len, size;
+	size_t pos; // cursor
+	size_t view; // first byte shown, long lines scroll sideways
+};
+void line_reserve(struct line_t *line, size_t extra)
+{
+	if (line->len+extra+1<=line->size) return;
+	while (line->len+extra+1>line->size)
+		line->size=line->size?line->size*2:256;
+	line->buf=realloc(line->buf, line->size);
+}
+void line_insert(struct line_t *line, const char *text, size_t n)
+{
+	line_reserve(line, n);
+	memmove(line->buf+line->pos+n, line->buf+line->pos, line->len-line->pos);
+	memcpy(line->buf+line->pos, text, n);
+	line->len+=n;
+	line->pos+=n;
+}
+// Remove the bytes between from and to and leave the cursor at from.
+void line_delete(struct line_t *line, size_t from, size_t to)
+{
+	memmove(line->buf+from, line->buf+to, line->len-to);
+	line->len-=to-from;
+	line->pos=from;
+}
+void line_set(struct line_t *line, const char *text, size_t n)
+{
+	line->len=line->pos=0;
+	line_insert(line, text, n);
+}
+/**
+ * Redraw the prompt and the visible part of the line with one write.
+ * @param line [description]
+ */
+void line_refresh(struct line_t *line)
+{
+	struct winsize ws;
+	size_t cols=80;
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws)==0 && ws.ws_col>0)
+		cols=ws.ws_col;
+	size_t avail=cols>prompt_frame_width+1?cols-prompt_frame_width-1:1;
+	if (line->pos<line->view)
+		line->view=line->pos;
+	if (line->pos-line->view>=avail)
+		line->view=line->pos-avail+1;
+	size_t shown=line->len-line->view;
+	if (shown>avail) shown=avail;
+
+	size_t size=prompt_frame_len+shown+32;
+	char stack[4096], *frame=size<=sizeof(stack)?stack:malloc(size), *p=frame;
+	*p++='\r';
+	memcpy(p, prompt_frame, prompt_frame_len);
+	p+=prompt_frame_len;
+	memcpy(p, line->buf+line->view, shown);
+	p+=shown;
+	p+=sprintf(p, "\x1b[0K\r");
+	size_t column=prompt_frame_width+line->pos-line->view;
+	if (column)
+		p+=sprintf(p, "\x1b[%zuC", column);
+	write_all(STDOUT_FILENO, frame, p-frame);
+	if (frame!=stack) free(frame);
+}
+// Command history. The file is append only with one command per line, and
+// it is mapped whole at startup: the only work done on it is one memchr pass
+// for the offset table. Lines entered since then are appended to the file and
+// to a heap tail, and offsets past the end of the map point into the tail.
+#define HISTORY_BLOCK 32 // entries sharing one trigram filter
+#define HISTORY_FILTER_WORDS 32 // 2048 bit filters
+#define HISTORY_MAX_BYTES (16<<20)
+struct history_t {
+	char path[1040];
+	int fd;
+	const char *map;
+	size_t map_len;
+	char *tail;
+	size_t tail_len, tail_size;
+	size_t *offsets; // start of each entry, offsets[count] is the end of the last
+	size_t count, offsets_size;
+	uint64_t *filters; // per block, the trigrams found in its entries
+	size_t filter_blocks, indexed;
+	size_t max_bytes; // the file is compacted to half of this when it grows past it
+	pid_t compactor;
+} history={.fd=-1};
+
+const char *history_entry(size_t i, size_t *len)
+{
+	size_t off=history.offsets[i];
+	*len=history.offsets[i+1]-off-1; // without the newline
+	if (off<history.map_len)
+		return history.map+off;
+	return history.tail+(off-history.map_len);
+}
+// Record the end of a new entry.
+void history_push(size_t end)
+{
+	if (history.count+2>history.offsets_size)
+	{
+		history.offsets_size*=2;
+		history.offsets=realloc(history.offsets, history.offsets_size*sizeof(size_t));
+	}
+	history.offsets[++history.count]=end;
+}
+/**
+ * Open and map the history file. SHELLINGTON_HISTFILE overrides its place
+ * and SHELLINGTON_HISTSIZE its size cap in bytes.
+ */
+void history_load()
+{
+	const char *file=getenv("SHELLINGTON_HISTFILE");
+	if (file && *file)
+		snprintf(history.path, sizeof(history.path), "%s", file);
+	else
+		snprintf(history.path, sizeof(history.path), "%s/history.txt", init_dir);
+	const char *max=getenv("SHELLINGTON_HISTSIZE");
+	history.max_bytes=max && atol(max)>0?(size_t)atol(max):HISTORY_MAX_BYTES;
+
+	history.offsets_size=1024;
+	history.offsets=malloc(history.offsets_size*sizeof(size_t));
+	history.offsets[0]=0;
+	history.fd=open(history.path, O_RDWR|O_CREAT|O_APPEND|O_CLOEXEC, 0600);
+	if (history.fd==-1)
+	{
+		printf("-%s: %s: %s\n", sysname, history.path, strerror(errno));
+		return;
+	}
+	struct stat st;
+	if (fstat(history.fd, &st)==-1 || st.st_size==0)
+		return;
+	const char *map=mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, history.fd, 0);
+	if (map==MAP_FAILED)
+		return;
+	history.map=map;
+	const char *end=map+st.st_size, *p=map, *nl;
+	while ((nl=memchr(p, '\n', end-p)))
+	{
+		history_push(nl+1-map);
+		p=nl+1;
+	}
+	history.map_len=history.offsets[history.count];
+	if (p<end) // a line cut short, end it so the next one is not glued to it
+		write_all(history.fd, "\n", 1);
+}
+/**
+ * Rewrite the file with its newest half in a child, so the prompt is never
+ * held up by it. The new file replaces the old one with a rename, under the
+ * same lock the writers take.
+ */
+void history_compact()
+{
+	if (history.compactor>0 && kill(history.compactor, 0)==0)
+		return; // still at it
+	fflush(stdout);
+	pid_t pid=fork();
+	if (pid!=0)
+	{
+		if (pid>0) history.compactor=pid;
+		return;
+	}
+	int fd=open(history.path, O_RDONLY|O_CLOEXEC);
+	struct stat st;
+	if (fd==-1 || flock(fd, LOCK_EX)==-1 || fstat(fd, &st)==-1)
+		_exit(1);
+	size_t size=st.st_size, keep=history.max_bytes/2;
+	if (size<=history.max_bytes)
+		_exit(0); // another shell got there first
+	const char *map=mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map==MAP_FAILED)
+		_exit(1);
+	const char *start=memchr(map+size-keep, '\n', keep);
+	start=start?start+1:map+size;
+
+	char tmp[sizeof(history.path)+4];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", history.path);
+	int out=open(tmp, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0600);
+	if (out==-1)
+		_exit(1);
+	if (write_all(out, start, map+size-start)==-1 || fsync(out)==-1 || rename(tmp, history.path)==-1)
+	{
+		unlink(tmp);
+		_exit(1);
+	}
+	_exit(0);
+}
+/**
+ * Append one entry to the file. If a compaction replaced the file since it
+ * was opened, the new one is opened first.
+ * @param text [description]
+ * @param len  [description]
+ */
+void history_write(const char *text, size_t len)
+{
+	struct iovec iov[2]={{(void *)text, len}, {"\n", 1}};
+	struct stat fst, pst;
+	for (int tries=0; tries<2; tries++)
+	{
+		if (flock(history.fd, LOCK_EX)==-1)
+			return;
+		if (tries==0 && fstat(history.fd, &fst)==0 && stat(history.path, &pst)==0
+			&& (fst.st_ino!=pst.st_ino || fst.st_dev!=pst.st_dev))
+		{
+			int fd=open(history.path, O_RDWR|O_APPEND|O_CLOEXEC);
+			if (fd!=-1)
+			{
+				close(history.fd); // drops the lock too
+				history.fd=fd;
+				continue;
+			}
+		}
+		bool full=writev(history.fd, iov, 2)!=-1 && fstat(history.fd, &fst)==0
+			&& (size_t)fst.st_size>history.max_bytes;
+		flock(history.fd, LOCK_UN);
+		if (full)
+			history_compact();
+		return;
+	}
+}
+/**
+ * Add a line to the history, unless it repeats the previous one.
+ * @param text [description]
+ * @param len  [description]
+ */
+void history_add(const char *text, size_t len)
+{
+	if (!history.offsets || len==0 || memchr(text, '\n', len))
+		return;
+	if (history.count)
+	{
+		size_t last_len;
+		const char *last=history_entry(history.count-1, &last_len);
+		if (last_len==len && memcmp(last, text, len)==0)
+			return;
+	}
+	if (history.fd!=-1)
+		history_write(text, len);
+	if (history.tail_len+len+1>history.tail_size)
+	{
+		while (history.tail_len+len+1>history.tail_size)
+			history.tail_size=history.tail_size?history.tail_size*2:4096;
+		history.tail=realloc(history.tail, history.tail_size);
+	}
+	memcpy(history.tail+history.tail_len, text, len);
+	history.tail[history.tail_len+len]='\n';
+	history.tail_len+=len+1;
+	history_push(history.map_len+history.tail_len);
+}
+static inline unsigned history_trigram(const unsigned char *p)
+{
+	return ((p[0]|p[1]<<8|p[2]<<16)*2654435761u)>>21; // 11 bits, one of 2048
+}
+// Bring the trigram filters up to date with the entries added since.
+void history_index()
+{
+	size_t blocks=(history.count+HISTORY_BLOCK-1)/HISTORY_BLOCK;
+	if (blocks>history.filter_blocks)
+	{
+		size_t size=history.filter_blocks?history.filter_blocks:64;
+		while (size<blocks) size*=2;
+		history.filters=realloc(history.filters, size*HISTORY_FILTER_WORDS*sizeof(uint64_t));
+		memset(history.filters+history.filter_blocks*HISTORY_FILTER_WORDS, 0,
+			(size-history.filter_blocks)*HISTORY_FILTER_WORDS*sizeof(uint64_t));
+		history.filter_blocks=size;
+	}
+	for (; history.indexed<history.count; history.indexed++)
+	{
+		uint64_t *filter=history.filters+history.indexed/HISTORY_BLOCK*HISTORY_FILTER_WORDS;
+		size_t len;
+		const unsigned char *text=(const unsigned char *)history_entry(history.indexed, &len);
+		for (size_t i=0; i+3<=len; i++)
+		{
+			unsigned h=history_trigram(text+i);
+			filter[h>>6]|=1ull<<(h&63);
+		}
+	}
+}
+/**
+ * Find the newest entry at or before from that contains the query. Queries
+ * of three bytes or more only look inside the blocks whose filter has every
+ * trigram of the query, so most of a large history is never touched.
+ * @param  query [description]
+ * @param  qlen  [description]
+ * @param  from  index to start at, going backwards
+ * @return       index of the entry, -1 if there is none
+ */
+long history_search(const char *query, size_t qlen, long from)
+{
+	if (from>=(long)history.count)
+		from=(long)history.count-1;
+	if (qlen==0 || from<0)
+		return -1;
+	uint64_t want[HISTORY_FILTER_WORDS]={0};
+	bool filtered=qlen>=3;
+	if (filtered)
+	{
+		history_index();
+		for (size_t i=0; i+3<=qlen; i++)
+		{
+			unsigned h=history_trigram((const unsigned char *)query+i);
+			want[h>>6]|=1ull<<(h&63);
+		}
+	}
+	long i=from;
+	while (i>=0)
+	{
+		long first=i/HISTORY_BLOCK*HISTORY_BLOCK;
+		if (filtered)
+		{
+			const uint64_t *filter=history.filters+i/HISTORY_BLOCK*HISTORY_FILTER_WORDS;
+			int w=0;
+			while (w<HISTORY_FILTER_WORDS && (filter[w]&want[w])==want[w]) w++;
+			if (w<HISTORY_FILTER_WORDS)
+			{
+				i=first-1;
+				continue;
+			}
+		}
+		for (; i>=first; i--)
+		{
+			size_t len;
+			const char *text=history_entry(i, &len);
+			if (len>=qlen && memmem(text, len, query, qlen))
+				return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Draw the reverse search line with one write.
+ * @param query [description]
+ * @param qlen  [description]
+ * @param match entry shown, -1 for none
+ * @param found false once the query stopped matching
+ */
+void search_refresh(const char *query, size_t qlen, long match, bool found)
+{
+	struct winsize ws;
+	size_t cols=80;
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws)==0 && ws.ws_col>0)
+		cols=ws.ws_col;
+	size_t len=0;
+	const char *text=match==-1?"":history_entry(match, &len);
+
+	char *frame=malloc(qlen+len+64), *p=frame;
+	*p++='\r';
+	p+=sprintf(p, "(%sreverse-i-search)`", found?"":"failed ");
+	memcpy(p, query, qlen);
+	p+=qlen;
+	p+=sprintf(p, "': ");
+	memcpy(p, text, len);
+	p+=len;
+	if ((size_t)(p-frame)>cols) // keep to one row
+		p=frame+cols;
+	p+=sprintf(p, "\x1b[0K");
+	write_all(STDOUT_FILENO, frame, p-frame);
+	free(frame);
+}
+/**
+ * Ctrl+R: search the history backwards as the query is typed. Enter runs the
+ * match, ^G or ^C give back the line as it was, and any other key leaves the
+ * match in the line and is then handled by the editor.
+ * @param  line [description]
+ * @return      true if the match should be run right away
+ */
+bool edit_search(struct line_t *line)
+{
+	char query[256];
+	size_t qlen=0;
+	long match=-1;
+	bool found=true, run=false;
+	while (1)
+	{
+		if (input_pos==input_len)
+		{
+			search_refresh(query, qlen, match, found);
+			if (input_fill(-1)==-1)
+				break;
+		}
+		unsigned char c=input_buf[input_pos++];
+		if (c>=32 && c!=127)
+		{
+			if (qlen<sizeof(query))
+				query[qlen++]=c;
+			long m=history_search(query, qlen, match==-1?(long)history.count-1:match);
+			found=m!=-1;
+			if (found) match=m;
+		}
+		else if (c==18) // Ctrl+R again, an older match
+		{
+			long m=match==-1?-1:history_search(query, qlen, match-1);
+			found=m!=-1;
+			if (found) match=m;
+		}
+		else if (c==127 || c==8)
+		{
+			if (qlen) qlen--;
+			match=history_search(query, qlen, history.count-1);
+			found=match!=-1 || qlen==0;
+		}
+		else if (c==7 || c==3) // Ctrl+G, Ctrl+C
+		{
+			match=-1;
+			break;
+		}
+		else
+		{
+			if (c=='\r' || c=='\n')
+				run=true;
+			else
+				input_pos--; // for the editor
+			break;
+		}
+	}
+	if (match!=-1)
+	{
+		size_t len;
+		const char *text=history_entry(match, &len);
+		line_set(line, text, len);
+	}
+	return run;
+}
+
+// Directory listings read with getdents64 and kept sorted by name, for
+// completion and globbing. A listing is reused until the directory's mtime
+// changes. One read within DIR_SETTLE_NS of that mtime is not trusted, as a
+// change in the same clock tick would not move it, and is read again.
+// Large directories can be read a piece at a time against a deadline.
+// With SHELLINGTON_NO_DIR_CACHE set every lookup reads the directory again.
+// The sorted array stands in for a prefix trie. A binary search finds the
+// run of names with a prefix, as a trie walk would. The names stay packed in
+// one arena with no node per character, and one sort after the last read
+// builds it. The same listings serve PATH directories, file arguments and
+// globs.
+#define DIR_CACHE_BUCKETS 256
+#define DIR_SETTLE_NS 20000000
+struct dir_entry_t {
+	const char *name;
+	unsigned char type; // DT_* as reported, DT_UNKNOWN if the filesystem does not say
+};
+struct dir_listing_t {
+	char *path; // absolute
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	bool settled;
+	int fd; // open while a read is under way
+	bool complete; // read to the end, entries are sorted
+	struct arena_t names;
+	struct dir_entry_t *entries; // without . and ..
+	size_t count, size;
+	struct dir_listing_t *next;
+};
+struct dir_listing_t *dir_cache[DIR_CACHE_BUCKETS];
+bool dir_cache_off;
+
+static inline void dir_swap(struct dir_entry_t *a, struct dir_entry_t *b)
+{
+	struct dir_entry_t t=*a;
+	*a=*b;
+	*b=t;
+}
+/**
+ * Sort entries by name with a three way radix quicksort, which looks at
+ * each byte of a shared prefix once instead of in every comparison.
+ * @param entries [description]
+ * @param n       [description]
+ * @param depth   bytes every name is already known to share
+ */
+void dir_sort(struct dir_entry_t *entries, size_t n, size_t depth)
+{
+	while (n>1)
+	{
+		if (n<16)
+		{
+			for (size_t i=1; i<n; i++)
+				for (size_t j=i; j>0 && strcmp(entries[j-1].name+depth, entries[j].name+depth)>0; j--)
+					dir_swap(&entries[j-1], &entries[j]);
+			return;
+		}
+		dir_swap(&entries[0], &entries[n/2]);
+		unsigned char pivot=entries[0].name[depth];
+		size_t lt=0, i=0, gt=n; // [0,lt) below the pivot, [lt,i) equal, [gt,n) above
+		while (i<gt)
+		{
+			unsigned char c=entries[i].name[depth];
+			if (c<pivot) dir_swap(&entries[lt++], &entries[i++]);
+			else if (c>pivot) dir_swap(&entries[i], &entries[--gt]);
+			else i++;
+		}
+		dir_sort(entries, lt, depth);
+		if (pivot) dir_sort(entries+lt, gt-lt, depth+1);
+		entries+=gt;
+		n-=gt;
+	}
+}
+/**
+ * Read more of the directory, until its end or the deadline.
+ * @param  listing  [description]
+ * @param  deadline monotonic_ns() to stop at, 0 to read it all
+ * @return          false if it could not be read
+ */
+bool dir_read(struct dir_listing_t *listing, uint64_t deadline)
+{
+	if (listing->fd==-1) // from the start
+	{
+		struct stat st;
+		listing->fd=open(listing->path, O_RDONLY|O_DIRECTORY|O_CLOEXEC);
+		if (listing->fd==-1)
+			return false;
+		fstat(listing->fd, &st);
+		listing->dev=st.st_dev;
+		listing->ino=st.st_ino;
+		listing->mtime=st.st_mtim;
+		listing->complete=false;
+		listing->count=0;
+		arena_reset(&listing->names);
+	}
+	_Alignas(struct dirent64) char buf[32768];
+	ssize_t n;
+	while ((n=getdents64(listing->fd, buf, sizeof(buf)))>0)
+	{
+		for (ssize_t pos=0; pos<n;)
+		{
+			struct dirent64 *ent=(struct dirent64 *)(buf+pos);
+			pos+=ent->d_reclen;
+			const char *name=ent->d_name;
+			if (name[0]=='.' && (name[1]==0 || (name[1]=='.' && name[2]==0)))
+				continue;
+			if (listing->count==listing->size)
+			{
+				listing->size=listing->size?listing->size*2:256;
+				listing->entries=realloc(listing->entries, sizeof(struct dir_entry_t)*listing->size);
+			}
+			listing->entries[listing->count].name=arena_strdup(&listing->names, name);
+			listing->entries[listing->count++].type=ent->d_type;
+		}
+		if (deadline && monotonic_ns()>=deadline)
+			return true;
+	}
+	close(listing->fd);
+	listing->fd=-1;
+	if (n==-1)
+		return false;
+	dir_sort(listing->entries, listing->count, 0);
+	listing->complete=true;
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	int64_t age=(int64_t)(now.tv_sec-listing->mtime.tv_sec)*1000000000+(now.tv_nsec-listing->mtime.tv_nsec);
+	listing->settled=age>DIR_SETTLE_NS;
+	return true;
+}
+/**
+ * The listing of an absolute directory path, read again only if the
+ * directory changed since.
+ * @param  path     [description]
+ * @param  deadline as for dir_read, the listing may come back incomplete
+ * @return          NULL if it is not a readable directory
+ */
+struct dir_listing_t *dir_listing(const char *path, uint64_t deadline)
+{
+	struct dir_listing_t **bucket=&dir_cache[hash_string(path)&(DIR_CACHE_BUCKETS-1)];
+	struct dir_listing_t *listing=*bucket;
+	while (listing && strcmp(listing->path, path)!=0)
+		listing=listing->next;
+	struct stat st;
+	if (stat(path, &st)==-1 || !S_ISDIR(st.st_mode))
+		return NULL;
+	if (!listing)
+	{
+		listing=calloc(1, sizeof(struct dir_listing_t));
+		listing->path=strdup(path);
+		listing->fd=-1;
+		listing->next=*bucket;
+		*bucket=listing;
+	}
+	bool same=listing->dev==st.st_dev && listing->ino==st.st_ino
+		&& listing->mtime.tv_sec==st.st_mtim.tv_sec && listing->mtime.tv_nsec==st.st_mtim.tv_nsec;
+	if (listing->complete && listing->settled && same && !dir_cache_off)
+		return listing;
+	if (listing->fd!=-1 && !same) // changed halfway through, start over
+	{
+		close(listing->fd);
+		listing->fd=-1;
+	}
+	return dir_read(listing, deadline)?listing:NULL;
+}
+/**
+ * Find the entries of a complete listing whose names start with prefix.
+ * Sorting makes them one run, found with a binary search.
+ * @param  listing [description]
+ * @param  prefix  [description]
+ * @param  len     length of prefix
+ * @param  count   set to the number of entries in the run
+ * @return         the first entry of the run
+ */
+struct dir_entry_t *dir_prefix(struct dir_listing_t *listing, const char *prefix, size_t len, size_t *count)
+{
+	if (len==0)
+	{
+		*count=listing->count;
+		return listing->entries;
+	}
+	size_t lo=0, hi=listing->count;
+	while (lo<hi)
+	{
+		size_t mid=(lo+hi)/2;
+		if (strncmp(listing->entries[mid].name, prefix, len)<0)
+			lo=mid+1;
+		else
+			hi=mid;
+	}
+	size_t end=lo;
+	while (end<listing->count && strncmp(listing->entries[end].name, prefix, len)==0)
+		end++;
+	*count=end-lo;
+	return listing->entries+lo;
+}
+
+// Glob expansion of the words the parser marked. A pattern is matched one
+// path component at a time: literal components are appended without
+// looking at the directory, the others are matched against its cached
+// listing, narrowed first to the run of names sharing the literal text in
+// front of the first metacharacter. Dot files only match a leading dot.
+struct glob_t {
+	char *parts[PATH_MAX/2]; // the pattern's components
+	bool literal[PATH_MAX/2]; // the component has no metacharacters, its escapes are dropped
+	size_t part_count;
+	bool dir_only; // pattern ends with a slash
+	char path[PATH_MAX]; // root, then the matched path
+	size_t root; // the part of path the matches do not show
+	size_t dirs; // directories listed, more than one and the matches are sorted again
+	struct arena_t *arena;
+	char **matches;
+	size_t count, size;
+};
+/**
+ * Match one pattern element, a character, ? or a [...] class, against c.
+ * @param  p [description]
+ * @param  c [description]
+ * @return   the element after it if it matches, NULL if not
+ */
+const char *glob_element(const char *p, unsigned char c)
+{
+	if (*p=='?')
+		return p+1;
+	if (*p=='[')
+	{
+		const char *q=p+1;
+		bool negate=*q=='!' || *q=='^';
+		if (negate) q++;
+		bool found=false;
+		for (bool first=true; *q && (first || *q!=']'); first=false)
+		{
+			unsigned char lo=*q++;
+			if (lo=='\\' && *q) lo=*q++;
+			unsigned char hi=lo;
+			if (*q=='-' && q[1] && q[1]!=']')
+			{
+				q++;
+				hi=*q++;
+				if (hi=='\\' && *q) hi=*q++;
+			}
+			if (lo<=c && c<=hi) found=true;
+		}
+		if (*q==']')
+			return found!=negate?q+1:NULL;
+		// no closing bracket, the [ is an ordinary character
+	}
+	else if (*p=='\\' && p[1])
+		p++;
+	return (unsigned char)*p==c?p+1:NULL;
+}
+/**
+ * Match a name against a pattern component, backtracking only to the
+ * last star. A star followed by plain text is a test of the name's end.
+ * @param  p    [description]
+ * @param  name [description]
+ * @return      [description]
+ */
+bool glob_match(const char *p, const char *name)
+{
+	const char *star=NULL, *resume=NULL;
+	while (*name)
+	{
+		if (*p=='*')
+		{
+			while (*p=='*') p++;
+			size_t tail=strcspn(p, "*?[\\");
+			if (!p[tail]) // only literal text left, *.log and the like
+			{
+				size_t len=strlen(name);
+				return len>=tail && memcmp(name+len-tail, p, tail)==0;
+			}
+			star=p;
+			resume=name;
+			continue;
+		}
+		const char *next=*p?glob_element(p, *name):NULL;
+		if (next)
+		{
+			p=next;
+			name++;
+		}
+		else if (star)
+		{
+			p=star;
+			name=++resume;
+		}
+		else
+			return false;
+	}
+	while (*p=='*') p++;
+	return !*p;
+}
+// Length of the literal text in front of the first metacharacter or escape.
+size_t glob_prefix(const char *p)
+{
+	return strcspn(p, "*?[\\");
+}
+/**
+ * Whether a component has any metacharacter, and if not drop its escapes.
+ * @param  part [description]
+ * @return      [description]
+ */
+bool glob_literal(char *part)
+{
+	for (const char *p=part; *p; p++)
+	{
+		if (*p=='\\' && p[1]) p++;
+		else if (*p=='*' || *p=='?' || *p=='[') return false;
+	}
+	char *out=part;
+	for (const char *p=part; *p; p++)
+	{
+		if (*p=='\\' && p[1]) p++;
+		*out++=*p;
+	}
+	*out=0;
+	return true;
+}
+void glob_add(struct glob_t *glob, size_t len)
+{
+	if (glob->count==glob->size)
+	{
+		glob->size=glob->size?glob->size*2:64;
+		glob->matches=realloc(glob->matches, sizeof(char *)*glob->size);
+	}
+	char *match=arena_alloc(glob->arena, len-glob->root+1);
+	memcpy(match, glob->path+glob->root, len-glob->root);
+	match[len-glob->root]=0;
+	glob->matches[glob->count++]=match;
+}
+/**
+ * Append a name to the path, with a slash after it if asked.
+ * @return the new length, 0 if it does not fit
+ */
+size_t glob_append(struct glob_t *glob, size_t len, const char *name, bool slash)
+{
+	size_t n=strlen(name);
+	if (len+n+2>sizeof(glob->path)) return 0;
+	memcpy(glob->path+len, name, n);
+	len+=n;
+	if (slash) glob->path[len++]='/';
+	glob->path[len]=0;
+	return len;
+}
+// Whether the entry at the end of the path is a directory, symlinks followed
+// unless only real directories are wanted.
+bool glob_is_dir(struct glob_t *glob, const struct dir_entry_t *ent, bool follow)
+{
+	if (ent->type==DT_DIR) return true;
+	if (ent->type!=DT_UNKNOWN && (ent->type!=DT_LNK || !follow)) return false;
+	struct stat st;
+	return (follow?stat(glob->path, &st):lstat(glob->path, &st))==0 && S_ISDIR(st.st_mode);
+}
+/**
+ * The listing of the directory the path ends in.
+ * @param  glob [description]
+ * @param  len  length of the path, which ends with a slash
+ * @return      NULL if it cannot be read
+ */
+struct dir_listing_t *glob_listing(struct glob_t *glob, size_t len)
+{
+	glob->dirs++;
+	if (len>1) glob->path[len-1]=0; // the cache knows directories without the slash
+	struct dir_listing_t *listing=dir_listing(glob->path, 0);
+	glob->path[len-1]='/';
+	return listing;
+}
+/**
+ * Match the components from part on below the directory the path ends in.
+ * @param glob [description]
+ * @param part [description]
+ * @param len  length of the path, ending with a slash
+ */
+void glob_walk(struct glob_t *glob, size_t part, size_t len)
+{
+	char *pattern=glob->parts[part];
+	bool last=part+1==glob->part_count;
+	if (glob->literal[part]) // nothing to scan, the next directory down tells if it is there
+	{
+		size_t end=glob_append(glob, len, pattern, !last || glob->dir_only);
+		if (!end) return;
+		struct stat st;
+		if (!last)
+			glob_walk(glob, part+1, end);
+		else if (lstat(glob->path, &st)==0)
+			glob_add(glob, end);
+		return;
+	}
+	if (strcmp(pattern, "**")==0) // any number of directories, none included
+	{
+		// before the listing is held, matching the rest here may read it again
+		if (!last)
+			glob_walk(glob, part+1, len);
+		struct dir_listing_t *listing=glob_listing(glob, len);
+		if (!listing) return;
+		for (size_t i=0; i<listing->count; i++)
+		{
+			const struct dir_entry_t *ent=&listing->entries[i];
+			if (ent->name[0]=='.') continue;
+			size_t end=glob_append(glob, len, ent->name, false);
+			if (!end) continue;
+			bool dir=glob_is_dir(glob, ent, false); // symlinks are not descended
+			size_t below=dir?glob_append(glob, end, "", true):0;
+			size_t shown=glob->dir_only?below:end; // 0 if it is not to be shown
+			if (last && shown)
+				glob_add(glob, shown);
+			if (below)
+				glob_walk(glob, part, below);
+		}
+		return;
+	}
+	struct dir_listing_t *listing=glob_listing(glob, len);
+	if (!listing) return;
+	size_t prefix=glob_prefix(pattern), count;
+	bool hidden=pattern[0]=='.';
+	const struct dir_entry_t *ent=dir_prefix(listing, pattern, prefix, &count);
+	for (size_t i=0; i<count; i++, ent++)
+	{
+		if (ent->name[0]=='.' && !hidden) continue;
+		if (!glob_match(pattern+prefix, ent->name+prefix)) continue;
+		size_t end=glob_append(glob, len, ent->name, false);
+		if (!end) continue;
+		if (last && !glob->dir_only)
+			glob_add(glob, end);
+		else if (glob_is_dir(glob, ent, true) && (end=glob_append(glob, end, "", true)))
+		{
+			if (last)
+				glob_add(glob, end);
+			else
+				glob_walk(glob, part+1, end);
+		}
+	}
+}
+int glob_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+/**
+ * Expand a pattern into the paths it matches, sorted.
+ * @param  pattern [description]
+ * @param  arena   the matches are allocated from it
+ * @param  count   set to the number of matches
+ * @return         malloc'd array of the matches, NULL if there are none
+ */
+char **glob_expand(const char *pattern, struct arena_t *arena, size_t *count)
+{
+	struct glob_t *glob=calloc(1, sizeof(struct glob_t));
+	glob->arena=arena;
+	char *copy=strdup(pattern);
+	for (char *part=strtok(copy, "/"); part && glob->part_count<PATH_MAX/2; part=strtok(NULL, "/"))
+	{
+		glob->literal[glob->part_count]=glob_literal(part);
+		glob->parts[glob->part_count++]=part;
+	}
+	size_t len=strlen(pattern);
+	glob->dir_only=len>1 && pattern[len-1]=='/';
+
+	// relative patterns are matched below the cwd, which the matches leave out
+	if (pattern[0]=='/')
+		glob->path[0]='/';
+	else
+	{
+		if (!prompt_cwd) prompt_update_cwd();
+		glob->root=glob_append(glob, 0, prompt_cwd, strcmp(prompt_cwd, "/")!=0);
+	}
+	if (glob->part_count)
+		glob_walk(glob, 0, pattern[0]=='/'?1:glob->root);
+	if (glob->count>1 && glob->dirs>1)
+		qsort(glob->matches, glob->count, sizeof(char *), glob_cmp);
+	char **matches=glob->matches;
+	*count=glob->count;
+	free(copy);
+	free(glob);
+	return matches;
+}
+// Whether any stage of the command has glob words.
+bool command_globs(struct command_t *command)
+{
+	for (; command; command=command->next)
+		if (command->patterns) return true;
+	return false;
+}
+/**
+ * A copy of the command with its glob words replaced by what they match,
+ * allocated from arena. Words that match nothing are kept as they were.
+ * The command itself is left alone, it may be a template run again later.
+ * @param  command [description]
+ * @param  arena   [description]
+ * @return         the expanded copy
+ */
+struct command_t *glob_command(struct command_t *command, struct arena_t *arena)
+{
+	struct command_t *first=NULL, **link=&first;
+	for (struct command_t *c=command; c; c=c->next)
+	{
+		struct command_t *stage=new_command(arena);
+		size_t count=0, size=c->arg_count+2;
+		char **words=malloc(sizeof(char *)*size);
+		for (int i=0; i<=c->arg_count; ++i)
+		{
+			size_t n=0;
+			char **matches=c->patterns && c->patterns[i]?glob_expand(c->patterns[i], arena, &n):NULL;
+			if (count+n+1>size)
+				words=realloc(words, sizeof(char *)*(size=2*size+n));
+			if (n)
+			{
+				memcpy(words+count, matches, sizeof(char *)*n);
+				count+=n;
+			}
+			else
+				words[count++]=c->argv[i];
+			free(matches);
+		}
+		parse_finish_stage(stage, words, count);
+		free(words);
+		memcpy(stage->redirects, c->redirects, sizeof(c->redirects));
+		stage->background=c->background;
+		stage->auto_complete=c->auto_complete;
+		*link=stage;
+		link=&stage->next;
+	}
+	return first;
+}
+
+// Tab completion. The word before the cursor is completed as a command when
+// it starts a pipeline stage and has no slash, otherwise as a path. Command
+// candidates are gathered one PATH directory per step within a frame's time,
+// so a cold PATH shows what was found so far and the next tab goes on.
+#define COMPLETE_BUDGET_NS 16000000
+#define COMPLETE_LIST_MAX 200
+const char *builtin_name(size_t i);
+struct candidate_t {
+	char *name;
+	bool dir;
+};
+struct completion_t {
+	bool active; // false once any other key is pressed
+	int tabs; // pressed in a row
+	char *word; // as the parser will see it, quotes and escapes removed
+	size_t word_len;
+	char quote; // quote still open at the cursor
+	bool command;
+	char *dir; // absolute directory searched for paths
+	const char *prefix; // part of word after its last slash
+	size_t prefix_len;
+	int step; // -1 for builtins, then PATH directories
+	uint64_t deadline;
+	bool done;
+	struct candidate_t *items;
+	size_t count, size;
+};
+
+void complete_clear(struct completion_t *comp)
+{
+	for (size_t i=0; i<comp->count; i++)
+		free(comp->items[i].name);
+	free(comp->items);
+	free(comp->word);
+	free(comp->dir);
+	memset(comp, 0, sizeof(*comp));
+}
+void complete_add(struct completion_t *comp, const char *name, bool dir)
+{
+	if (comp->count==comp->size)
+	{
+		comp->size=comp->size?comp->size*2:64;
+		comp->items=realloc(comp->items, sizeof(struct candidate_t)*comp->size);
+	}
+	comp->items[comp->count].name=strdup(name);
+	comp->items[comp->count++].dir=dir;
+}
+/**
+ * Find the word under the cursor, reading the line the way the parser will.
+ * @param comp [description]
+ * @param line [description]
+ */
+void complete_start(struct completion_t *comp, struct line_t *line)
+{
+	complete_clear(comp);
+	comp->active=true;
+	comp->word=malloc(line->pos+1);
+	bool command=true;
+	char quote=0;
+	size_t len=0;
+	for (size_t i=0; i<line->pos; i++)
+	{
+		char c=line->buf[i];
+		if (quote)
+		{
+			if (c==quote) quote=0;
+			else comp->word[len++]=c;
+		}
+		else if (c=='\\' && i+1<line->pos)
+			comp->word[len++]=line->buf[++i];
+		else if (c=='"' || c=='\'')
+			quote=c;
+		else if (c==' ' || c=='\t' || c=='|' || c=='&' || c=='<' || c=='>')
+		{
+			if (c=='|' || c=='&') command=true;
+			else if (c=='<' || c=='>' || len) command=false;
+			len=0;
+		}
+		else
+			comp->word[len++]=c;
+	}
+	comp->word[len]=0;
+	comp->word_len=len;
+	comp->quote=quote;
+
+	char *slash=strrchr(comp->word, '/');
+	comp->command=command && !slash;
+	comp->prefix=slash?slash+1:comp->word;
+	comp->prefix_len=comp->word+len-comp->prefix;
+	comp->step=comp->command?-1:0;
+	if (comp->command) return;
+
+	// the directory the path is relative to, ~ standing for $HOME
+	const char *base=comp->word;
+	size_t base_len=comp->prefix-comp->word;
+	const char *root=prompt_cwd;
+	if (base_len && base[0]=='/')
+		root="";
+	else if (base_len && base[0]=='~' && base[1]=='/')
+	{
+		root=getenv("HOME")?getenv("HOME"):"";
+		base+=2;
+		base_len-=2;
+	}
+	comp->dir=malloc(strlen(root)+base_len+2);
+	sprintf(comp->dir, "%s%s%.*s", root, *root?"/":"", (int)base_len, base);
+}
+/**
+ * Gather the candidates of one directory.
+ * @param  comp [description]
+ */
+void complete_step(struct completion_t *comp)
+{
+	bool hidden=comp->prefix[0]=='.';
+	if (comp->step==-1)
+	{
+		const char *name;
+		for (size_t i=0; (name=builtin_name(i)); i++)
+			if (strncmp(name, comp->prefix, comp->prefix_len)==0)
+				complete_add(comp, name, false);
+		comp->step++;
+		return;
+	}
+	const char *dir=comp->dir;
+	char path[4096];
+	if (comp->command)
+	{
+		if (comp->step>=path_dir_count)
+		{
+			comp->done=true;
+			return;
+		}
+		dir=path_dirs[comp->step].path;
+		if (dir[0]!='/') // relative PATH entries follow the current directory
+		{
+			snprintf(path, sizeof(path), "%s/%s", prompt_cwd, dir);
+			dir=path;
+		}
+	}
+	struct dir_listing_t *listing=dir_listing(dir, comp->deadline);
+	size_t count=0;
+	struct dir_entry_t *ent=NULL;
+	if (listing && listing->complete)
+		ent=dir_prefix(listing, comp->prefix, comp->prefix_len, &count);
+	else if (listing) // what was read so far, this directory is visited again
+	{
+		ent=listing->entries;
+		count=listing->count;
+	}
+	if (!listing || listing->complete)
+	{
+		comp->step++;
+		if (!comp->command) comp->done=true;
+	}
+	for (size_t i=0; i<count; i++, ent++)
+	{
+		if (strncmp(ent->name, comp->prefix, comp->prefix_len)!=0) continue;
+		if (ent->name[0]=='.' && !hidden) continue;
+		bool is_dir=ent->type==DT_DIR;
+		if (ent->type==DT_LNK || ent->type==DT_UNKNOWN)
+		{
+			struct stat st;
+			snprintf(path, sizeof(path), "%s/%s", listing->path, ent->name);
+			is_dir=stat(path, &st)==0 && S_ISDIR(st.st_mode);
+		}
+		if (comp->command && is_dir) continue;
+		complete_add(comp, ent->name, is_dir);
+	}
+}
+int candidate_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct candidate_t *)a)->name, ((const struct candidate_t *)b)->name);
+}
+// Gather candidates until done or out of time, then sort them and drop repeats.
+void complete_run(struct completion_t *comp)
+{
+	if (comp->command) path_dirs_load();
+	comp->deadline=monotonic_ns()+COMPLETE_BUDGET_NS;
+	do
+		complete_step(comp);
+	while (!comp->done && monotonic_ns()<comp->deadline);
+
+	qsort(comp->items, comp->count, sizeof(struct candidate_t), candidate_cmp);
+	size_t kept=0;
+	for (size_t i=0; i<comp->count; i++)
+	{
+		if (kept && strcmp(comp->items[kept-1].name, comp->items[i].name)==0)
+		{
+			free(comp->items[i].name);
+			continue;
+		}
+		comp->items[kept++]=comp->items[i];
+	}
+	comp->count=kept;
+}
+// Insert text at the cursor, escaped unless it goes inside quotes.
+void complete_insert(struct line_t *line, const char *text, size_t n, char quote)
+{
+	for (size_t i=0; i<n; i++)
+	{
+		if (!quote && strchr(" \t\\'\"|&<>", text[i]))
+			line_insert(line, "\\", 1);
+		line_insert(line, text+i, 1);
+	}
+}
+/**
+ * Print the candidates in columns below the line, ls style.
+ * @param comp [description]
+ */
+void complete_list(struct completion_t *comp)
+{
+	struct winsize ws;
+	size_t cols=80, width=1;
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws)==0 && ws.ws_col>0)
+		cols=ws.ws_col;
+	size_t count=comp->count<COMPLETE_LIST_MAX?comp->count:COMPLETE_LIST_MAX;
+	for (size_t i=0; i<count; i++)
+	{
+		size_t len=strlen(comp->items[i].name)+comp->items[i].dir+2;
+		if (len>width) width=len;
+	}
+	size_t per_row=cols/width?cols/width:1, rows=(count+per_row-1)/per_row;
+
+	size_t size=(rows+2)*(cols+8)+64;
+	char *out=malloc(size), *p=out;
+	*p++='\n';
+	for (size_t r=0; r<rows; r++)
+	{
+		for (size_t c=0; c<per_row; c++)
+		{
+			size_t i=c*rows+r;
+			if (i>=count) break;
+			int n=sprintf(p, "%s%s", comp->items[i].name, comp->items[i].dir?"/":"");
+			p+=n;
+			if (c+1<per_row && i+rows<count)
+				for (; (size_t)n<width; n++) *p++=' ';
+		}
+		*p++='\n';
+	}
+	if (comp->count>count)
+		p+=sprintf(p, "(%zu more)\n", comp->count-count);
+	if (!comp->done)
+		p+=sprintf(p, "(still reading, tab again for more)\n");
+	write_all(STDOUT_FILENO, out, p-out);
+	free(out);
+}
+/**
+ * Handle tab: complete as far as every candidate agrees, and list them
+ * when a second tab finds nothing more to add.
+ * @param line [description]
+ * @param comp [description]
+ */
+void complete_key(struct line_t *line, struct completion_t *comp)
+{
+	int tabs=comp->tabs+1;
+	if (!comp->active)
+		complete_start(comp, line);
+	comp->tabs=tabs;
+	complete_run(comp);
+	if (comp->count==0 && comp->done)
+	{
+		write_all(STDOUT_FILENO, "\a", 1);
+		return;
+	}
+	if (!comp->done) // show what there is so far
+	{
+		complete_list(comp);
+		return;
+	}
+	// longest prefix every candidate shares
+	const char *first=comp->items[0].name, *last=comp->items[comp->count-1].name;
+	size_t common=0;
+	while (first[common] && first[common]==last[common]) common++;
+
+	if (comp->count==1 || common>comp->prefix_len)
+	{
+		complete_insert(line, first+comp->prefix_len, common-comp->prefix_len, comp->quote);
+		if (comp->count==1)
+		{
+			if (comp->items[0].dir)
+				line_insert(line, "/", 1);
+			else
+			{
+				if (comp->quote) line_insert(line, &comp->quote, 1);
+				line_insert(line, " ", 1);
+			}
+		}
+		comp->active=false; // the word changed, start again on the next tab
+		comp->tabs=comp->count==1?0:1;
+		return;
+	}
+	if (comp->tabs>=2)
+		complete_list(comp);
+}
+
+enum edit_result { EDIT_LINE, EDIT_EOF };
+/**
+ * Read and edit one line. Everything already read is applied before the
+ * line is redrawn, so a paste costs one frame per chunk, not one per key.
+ * @param  line [description]
+ * @return      EDIT_LINE when enter is pressed, EDIT_EOF on ^D or end of
+ *              input
+ */
+int edit_line(struct line_t *line)
+{
+	bool dirty=false;
+	size_t browse=history.count; // history entry shown, count for the line being typed
+	char *saved=NULL; // the line being typed while browsing
+	size_t saved_len=0;
+	struct completion_t comp={0};
+	int result;
+	line_reserve(line, 0);
+
+	while (1)
+	{
+		if (input_pos==input_len)
+		{
+			if (dirty) line_refresh(line);
+			dirty=false;
+			if (input_fill(-1)==-1)
+			{
+				result=line->len?EDIT_LINE:EDIT_EOF;
+				break;
+			}
+		}
+		unsigned char c=input_buf[input_pos++];
+		if (c!=9) comp.active=false, comp.tabs=0;
+
+		if (c>=32 && c!=127) // printable, take the whole run at once
+		{
+			size_t start=input_pos-1;
+			while (input_pos<input_len && (unsigned char)input_buf[input_pos]>=32 && input_buf[input_pos]!=127)
+				input_pos++;
+			line_insert(line, input_buf+start, input_pos-start);
+			dirty=true;
+			continue;
+		}
+		if (c=='\r' || c=='\n') // enter key
+		{
+			result=EDIT_LINE;
+			break;
+		}
+		if (c==9) // handle tab
+		{
+			complete_key(line, &comp);
+			dirty=true;
+			continue;
+		}
+		if (c==4) // Ctrl+D deletes forward, or ends input on an empty line
+		{
+			if (line->len==0)
+			{
+				result=EDIT_EOF;
+				break;
+			}
+			if (line->pos<line->len)
+				line_delete(line, line->pos, line->pos+1);
+			dirty=true;
+			continue;
+		}
+		if (c==18) // Ctrl+R
+		{
+			if (edit_search(line))
+			{
+				result=EDIT_LINE;
+				break;
+			}
+			dirty=true;
+			continue;
+		}
+		if (c==3) // Ctrl+C drops the line
+		{
+			write_all(STDOUT_FILENO, "^C\n", 3);
+			line->len=line->pos=line->view=0;
+			show_prompt();
+			continue;
+		}
+		dirty=true;
+		if (c==127 || c==8) // handle backspace
+		{
+			if (line->pos>0)
+				line_delete(line, line->pos-1, line->pos);
+		}
+		else if (c==1) // Ctrl+A
+			line->pos=0;
+		else if (c==5) // Ctrl+E
+			line->pos=line->len;
+		else if (c==2) // Ctrl+B
+		{
+			if (line->pos>0) line->pos--;
+		}
+		else if (c==6) // Ctrl+F
+		{
+			if (line->pos<line->len) line->pos++;
+		}
+		else if (c==11) // Ctrl+K kills to the end
+			line->len=line->pos;
+		else if (c==21) // Ctrl+U kills to the start
+			line_delete(line, 0, line->pos);
+		else if (c==23) // Ctrl+W kills the word before the cursor
+		{
+			size_t from=line->pos;
+			while (from>0 && line->buf[from-1]==' ') from--;
+			while (from>0 && line->buf[from-1]!=' ') from--;
+			line_delete(line, from, line->pos);
+		}
+		else if (c==12) // Ctrl+L
+			write_all(STDOUT_FILENO, "\x1b[H\x1b[2J", 7);
+		else if (c==27) // handle multi-code keys
+		{
+			// the rest of an escape sequence arrives together with the ESC
+			char seq[8];
+			size_t n=0;
+			while (n<sizeof(seq) && input_fill(50)==1)
+			{
+				seq[n++]=input_buf[input_pos++];
+				if (n==1 && seq[0]!='[' && seq[0]!='O') break;
+				if (n>1 && (isalpha((unsigned char)seq[n-1]) || seq[n-1]=='~')) break;
+			}
+			if (n<2) continue;
+			char key=seq[n-1];
+			int num=key=='~'?atoi(seq+1):0;
+			if (key=='A' || key=='B') // up and down arrows
+			{
+				if (key=='A' && browse>0)
+				{
+					if (browse==history.count)
+					{
+						saved_len=line->len;
+						saved=memcpy(malloc(saved_len+1), line->buf, saved_len);
+					}
+					size_t len;
+					const char *text=history_entry(--browse, &len);
+					line_set(line, text, len);
+				}
+				else if (key=='B' && browse<history.count)
+				{
+					if (++browse==history.count)
+					{
+						line_set(line, saved, saved_len);
+						free(saved);
+						saved=NULL;
+					}
+					else
+					{
+						size_t len;
+						const char *text=history_entry(browse, &len);
+						line_set(line, text, len);
+					}
+				}
+			}
+			else if (key=='C') // right arrow
+			{
+				if (line->pos<line->len) line->pos++;
+			}
+			else if (key=='D') // left arrow
+			{
+				if (line->pos>0) line->pos--;
+			}
+			else if (key=='H' || num==1 || num==7) // home
+				line->pos=0;
+			else if (key=='F' || num==4 || num==8) // end
+				line->pos=line->len;
+			else if (num==3) // delete
+			{
+				if (line->pos<line->len)
+					line_delete(line, line->pos, line->pos+1);
+			}
+		}
+	}
+	free(saved);
+	complete_clear(&comp);
+	line->pos=line->len;
+	line_refresh(line);
+	write_all(STDOUT_FILENO, "\n", 1);
+	line->buf[line->len]=0;
+	return result;
+}
+/**
+ * Read a line without a terminal: no prompt redraws or echo handling,
+ * the bytes are taken as they come.
+ * @param  line [description]
+ * @return      EDIT_LINE or EDIT_EOF
+ */
+int read_plain_line(struct line_t *line)
+{
+	while (1)
+	{
+		if (input_fill(-1)==-1)
+		{
+			line_reserve(line, 0);
+			line->buf[line->len]=0;
+			return line->len?EDIT_LINE:EDIT_EOF;
+		}
+		char *start=input_buf+input_pos;
+		char *nl=memchr(start, '\n', input_len-input_pos);
+		size_t n=nl?(size_t)(nl-start):input_len-input_pos;
+		line->pos=line->len;
+		line_insert(line, start, n);
+		input_pos+=n;
+		if (nl)
+		{
+			input_pos++;
+			line->buf[line->len]=0;
+			return EDIT_LINE;
+		}
+	}
+}
+/**
+ * Prompt a command from the user
+ * @param  command [description]
+ * @return          [description]
+ */
+int prompt(struct command_t *command)
+{
+	static struct line_t line;
+	line.len=line.pos=line.view=0;
+	jobs_notify();
+	reminders_sync(); // reminders added by other shells
+	show_prompt();
+
+	int result;
+	if (term_ok)
+	{
+		term_set_raw();
+		result=edit_line(&line);
+	}
+	else
+	{
+		result=read_plain_line(&line);
+		if (result==EDIT_LINE)
+		{
+			// echo what was read, like the terminal would have
+			write_all(STDOUT_FILENO, line.buf, line.len);
+			write_all(STDOUT_FILENO, "\n", 1);
+		}
+	}
+	if (result==EDIT_EOF)
+		return EXIT;
+	if (result==EDIT_LINE)
+		history_add(line.buf, line.len);
+
+	parse_command(line.buf, command);
+
+	// print_command(command); // DEBUG: uncomment for debugging
+	return SUCCESS;
+}
+
+// Directory aliases of the short command, in an open addressing table keyed
+// by alias. The table is written to short.db in init_dir after every change
+// and mapped back in at startup. The file is a header and then one record
+// per alias, each two lengths followed by the alias and the directory.
+#define ALIAS_MAGIC 0x54524853 // "SHRT"
+struct alias_t {
+	char *name; // NULL marks an empty slot
+	char *dir;
+};
+struct alias_header_t {
+	uint32_t magic;
+	uint32_t count;
+};
+struct alias_record_t {
+	uint32_t name_len;
+	uint32_t dir_len;
+};
+struct alias_t *alias_table; // size is a power of two
+size_t alias_table_size, alias_table_used;
+
+struct alias_t *alias_find(const char *name)
+{
+	if (!alias_table_size) return NULL;
+	size_t mask=alias_table_size-1;
+	for (size_t i=hash_string(name)&mask; alias_table[i].name; i=(i+1)&mask)
+		if (strcmp(alias_table[i].name, name)==0)
+			return &alias_table[i];
+	return NULL;
+}
+/**
+ * Point an alias at a directory, taking ownership of both strings.
+ * @param  name [description]
+ * @param  dir  [description]
+ * @return      true if the alias existed and was overridden
+ */
+bool alias_put(char *name, char *dir)
+{
+	struct alias_t *found=alias_find(name);
+	if (found)
+	{
+		free(found->dir);
+		free(name);
+		found->dir=dir;
+		return true;
+	}
+	if ((alias_table_used+1)*4>alias_table_size*3) // keep load factor under 3/4
+	{
+		struct alias_t *old=alias_table;
+		size_t old_size=alias_table_size;
+		alias_table_size=old_size?old_size*2:64;
+		alias_table=calloc(alias_table_size, sizeof(struct alias_t));
+		alias_table_used=0;
+		for (size_t i=0;i<old_size;++i)
+			if (old[i].name)
+				alias_put(old[i].name, old[i].dir);
+		free(old);
+	}
+	size_t mask=alias_table_size-1, i=hash_string(name)&mask;
+	while (alias_table[i].name)
+		i=(i+1)&mask;
+	alias_table[i].name=name;
+	alias_table[i].dir=dir;
+	alias_table_used++;
+	return false;
+}
+void alias_path(char *path, size_t size)
+{
+	snprintf(path, size, "%s/short.db", init_dir);
+}
+// Map the snapshot and fill the table from it.
+void alias_load()
+{
+	char path[1100];
+	alias_path(path, sizeof(path));
+	int fd=open(path, O_RDONLY|O_CLOEXEC);
+	if (fd==-1) return;
+	struct stat st;
+	if (fstat(fd, &st)==-1 || (size_t)st.st_size<sizeof(struct alias_header_t))
+	{
+		close(fd);
+		return;
+	}
+	size_t size=st.st_size;
+	const char *map=mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map==MAP_FAILED) return;
+	const struct alias_header_t *header=(const struct alias_header_t *)map;
+	size_t pos=sizeof(*header);
+	for (uint32_t i=0; header->magic==ALIAS_MAGIC && i<header->count; i++)
+	{
+		struct alias_record_t record;
+		if (size-pos<sizeof(record)) break;
+		memcpy(&record, map+pos, sizeof(record));
+		pos+=sizeof(record);
+		if (size-pos<(size_t)record.name_len+record.dir_len) break; // cut short
+		char *name=strndup(map+pos, record.name_len);
+		char *dir=strndup(map+pos+record.name_len, record.dir_len);
+		pos+=record.name_len+record.dir_len;
+		alias_put(name, dir);
+	}
+	munmap((void *)map, size);
+}
+/**
+ * Write the table out in one go, to a temporary file renamed over the old
+ * snapshot so a crash leaves one or the other.
+ * @return 0, -1 with errno set on failure
+ */
+int alias_save()
+{
+	char path[1100], tmp[1110];
+	alias_path(path, sizeof(path));
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+	size_t size=sizeof(struct alias_header_t);
+	for (size_t i=0;i<alias_table_size;++i)
+		if (alias_table[i].name)
+			size+=sizeof(struct alias_record_t)+strlen(alias_table[i].name)+strlen(alias_table[i].dir);
+	char *buf=malloc(size), *p=buf;
+	struct alias_header_t header={ALIAS_MAGIC, alias_table_used};
+	memcpy(p, &header, sizeof(header));
+	p+=sizeof(header);
+	for (size_t i=0;i<alias_table_size;++i)
+	{
+		if (!alias_table[i].name) continue;
+		struct alias_record_t record={strlen(alias_table[i].name), strlen(alias_table[i].dir)};
+		memcpy(p, &record, sizeof(record));
+		p+=sizeof(record);
+		memcpy(p, alias_table[i].name, record.name_len);
+		p+=record.name_len;
+		memcpy(p, alias_table[i].dir, record.dir_len);
+		p+=record.dir_len;
+	}
+	int fd=open(tmp, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+	if (fd==-1)
+	{
+		free(buf);
+		return -1;
+	}
+	int r=write_all(fd, buf, size);
+	free(buf);
+	if (close(fd)==-1) r=-1; // always closed, even after a failed write
+	if (r==-1 || rename(tmp, path)==-1)
+	{
+		int saved=errno; // callers report errno
+		unlink(tmp);
+		errno=saved;
+		return -1;
+	}
+	return 0;
+}
+void alias_free()
+{
+	for (size_t i=0;i<alias_table_size;++i)
+		if (alias_table[i].name)
+		{
+			free(alias_table[i].name);
+			free(alias_table[i].dir);
+		}
+	free(alias_table);
+	alias_table=NULL;
+	alias_table_size=alias_table_used=0;
+}
+//Malloc to keep the scores, user score is index0 and shellington score is index1
+void malloc_rps() {
+	rps_counter = (int*)malloc(sizeof(int)*2); 
+}
+// Free allocated space for custom command
+void free_rps() {
+	free(rps_counter);
+}
+int process_command(struct command_t *command);
+/**
+ * Parse and run one line outside the prompt. Blank lines and # comments,
+ * a #! line among them, are skipped.
+ * @param  buf [description]
+ * @return     EXIT if the line asked the shell to exit
+ */
+int run_line(char *buf)
+{
+	const char *p=buf;
+	while (*p==' ' || *p=='\t') p++;
+	if (*p==0 || *p=='#')
+		return SUCCESS;
+	struct command_t *command=new_command(&line_arena);
+	parse_command(buf, command);
+	int code=process_command(command);
+	free_command(command);
+	return code;
+}
+/**
+ * Run the lines of a -c string.
+ * @param  commands [description]
+ * @return          [description]
+ */
+int run_string(const char *commands)
+{
+	while (*commands)
+	{
+		const char *nl=strchrnul(commands, '\n');
+		char *buf=strndup(commands, nl-commands);
+		int code=run_line(buf);
+		free(buf);
+		if (code==EXIT) return EXIT;
+		commands=*nl?nl+1:nl;
+	}
+	return SUCCESS;
+}
+/**
+ * Run a script or piped input: no prompt or terminal handling, input read
+ * in chunks and each line parsed as it is found.
+ * @return [description]
+ */
+int run_batch()
+{
+	static struct line_t line;
+	while (1)
+	{
+		line.len=line.pos=0;
+		if (read_plain_line(&line)==EDIT_EOF)
+			return SUCCESS;
+		if (run_line(line.buf)==EXIT)
+			return EXIT;
+	}
+}
+#ifndef SHELLINGTON_NO_MAIN
+int main(int argc, char *argv[])
+{
+	const char *commands=NULL, *script=NULL;
+	if (argc>1 && strcmp(argv[1], "-c")==0)
+	{
+		if (argc<3)
+		{
+			fprintf(stderr, "-%s: -c: option requires an argument\n", sysname);
+			return 2;
+		}
+		commands=argv[2];
+	}
+	else if (argc>1)
+		script=argv[1];
+	interactive=!commands && !script && isatty(STDIN_FILENO);
+	if (script && (input_fd=open(script, O_RDONLY|O_CLOEXEC))==-1)
+	{
+		fprintf(stderr, "-%s: %s: %s\n", sysname, script, strerror(errno));
+		return 127;
+	}
+
+	getcwd(init_dir, 1024); // Getting the directory that shell first executed.
+	jobs_init();
+	if (getenv("SHELLINGTON_ZYGOTE"))
+		zygote_start(); // before anything else grows the heap
+	dir_cache_off=getenv("SHELLINGTON_NO_DIR_CACHE")!=NULL;
+	malloc_rps(); // Malloc for rps custom command
+	alias_load(); // Aliases of the short command saved by earlier sessions.
+	if (!interactive)
+	{
+		if (commands)
+			run_string(commands);
+		else
+			run_batch();
+		fflush(stdout);
+		return last_status;
+	}
+	term_init();
+	prompt_init();
+	history_load();
+	reminders_init();
+	while (1)
+	{
+		struct command_t *command=new_command(&line_arena);
+
+		int code;
+		code = prompt(command);
+		if (code==EXIT) break;
+
+		code = process_command(command);
+		if (code==EXIT) break;
+
+		free_command(command);
+	}
+	if (prompt_timing && prompt_renders)
+		fprintf(stderr, "prompt: %llu renders, mean %.1fus, max %.1fus\n",
+			(unsigned long long)prompt_renders, prompt_total_ns/1000.0/prompt_renders, prompt_max_ns/1000.0);
+	term_set_cooked();
+	free_rps(); // Free allocated space for rps custom command
+	alias_free();
+	printf("\n");
+	return last_status;
+}
+#endif
+
+// Scheduling settings given with the run prefix: CPU affinity, nice value,
+// scheduling policy, I/O priority and resource limits. Children apply them
+// to themselves between fork and exec, so no taskset, nice or ionice has to
+// be exec'd in front of the command. A running job's processes can have
+// them applied from the outside instead.
+#define RUN_IOPRIO_CLASS_SHIFT 13
+enum { RUN_IOPRIO_WHO_PROCESS = 1 };
+enum { RUN_IOPRIO_CLASS_RT = 1, RUN_IOPRIO_CLASS_BE = 2, RUN_IOPRIO_CLASS_IDLE = 3 };
+struct run_limit_t {
+	int resource;
+	struct rlimit limit;
+};
+struct run_t {
+	bool affinity;
+	cpu_set_t cpus;
+	bool nice;
+	int nice_value;
+	int policy; // SCHED_* to switch to, -1 to keep the shell's
+	int ioprio; // class and level for ioprio_set, -1 to keep the shell's
+	int limit_count;
+	struct run_limit_t limits[RLIM_NLIMITS];
+};
+struct run_t *run_current; // what run asked for the commands being launched, NULL outside run
+struct {
+	const char *name;
+	int resource;
+} run_limit_names[]={
+	{"as", RLIMIT_AS}, {"core", RLIMIT_CORE}, {"cpu", RLIMIT_CPU}, {"data", RLIMIT_DATA},
+	{"fsize", RLIMIT_FSIZE}, {"locks", RLIMIT_LOCKS}, {"memlock", RLIMIT_MEMLOCK},
+	{"nofile", RLIMIT_NOFILE}, {"nproc", RLIMIT_NPROC}, {"rss", RLIMIT_RSS}, {"stack", RLIMIT_STACK},
+};
+/**
+ * Add the numbers of a list like 0-3,8,10-11 to set, as sysfs writes them.
+ * @param  list [description]
+ * @param  set  [description]
+ * @return      false if the list is malformed
+ */
+bool run_cpu_list(const char *list, cpu_set_t *set)
+{
+	for (const char *p=list;;)
+	{
+		char *end;
+		long lo=strtol(p, &end, 10), hi=lo;
+		if (end==p || lo<0) return false;
+		if (*end=='-')
+		{
+			p=end+1;
+			hi=strtol(p, &end, 10);
+			if (end==p || hi<lo) return false;
+		}
+		if (hi>=CPU_SETSIZE) return false;
+		for (long cpu=lo;cpu<=hi;++cpu)
+			CPU_SET(cpu, set);
+		if (!*end || *end=='\n') return true;
+		if (*end!=',') return false;
+		p=end+1;
+	}
+}
+/**
+ * Add the CPUs of the NUMA nodes in a list to set.
+ * @param  list [description]
+ * @param  set  [description]
+ * @return      false if the list is malformed or names a node that is not there
+ */
+bool run_node_list(const char *list, cpu_set_t *set)
+{
+	cpu_set_t nodes; // node numbers, parsed the same way as CPUs
+	CPU_ZERO(&nodes);
+	if (!run_cpu_list(list, &nodes)) return false;
+	for (int node=0;node<CPU_SETSIZE;++node)
+	{
+		if (!CPU_ISSET(node, &nodes)) continue;
+		char path[64], buf[4096];
+		snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+		int fd=open(path, O_RDONLY|O_CLOEXEC);
+		if (fd==-1) return false;
+		ssize_t n=read(fd, buf, sizeof(buf)-1);
+		close(fd);
+		if (n<0) return false;
+		buf[n]=0;
+		if (buf[0] && buf[0]!='\n' && !run_cpu_list(buf, set)) // memory only nodes have no CPUs
+			return false;
+	}
+	return true;
+}
+/**
+ * Parse a resource limit, name=value where value is a count, a size with
+ * a K, M or G suffix, or unlimited. Soft and hard limit are both set.
+ * @param  run  [description]
+ * @param  spec [description]
+ * @return      false if it is malformed
+ */
+bool run_limit(struct run_t *run, const char *spec)
+{
+	const char *value=strchr(spec, '=');
+	if (!value) return false;
+	int resource=-1;
+	for (size_t i=0;i<sizeof(run_limit_names)/sizeof(run_limit_names[0]);++i)
+		if (strncmp(run_limit_names[i].name, spec, value-spec)==0 && run_limit_names[i].name[value-spec]==0)
+			resource=run_limit_names[i].resource;
+	if (resource==-1) return false;
+	rlim_t limit=RLIM_INFINITY;
+	if (strcmp(++value, "unlimited")!=0)
+	{
+		char *end;
+		unsigned long long n=strtoull(value, &end, 10);
+		if (end==value) return false;
+		const char *units="KMG", *unit=*end?strchr(units, toupper((unsigned char)*end)):NULL;
+		if (*end && (!unit || end[1])) return false;
+		limit=unit?n<<(10*(unit-units+1)):n;
+	}
+	int i=0;
+	while (i<run->limit_count && run->limits[i].resource!=resource) // the last one given wins
+		i++;
+	run->limits[i].resource=resource;
+	run->limits[i].limit.rlim_cur=run->limits[i].limit.rlim_max=limit;
+	if (i==run->limit_count) run->limit_count++;
+	return true;
+}
+/**
+ * Parse an I/O class, idle, be or rt, the last two with an optional :level.
+ * @param  run  [description]
+ * @param  spec [description]
+ * @return      false if it is malformed
+ */
+bool run_ioprio(struct run_t *run, const char *spec)
+{
+	int class, level=4;
+	size_t len=strcspn(spec, ":");
+	if (strncmp(spec, "idle", len)==0 && len==4) class=RUN_IOPRIO_CLASS_IDLE, level=0;
+	else if (strncmp(spec, "be", len)==0 && len==2) class=RUN_IOPRIO_CLASS_BE;
+	else if (strncmp(spec, "rt", len)==0 && len==2) class=RUN_IOPRIO_CLASS_RT;
+	else return false;
+	if (spec[len])
+	{
+		if (class==RUN_IOPRIO_CLASS_IDLE || !isdigit((unsigned char)spec[len+1]) || spec[len+2]) return false;
+		level=spec[len+1]-'0';
+		if (level>7) return false;
+	}
+	run->ioprio=class<<RUN_IOPRIO_CLASS_SHIFT|level;
+	return true;
+}
+/**
+ * Apply settings to a process.
+ * @param  run [description]
+ * @param  pid the process, 0 for the calling one
+ * @return     NULL, or what could not be set with errno telling why
+ */
+const char *run_apply(const struct run_t *run, pid_t pid)
+{
+	if (run->affinity && sched_setaffinity(pid, sizeof(run->cpus), &run->cpus)==-1)
+		return "affinity";
+	struct sched_param param={0};
+	if (run->policy!=-1 && sched_setscheduler(pid, run->policy, &param)==-1)
+		return "policy";
+	if (run->nice && setpriority(PRIO_PROCESS, pid, run->nice_value)==-1)
+		return "nice";
+	if (run->ioprio!=-1 && syscall(SYS_ioprio_set, RUN_IOPRIO_WHO_PROCESS, pid, run->ioprio)==-1)
+		return "ioprio";
+	for (int i=0;i<run->limit_count;++i)
+		if (prlimit(pid, run->limits[i].resource, &run->limits[i].limit, NULL)==-1)
+			return "limit";
+	return NULL;
+}
+// In a child about to exec: apply the settings, or give up on the command.
+void run_child(const struct run_t *run)
+{
+	const char *failed=run?run_apply(run, 0):NULL;
+	if (!failed) return;
+	printf("-%s: run: %s: %s\n", sysname, failed, strerror(errno));
+	fflush(stdout);
+	_exit(126);
+}
+
+// Launching external commands. posix_spawn (which glibc implements with
+// clone(CLONE_VM|CLONE_VFORK)) never copies the shell's page tables, so it is
+// used whenever nothing has to run in the child besides the exec itself. fork
+// is kept as the fallback.
+extern char **environ;
+struct launch_t {
+	const char *path; // resolved executable
+	char **argv; // NULL terminated, argv[0] is the command name
+	int fds[3]; // descriptors to install as stdin/stdout/stderr, -1 to inherit
+	pid_t pgid; // process group to join, 0 for a new one, -1 for the shell's
+	bool foreground; // give the child's group the terminal
+	const struct run_t *run; // settings to apply before the exec, NULL for none
+};
+/**
+ * Start a child through posix_spawn.
+ * @param  launch [description]
+ * @param  pid    [description]
+ * @return        0 or an errno value
+ */
+int launch_spawn(struct launch_t *launch, pid_t *pid)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t empty;
+	int r=posix_spawn_file_actions_init(&actions);
+	if (r) return r;
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 35)
+	// while stdin is still the terminal, before the dup2s below replace it
+	if (launch->pgid!=-1 && launch->foreground && job_control)
+		r=posix_spawn_file_actions_addtcsetpgrp_np(&actions, STDIN_FILENO);
+#endif
+	for (int i=0;i<3 && r==0;++i)
+		if (launch->fds[i]!=-1 && launch->fds[i]!=i)
+			r=posix_spawn_file_actions_adddup2(&actions, launch->fds[i], i);
+
+	// same signal state child_setup gives forked children
+	short flags=POSIX_SPAWN_SETSIGMASK|POSIX_SPAWN_SETSIGDEF;
+	sigemptyset(&empty);
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setsigmask(&attr, &empty);
+	posix_spawnattr_setsigdefault(&attr, &job_signals);
+	if (launch->pgid!=-1)
+	{
+		flags|=POSIX_SPAWN_SETPGROUP;
+		posix_spawnattr_setpgroup(&attr, launch->pgid);
+	}
+	posix_spawnattr_setflags(&attr, flags);
+
+	if (r==0)
+		r=posix_spawn(pid, launch->path, &actions, &attr, launch->argv, environ);
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+	return r;
+}
+/**
+ * Start a child through fork and execv.
+ * @param  launch [description]
+ * @param  pid    [description]
+ * @return        0 or an errno value
+ */
+int launch_fork(struct launch_t *launch, pid_t *pid)
+{
+	fflush(stdout); // don't let the child inherit pending output
+	*pid=fork();
+	if (*pid==-1) return errno;
+	if (*pid==0)
+	{
+		child_setup(launch->pgid, launch->foreground);
+		for (int i=0;i<3;++i)
+			if (launch->fds[i]!=-1 && launch->fds[i]!=i)
+				dup2(launch->fds[i], i);
+		run_child(launch->run);
+		execv(launch->path, launch->argv);
+		printf("-%s: %s: %s\n", sysname, launch->argv[0], strerror(errno));
+		exit(127);
+	}
+	return 0;
+}
+// Zygote: with SHELLINGTON_ZYGOTE set, a helper forked at startup, while the
+// shell is still small, starts external commands on the shell's behalf. A
+// request carries the path, cwd, argv, environment and run settings, and
+// the three descriptors to install go along with SCM_RIGHTS. The helper
+// creates the child with clone(CLONE_PARENT), so it is the shell's child and
+// is reaped and job controlled like any other, and replies with its pid.
+#define ZYGOTE_MAX_REQUEST 65536 // bigger launches go through posix_spawn
+struct zygote_request_t {
+	pid_t pgid; // resolved: 0 for a new group, otherwise the group to join
+	int32_t foreground;
+	int32_t argc, envc;
+	int32_t has_run;
+	struct run_t run; // applied in the child if has_run is set
+	// then path, cwd, argv and the environment as NUL terminated strings
+};
+int zygote_fd=-1;
+pid_t zygote_pid;
+
+/**
+ * The helper's loop: take a request, clone, exec in the child, reply.
+ * Never returns; the helper exits when the shell closes its end.
+ * @param fd [description]
+ */
+void zygote_main(int fd)
+{
+	static char buf[ZYGOTE_MAX_REQUEST];
+	char control[CMSG_SPACE(sizeof(int)*3)];
+	while (1)
+	{
+		struct iovec iov={buf, sizeof(buf)};
+		struct msghdr msg={.msg_iov=&iov, .msg_iovlen=1, .msg_control=control, .msg_controllen=sizeof(control)};
+		ssize_t n=recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+		if (n<=0) _exit(0);
+		struct cmsghdr *cmsg=CMSG_FIRSTHDR(&msg);
+		if (n<(ssize_t)sizeof(struct zygote_request_t) || !cmsg || cmsg->cmsg_type!=SCM_RIGHTS
+			|| cmsg->cmsg_len!=CMSG_LEN(sizeof(int)*3))
+			_exit(1);
+		int fds[3];
+		memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+		struct zygote_request_t *request=(struct zygote_request_t *)buf;
+		pid_t pid=syscall(SYS_clone, CLONE_PARENT|SIGCHLD, 0, 0, 0, 0);
+		if (pid==0)
+		{
+			char *strings=buf+sizeof(*request), *path=strings, *cwd=path+strlen(path)+1;
+			char *argv[request->argc+1], *envp[request->envc+1], *p=cwd+strlen(cwd)+1;
+			for (int i=0;i<request->argc;++i, p+=strlen(p)+1)
+				argv[i]=p;
+			for (int i=0;i<request->envc;++i, p+=strlen(p)+1)
+				envp[i]=p;
+			argv[request->argc]=envp[request->envc]=NULL;
+			child_setup(request->pgid, request->foreground);
+			for (int i=0;i<3;++i)
+				dup2(fds[i], i); // the received copies are close-on-exec
+			run_child(request->has_run?&request->run:NULL);
+			if (chdir(cwd)==-1 || execve(path, argv, envp)==-1)
+				printf("-%s: %s: %s\n", sysname, argv[0], strerror(errno));
+			fflush(stdout);
+			_exit(127);
+		}
+		for (int i=0;i<3;++i)
+			close(fds[i]);
+		int reply=pid==-1?-errno:pid;
+		if (send(fd, &reply, sizeof(reply), MSG_NOSIGNAL)!=sizeof(reply))
+			_exit(1);
+	}
+}
+// Fork the helper. Called once, early, so it carries as little of the shell as possible.
+void zygote_start()
+{
+	int sv[2];
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, sv)==-1) return;
+	pid_t pid=fork();
+	if (pid==0)
+	{
+		close(sv[0]);
+		setpgid(0, 0); // out of the terminal's way, ^C is not meant for it
+		prctl(PR_SET_PDEATHSIG, SIGKILL);
+		zygote_main(sv[1]);
+	}
+	close(sv[1]);
+	if (pid==-1)
+	{
+		close(sv[0]);
+		return;
+	}
+	zygote_fd=sv[0];
+	zygote_pid=pid;
+}
+// Stop using the helper, for when it went away.
+void zygote_stop()
+{
+	close(zygote_fd);
+	zygote_fd=-1;
+	kill(zygote_pid, SIGKILL);
+}
+/**
+ * Start a child through the zygote.
+ * @param  launch [description]
+ * @param  pid    [description]
+ * @return        0 or an errno value, E2BIG if the request is too big for it
+ */
+int launch_zygote(struct launch_t *launch, pid_t *pid)
+{
+	static char buf[ZYGOTE_MAX_REQUEST];
+	struct zygote_request_t *request=(struct zygote_request_t *)buf;
+	request->pgid=launch->pgid==-1?getpgrp():launch->pgid;
+	request->foreground=launch->pgid!=-1 && launch->foreground;
+	request->argc=request->envc=0;
+	request->has_run=launch->run!=NULL;
+	if (launch->run)
+		request->run=*launch->run;
+	size_t len=sizeof(*request);
+	const char *cwd=prompt_cwd?prompt_cwd:".";
+	const char *fixed[2]={launch->path, cwd};
+	for (int part=0;part<3;++part)
+	{
+		const char *const *strings=part==0?fixed:part==1?(const char *const *)launch->argv:(const char *const *)environ;
+		for (int i=0;part==0?i<2:strings[i]!=NULL;++i)
+		{
+			size_t n=strlen(strings[i])+1;
+			if (len+n>sizeof(buf)) return E2BIG;
+			memcpy(buf+len, strings[i], n);
+			len+=n;
+			if (part==1) request->argc++;
+			if (part==2) request->envc++;
+		}
+	}
+
+	int fds[3];
+	for (int i=0;i<3;++i)
+		fds[i]=launch->fds[i]!=-1?launch->fds[i]:i;
+	char control[CMSG_SPACE(sizeof(fds))];
+	memset(control, 0, sizeof(control));
+	struct iovec iov={buf, len};
+	struct msghdr msg={.msg_iov=&iov, .msg_iovlen=1, .msg_control=control, .msg_controllen=sizeof(control)};
+	struct cmsghdr *cmsg=CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level=SOL_SOCKET;
+	cmsg->cmsg_type=SCM_RIGHTS;
+	cmsg->cmsg_len=CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	int reply;
+	if (sendmsg(zygote_fd, &msg, MSG_NOSIGNAL)!=(ssize_t)len
+		|| recv(zygote_fd, &reply, sizeof(reply), 0)!=sizeof(reply))
+	{
+		int r=errno?errno:EPIPE;
+		zygote_stop();
+		return r;
+	}
+	if (reply<0) return -reply;
+	*pid=reply;
+	return 0;
+}
+/**
+ * Start an external command, reporting failures the way the shell does.
+ * @param  launch [description]
+ * @return        pid of the child, -1 on failure
+ */
+pid_t launch_command(struct launch_t *launch)
+{
+	pid_t pid;
+	fflush(stdout); // keep output printed so far ahead of the child's
+	int r=zygote_fd!=-1?launch_zygote(launch, &pid):-1;
+	if (r && launch->run) // posix_spawn has no way to apply them
+		r=launch_fork(launch, &pid);
+	else if (r)
+	{
+		r=launch_spawn(launch, &pid);
+		if (r==ENOSYS || r==EINVAL || r==ENOMEM || r==EAGAIN)
+			r=launch_fork(launch, &pid);
+	}
+	if (r)
+	{
+		printf("-%s: %s: %s\n", sysname, launch->argv[0], strerror(r));
+		return -1;
+	}
+	return pid;
+}
+/**
+ * Run an external program to completion, for builtins that need to shell out.
+ * @param  path [description]
+ * @param  argv [description]
+ * @return      SUCCESS if it exited with status 0
+ */
+int run_program(const char *path, char **argv)
+{
+	int status;
+	struct launch_t launch={.path=path, .argv=argv, .fds={-1, -1, -1}, .pgid=-1};
+	term_set_cooked();
+	pid_t pid=launch_command(&launch);
+	if (pid==-1) return UNKNOWN;
+	waitpid(pid, &status, 0);
+	return (WIFEXITED(status) && WEXITSTATUS(status)==0)?SUCCESS:UNKNOWN;
+}
+
+// Builtins run inside the shell process, args[0] is the first argument after the name.
+int builtin_exit(struct command_t *command)
+{
+	static bool warned=false;
+	jobs_reap();
+	for (int i=0;i<job_count && !warned;++i)
+		if (job_stopped(jobs[i]))
+		{
+			printf("There are stopped jobs.\n");
+			warned=true;
+			return SUCCESS;
+		}
+	// stopped jobs would never see the hangup otherwise
+	for (int i=0;i<job_count;++i)
+		if (job_stopped(jobs[i]))
+		{
+			kill(-jobs[i]->pgid, SIGHUP);
+			kill(-jobs[i]->pgid, SIGCONT);
+		}
+	if (command->arg_count>0)
+		last_status=atoi(command->args[0])&0xff;
+	return EXIT;
+}
+int builtin_cd(struct command_t *command)
+{
+	const char *dir=command->arg_count>0?command->args[0]:getenv("HOME");
+	if (dir==NULL) return SUCCESS;
+	if (shell_chdir(dir)==-1)
+	{
+		printf("-%s: %s: %s\n", sysname, command->name, strerror(errno));
+		return UNKNOWN;
+	}
+	return SUCCESS;
+}
+// jobs builtin: list the job table, -l adds the pid of every process.
+int builtin_jobs(struct command_t *command)
+{
+	bool pids=command->arg_count>0 && strcmp(command->args[0], "-l")==0;
+	jobs_reap();
+	for (int i=0;i<job_count;++i)
+	{
+		struct job_t *job=jobs[i];
+		const char *state=job_completed(job)?"Done":job_stopped(job)?"Stopped":"Running";
+		printf("[%d]%c  ", job->id, job==job_current()?'+':' ');
+		if (pids)
+			for (int j=0;j<job->proc_count;++j)
+				printf("%d ", job->procs[j].pid);
+		printf("%-8s\t%s\n", state, job->cmdline);
+	}
+	return SUCCESS;
+}
+// Find the job a builtin was pointed at, complaining if there is none.
+struct job_t *builtin_job(struct command_t *command, const char *spec)
+{
+	struct job_t *job=job_find(spec);
+	if (job==NULL)
+		printf("-%s: %s: %s: no such job\n", sysname, command->name, spec?spec:"current");
+	return job;
+}
+// Continue the processes of a job that stopped.
+void job_continue(struct job_t *job)
+{
+	for (int i=0;i<job->proc_count;++i)
+		job->procs[i].stopped=false;
+	job->notified=false;
+	kill(-job->pgid, SIGCONT);
+}
+// fg builtin: continue a job in the foreground and wait for it.
+int builtin_fg(struct command_t *command)
+{
+	jobs_reap();
+	struct job_t *job=builtin_job(command, command->arg_count?command->args[0]:NULL);
+	if (!job) return UNKNOWN;
+	printf("%s\n", job->cmdline);
+	term_set_cooked();
+	if (job_control)
+		tcsetpgrp(STDIN_FILENO, job->pgid); // before SIGCONT, so it doesn't stop again on tty access
+	job_continue(job);
+	last_status=job_foreground(job);
+	return last_status==0?SUCCESS:UNKNOWN;
+}
+// bg builtin: continue stopped jobs in the background.
+int builtin_bg(struct command_t *command)
+{
+	jobs_reap();
+	int r=SUCCESS;
+	for (int i=0;i<(command->arg_count?command->arg_count:1);++i)
+	{
+		struct job_t *job=builtin_job(command, command->arg_count?command->args[i]:NULL);
+		if (!job)
+		{
+			r=UNKNOWN;
+			continue;
+		}
+		job->background=true;
+		job_continue(job);
+		printf("[%d]+ %s &\n", job->id, job->cmdline);
+	}
+	return r;
+}
+// wait builtin: wait for the given jobs or pids, or for every background job.
+int builtin_wait(struct command_t *command)
+{
+	jobs_reap();
+	if (command->arg_count==0)
+	{
+		for (int i=0;i<job_count;++i)
+			if (jobs[i]->background)
+				job_wait(jobs[i]);
+		return SUCCESS;
+	}
+	int r=SUCCESS;
+	for (int i=0;i<command->arg_count;++i)
+	{
+		struct job_t *job=builtin_job(command, command->args[i]);
+		if (!job)
+		{
+			r=UNKNOWN;
+			continue;
+		}
+		job_wait(job);
+		last_status=job_status(job);
+	}
+	return r;
+}
+int stats_cmp_ns(const void *a, const void *b)
+{
+	uint64_t x=*(const uint64_t *)a, y=*(const uint64_t *)b;
+	return x<y?-1:x>y;
+}
+/**
+ * The wall time below which the q-th fraction of a command's runs fall,
+ * interpolated between the two nearest of its samples.
+ * @param  entry [description]
+ * @param  q     0 to 1
+ * @return       ns
+ */
+uint64_t stats_percentile(struct command_stats_t *entry, double q)
+{
+	size_t n=entry->count<STATS_SAMPLES?entry->count:STATS_SAMPLES;
+	if (!n)
+		return 0;
+	uint64_t sorted[n];
+	memcpy(sorted, entry->samples, sizeof(sorted));
+	qsort(sorted, n, sizeof(sorted[0]), stats_cmp_ns);
+	double rank=q*(n-1);
+	size_t i=rank;
+	if (i+1>=n)
+		return sorted[n-1];
+	return sorted[i]+(rank-i)*(double)(sorted[i+1]-sorted[i]);
+}
+// A percentile for stats' tables, marked "~" once it comes from a sample of the runs.
+const char *format_percentile(char *buf, size_t size, struct command_stats_t *entry, double q)
+{
+	bool sampled=entry->count>STATS_SAMPLES;
+	if (sampled) buf[0]='~';
+	format_ns(buf+sampled, size-sampled, stats_percentile(entry, q));
+	return buf;
+}
+int stats_cmp_wall(const void *a, const void *b)
+{
+	uint64_t x=(*(struct command_stats_t **)a)->total.wall_ns, y=(*(struct command_stats_t **)b)->total.wall_ns;
+	return x<y?1:x>y?-1:0;
+}
+/**
+ * stats: the commands run this session, slowest in total first, with their
+ * mean and p50/p99 wall time, CPU time and peak RSS. Percentiles of commands
+ * run more than STATS_SAMPLES times are estimated from a sample, shown as
+ * "~12.3ms" and as "sampled" in JSON. "stats <command>" draws its latency
+ * histogram, -j prints every command as a JSON line, -c clears.
+ * @param  command [description]
+ * @return         [description]
+ */
+int builtin_stats(struct command_t *command)
+{
+	const char *arg=command->arg_count>0?command->args[0]:NULL;
+	char a[32], b[32], c[32], d[32], e[32];
+	if (arg && strcmp(arg, "-c")==0)
+	{
+		for (size_t i=0;i<stats_count;++i)
+		{
+			free(stats[i].name);
+			free(stats[i].samples);
+		}
+		stats_count=0;
+		if (stats_slots)
+			memset(stats_slots, 0, sizeof(size_t)*stats_slots_size);
+		return SUCCESS;
+	}
+	if (arg && strcmp(arg, "-j")==0)
+	{
+		for (size_t i=0;i<stats_count;++i)
+		{
+			struct command_stats_t *entry=&stats[i];
+			char name[512];
+			name[json_string(name, sizeof(name), entry->name)]=0;
+			printf("{\"command\":%s,\"count\":%llu,\"wall_us\":%llu,\"p50_us\":%llu,\"p99_us\":%llu,\"sampled\":%s,"
+				"\"user_us\":%llu,\"sys_us\":%llu,\"maxrss_kb\":%ld,\"nvcsw\":%ld,\"nivcsw\":%ld,\"histogram_us\":{",
+				name, (unsigned long long)entry->count, (unsigned long long)entry->total.wall_ns/1000,
+				(unsigned long long)stats_percentile(entry, 0.5)/1000, (unsigned long long)stats_percentile(entry, 0.99)/1000,
+				entry->count>STATS_SAMPLES?"true":"false",
+				(unsigned long long)entry->total.user_ns/1000, (unsigned long long)entry->total.sys_ns/1000,
+				entry->total.maxrss_kb, entry->total.nvcsw, entry->total.nivcsw);
+			// buckets by their upper bound in us
+			bool first=true;
+			for (int b=0;b<STATS_BUCKETS;++b)
+				if (entry->buckets[b])
+				{
+					printf("%s\"%llu\":%u", first?"":",", 1ull<<b, entry->buckets[b]);
+					first=false;
+				}
+			printf("}}\n");
+		}
+		return SUCCESS;
+	}
+	if (arg)
+	{
+		struct command_stats_t *entry=stats_find(arg);
+		if (!entry)
+		{
+			printf("-%s: %s: %s: not run this session\n", sysname, command->name, arg);
+			return UNKNOWN;
+		}
+		int lo=STATS_BUCKETS, hi=0;
+		uint32_t most=1;
+		for (int b=0;b<STATS_BUCKETS;++b)
+			if (entry->buckets[b])
+			{
+				if (b<lo) lo=b;
+				hi=b;
+				if (entry->buckets[b]>most) most=entry->buckets[b];
+			}
+		printf("%s: %llu runs, mean %s, p50 %s, p99 %s\n", entry->name, (unsigned long long)entry->count,
+			format_ns(a, sizeof(a), entry->total.wall_ns/entry->count),
+			format_percentile(b, sizeof(b), entry, 0.5), format_percentile(c, sizeof(c), entry, 0.99));
+		for (int b=lo;b<=hi;++b)
+		{
+			int width=(entry->buckets[b]*40+most-1)/most;
+			printf("%8s - %-8s %8u %.*s\n", b?format_ns(d, sizeof(d), (1ull<<(b-1))*1000):"0",
+				format_ns(e, sizeof(e), (1ull<<b)*1000), entry->buckets[b], width,
+				"########################################");
+		}
+		return SUCCESS;
+	}
+
+	struct command_stats_t *sorted[stats_count+1];
+	for (size_t i=0;i<stats_count;++i)
+		sorted[i]=&stats[i];
+	qsort(sorted, stats_count, sizeof(sorted[0]), stats_cmp_wall);
+	printf("%-20s %7s %9s %9s %9s %9s %9s %9s\n", "command", "runs", "mean", "p50", "p99", "user", "sys", "maxrss");
+	for (size_t i=0;i<stats_count;++i)
+	{
+		struct command_stats_t *entry=sorted[i];
+		printf("%-20.20s %7llu %9s %9s %9s %9s %9s %8ldk\n", entry->name, (unsigned long long)entry->count,
+			format_ns(a, sizeof(a), entry->total.wall_ns/entry->count),
+			format_percentile(b, sizeof(b), entry, 0.5), format_percentile(c, sizeof(c), entry, 0.99),
+			format_ns(d, sizeof(d), entry->total.user_ns), format_ns(e, sizeof(e), entry->total.sys_ns),
+			entry->total.maxrss_kb);
+	}
+	return SUCCESS;
+}
+// Alias a working directory with "short set <name>", go back to it with "short jump <name>".
+int builtin_short(struct command_t *command)
+{
+	// Return if there is not enough args.
+	if(command->arg_count < 2) {
+		printf("Not enough arguments.\n");
+		return UNKNOWN;
+	}
+	if(strcmp(command->args[0], "set") == 0) { // Check if first args is: set
+		char cwd[1024];	
+		getcwd(cwd, sizeof(cwd));	// Getting the current working directory.
+
+		// If the alias is already saved, update the directory and keep the alias.
+		if (alias_put(strdup(command->args[1]), strdup(cwd)))
+			printf("An alias named %s already has been found, overriding the path.\n", command->args[1]);
+		else
+			printf("New alias %s is saved. Curent alias number: %zu\n", command->args[1], alias_table_used);
+		if (alias_save()==-1)
+		{
+			printf("-%s: %s: %s\n", sysname, command->name, strerror(errno));
+			return UNKNOWN;
+		}
+	}
+	if(strcmp(command->args[0], "jump") == 0) { // Check if first arg is: jump
+		struct alias_t *found=alias_find(command->args[1]);
+		if (found) {	// If alias is saved, jump to the saved directory.
+			if (shell_chdir(found->dir)==-1) {
+				printf("-%s: %s: %s: %s\n", sysname, command->name, found->dir, strerror(errno));
+				return UNKNOWN;
+			}
+			printf("Alias %s found, changing dir.\n", found->name);
+			return SUCCESS;
+		}
+		printf("There is no such alias as %s, try again.\n", command->args[1]); 	//If there is no alias saved, print error.
+		return UNKNOWN;
+	}
+	return SUCCESS;
+}
+//Custom command rps. (Short for Rock, Paper, Scissors)
+int builtin_rps(struct command_t *command)
+{
+	if(command->arg_count == 0) {
+		printf("Not enough arguments given, try again.\n"); // Return if args are not enough
+		return UNKNOWN;
+	}
+	size_t i;
+	srand(time(NULL)); 
+	int random_var = rand() % 3;  // Random number generator for shellington to determine the move.
+	const char *moves[3] = {"rock", "paper", "scissors"};	// Array containing move names.
+	const char *linux_move = moves[random_var]; 	// Picking the move for shellington via random generated number.
+	char *user_move = strdup(command->args[0]);		// Getting the user input.
+	for(i = 0; i < strlen(user_move); i++) {
+		user_move[i] = tolower(user_move[i]);		// lowercase convertion to compare moves.
+	}
+	printf("Rock!\n");								
+	sleep(1);
+	printf("Paper!\n");
+	sleep(1);
+	printf("Scissors!\n");
+	sleep(1);
+	printf("You said: %s!\nShellington said %s!\n", user_move, linux_move);
+
+	//Checking which move wins over the other, printing the result and storing the data.
+	if(strcmp(user_move, moves[0]) == 0) {	
+		if(random_var == 0) printf(COLOR_YELLOW "That's a tie!\n" COLOR_RESET);
+		if(random_var == 1) {
+			printf(COLOR_RED "Paper beats rock! You lost.\n" COLOR_RESET);
+			(*(rps_counter+1))++;	//Incrementing the 1st index of the pointer if user loses.
+			}
+		if(random_var == 2) {
+			printf(COLOR_GREEN "Rock beats Scissors! You won.\n" COLOR_RESET);
+			(*rps_counter)++;	// Incrementing the 0th index of the pointer if user wins.
+		}
+	}
+	else if(strcmp(user_move, moves[1]) == 0) {
+		if(random_var == 1) printf(COLOR_YELLOW "That's a tie!\n" COLOR_RESET);
+		if(random_var == 0) {
+			printf(COLOR_GREEN "Paper beats rock! You won.\n" COLOR_RESET);
+			(*rps_counter)++;
+			}
+		if(random_var == 2) {
+			printf(COLOR_RED "Scissors beats paper! You lost.\n" COLOR_RESET);
+			(*(rps_counter+1))++;
+			}
+		}
+	else if(strcmp(user_move, moves[2]) == 0) {
+		if(random_var == 2) printf(COLOR_YELLOW "That's a tie!\n" COLOR_RESET);
+		if(random_var == 0) {
+			printf(COLOR_RED "Rock beats Scissors! You lost.\n" COLOR_RESET);
+			(*(rps_counter+1))++;
+			}
+		if(random_var == 1) {
+			printf(COLOR_GREEN "Scissors beats paper! You won.\n" COLOR_RESET);
+			(*rps_counter)++;
+			}
+		}
+	else {
+		printf("That move does not exist! Try again.\n");
+		free(user_move);
+		return UNKNOWN;		
+	}
+	free(user_move);
+	printf("SCOREBOARD: You %d, Shellinton %d\n", *rps_counter, *(rps_counter+1));	
+	return SUCCESS;
+}
+// Reminder scheduler. Reminders wait in a min-heap ordered by their next
+// deadline, and one timerfd is armed for the earliest; the shell watches it
+// wherever it waits, so reminders fire while a prompt or a job is waiting.
+// reminders.log in init_dir keeps them across sessions as an append-only
+// log of "+ id first period message" and "- id" lines, so adding one is a
+// heap push and one write. The log is rewritten once removals make up most
+// of it. Several shells can share the log: each picks up lines the others
+// appended, and only the one holding reminders.lock fires reminders.
+#define REMINDER_DAY (24*60*60)
+struct reminder_t {
+	unsigned id;
+	time_t first; // first deadline
+	unsigned period; // seconds between deadlines, 0 fires once
+	time_t next;
+	char *message;
+	size_t heap_pos;
+	struct reminder_t *id_next; // in the same index bucket
+};
+struct reminders_t {
+	struct reminder_t **heap;
+	size_t count, size;
+	struct reminder_t **index; // by id, chained, size buckets
+	unsigned next_id;
+	size_t removed; // "-" lines in the log
+	char path[1100];
+	int fd; // the log, O_APPEND
+	off_t read_to; // how much of the log has been applied
+	dev_t dev;
+	ino_t ino;
+	int lock_fd; // held by the shell that fires reminders
+	bool loaded;
+} reminders={.fd=-1, .lock_fd=-1};
+
+void reminder_swap(size_t a, size_t b)
+{
+	struct reminder_t *t=reminders.heap[a];
+	reminders.heap[a]=reminders.heap[b];
+	reminders.heap[b]=t;
+	reminders.heap[a]->heap_pos=a;
+	reminders.heap[b]->heap_pos=b;
+}
+// Restore heap order around position i after its deadline changed.
+void reminder_fix(size_t i)
+{
+	while (i>0 && reminders.heap[i]->next<reminders.heap[(i-1)/2]->next)
+	{
+		reminder_swap(i, (i-1)/2);
+		i=(i-1)/2;
+	}
+	while (1)
+	{
+		size_t l=2*i+1, r=l+1, min=i;
+		if (l<reminders.count && reminders.heap[l]->next<reminders.heap[min]->next) min=l;
+		if (r<reminders.count && reminders.heap[r]->next<reminders.heap[min]->next) min=r;
+		if (min==i) break;
+		reminder_swap(i, min);
+		i=min;
+	}
+}
+// Ids are handed out in order, so the low bits spread them over the buckets.
+struct reminder_t **reminder_bucket(unsigned id)
+{
+	return &reminders.index[id&(reminders.size-1)];
+}
+void reminder_push(struct reminder_t *reminder)
+{
+	if (reminders.count==reminders.size)
+	{
+		reminders.size=reminders.size?reminders.size*2:64;
+		reminders.heap=realloc(reminders.heap, sizeof(struct reminder_t *)*reminders.size);
+		free(reminders.index);
+		reminders.index=calloc(reminders.size, sizeof(struct reminder_t *));
+		for (size_t i=0;i<reminders.count;++i)
+		{
+			struct reminder_t **bucket=reminder_bucket(reminders.heap[i]->id);
+			reminders.heap[i]->id_next=*bucket;
+			*bucket=reminders.heap[i];
+		}
+	}
+	struct reminder_t **bucket=reminder_bucket(reminder->id);
+	reminder->id_next=*bucket;
+	*bucket=reminder;
+	reminder->heap_pos=reminders.count;
+	reminders.heap[reminders.count++]=reminder;
+	reminder_fix(reminder->heap_pos);
+}
+// Take a reminder out of the heap, the caller frees it.
+void reminder_unlink(struct reminder_t *reminder)
+{
+	struct reminder_t **link=reminder_bucket(reminder->id);
+	while (*link!=reminder)
+		link=&(*link)->id_next;
+	*link=reminder->id_next;
+	size_t i=reminder->heap_pos;
+	reminder_swap(i, --reminders.count);
+	if (i<reminders.count)
+		reminder_fix(i);
+}
+void reminder_free(struct reminder_t *reminder)
+{
+	free(reminder->message);
+	free(reminder);
+}
+struct reminder_t *reminder_find(unsigned id)
+{
+	if (!reminders.size)
+		return NULL;
+	struct reminder_t *reminder=*reminder_bucket(id);
+	while (reminder && reminder->id!=id)
+		reminder=reminder->id_next;
+	return reminder;
+}
+// The first deadline of a repeating reminder that is not in the past.
+time_t reminder_next(struct reminder_t *reminder, time_t now)
+{
+	if (reminder->first>now || reminder->period==0)
+		return reminder->first;
+	return reminder->first+((now-reminder->first)/reminder->period+1)*(time_t)reminder->period;
+}
+// Arm the timer for the earliest deadline, or disarm it.
+void reminders_arm()
+{
+	if (reminder_fd==-1) return;
+	struct itimerspec its={{0, 0}, {0, 0}};
+	if (reminders.count)
+		its.it_value.tv_sec=reminders.heap[0]->next>0?reminders.heap[0]->next:1;
+	timerfd_settime(reminder_fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+/**
+ * Apply one log line.
+ * @param line [description]
+ * @param len  [description]
+ */
+void reminders_apply(const char *line, size_t len)
+{
+	char *buf=strndup(line, len), *end;
+	if (buf[0]=='+')
+	{
+		unsigned id=strtoul(buf+1, &end, 10);
+		time_t first=strtoll(end, &end, 10);
+		unsigned period=strtoul(end, &end, 10);
+		if (*end==' ' && !reminder_find(id))
+		{
+			struct reminder_t *reminder=calloc(1, sizeof(struct reminder_t));
+			reminder->id=id;
+			reminder->first=first;
+			reminder->period=period;
+			reminder->next=reminder_next(reminder, time(NULL));
+			reminder->message=strdup(end+1);
+			reminder_push(reminder);
+		}
+		if (id>=reminders.next_id) reminders.next_id=id+1;
+	}
+	else if (buf[0]=='-')
+	{
+		struct reminder_t *reminder=reminder_find(strtoul(buf+1, NULL, 10));
+		if (reminder)
+		{
+			reminder_unlink(reminder);
+			reminder_free(reminder);
+		}
+		reminders.removed++;
+	}
+	free(buf);
+}
+/**
+ * Open the log, or reopen it after another shell rewrote it, and apply
+ * whatever was appended since it was last read. Also tries to become the
+ * shell that fires reminders.
+ */
+void reminders_sync()
+{
+	struct stat st;
+	if (!reminders.loaded)
+	{
+		snprintf(reminders.path, sizeof(reminders.path), "%s/reminders.log", init_dir);
+		reminders.loaded=true;
+	}
+	if (reminders.fd!=-1 && stat(reminders.path, &st)==0 && (st.st_ino!=reminders.ino || st.st_dev!=reminders.dev))
+	{
+		// rewritten by another shell, start from scratch
+		close(reminders.fd);
+		reminders.fd=-1;
+		while (reminders.count)
+		{
+			struct reminder_t *reminder=reminders.heap[0];
+			reminder_unlink(reminder);
+			reminder_free(reminder);
+		}
+		reminders.read_to=0;
+		reminders.removed=0;
+	}
+	if (reminders.fd==-1)
+	{
+		reminders.fd=open(reminders.path, O_RDWR|O_CREAT|O_APPEND|O_CLOEXEC, 0644);
+		if (reminders.fd==-1 || fstat(reminders.fd, &st)==-1)
+			return;
+		reminders.dev=st.st_dev;
+		reminders.ino=st.st_ino;
+	}
+	if (fstat(reminders.fd, &st)==0 && st.st_size>reminders.read_to)
+	{
+		size_t size=st.st_size-reminders.read_to;
+		char *buf=malloc(size);
+		ssize_t n=pread(reminders.fd, buf, size, reminders.read_to);
+		const char *p=buf, *end=buf+(n>0?n:0), *nl;
+		while ((nl=memchr(p, '\n', end-p)))
+		{
+			reminders_apply(p, nl-p);
+			p=nl+1;
+		}
+		reminders.read_to+=p-buf; // a line being written is read next time
+		free(buf);
+	}
+	if (reminder_fd!=-1 && reminders.lock_fd==-1)
+	{
+		char lock[1110];
+		snprintf(lock, sizeof(lock), "%s/reminders.lock", init_dir);
+		int fd=open(lock, O_RDWR|O_CREAT|O_CLOEXEC, 0644);
+		if (fd!=-1 && flock(fd, LOCK_EX|LOCK_NB)==0)
+			reminders.lock_fd=fd;
+		else if (fd!=-1)
+			close(fd);
+	}
+	if (reminders.lock_fd!=-1)
+		reminders_arm();
+}
+/**
+ * Append a line to the log, and apply it.
+ * @return -1 with errno set on failure
+ */
+/**
+ * Lock the log against other shells and apply what they appended, so ids
+ * handed out before reminders_append are not taken. A compaction can replace
+ * the log while this waits, then the lock is on a file nobody reads anymore
+ * and has to be taken again on the new one.
+ * @return 0, -1 if the log cannot be opened
+ */
+int reminders_lock()
+{
+	while (1)
+	{
+		reminders_sync();
+		if (reminders.fd==-1)
+			return -1;
+		flock(reminders.fd, LOCK_EX);
+		struct stat st;
+		if (stat(reminders.path, &st)==0 && st.st_ino==reminders.ino && st.st_dev==reminders.dev)
+			break;
+		flock(reminders.fd, LOCK_UN);
+	}
+	reminders_sync();
+	return 0;
+}
+// Append lines to the log locked by reminders_lock and unlock it.
+int reminders_append(const char *lines)
+{
+	int r=write_all(reminders.fd, lines, strlen(lines));
+	flock(reminders.fd, LOCK_UN);
+	if (r==0)
+		reminders_sync();
+	return r;
+}
+int reminders_log(const char *line)
+{
+	return reminders_lock()==-1?-1:reminders_append(line);
+}
+/**
+ * Rewrite the log with only the reminders still pending, once removals
+ * make up most of it.
+ */
+void reminders_compact()
+{
+	if (reminders.removed<64 || reminders.removed<reminders.count)
+		return;
+	// Locked before the tmp file is touched, as another shell may be compacting
+	// too, and so nothing appended in between is lost. If that shell got there
+	// first the log is short again.
+	if (reminders_lock()==-1)
+		return;
+	if (reminders.removed<64 || reminders.removed<reminders.count)
+	{
+		flock(reminders.fd, LOCK_UN);
+		return;
+	}
+	char tmp[1110];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", reminders.path);
+	FILE *out=fopen(tmp, "w");
+	if (!out)
+	{
+		flock(reminders.fd, LOCK_UN);
+		return;
+	}
+	for (size_t i=0;i<reminders.count;++i)
+	{
+		struct reminder_t *reminder=reminders.heap[i];
+		fprintf(out, "+ %u %lld %u %s\n", reminder->id, (long long)reminder->first, reminder->period, reminder->message);
+	}
+	bool done=fclose(out)==0 && rename(tmp, reminders.path)==0;
+	flock(reminders.fd, LOCK_UN);
+	if (done)
+		reminders_sync(); // sees the new inode and reads it from the start
+	else
+		unlink(tmp);
+}
+// Start the notifier for a reminder and leave it running, jobs_reap reaps it.
+void reminder_notify(struct reminder_t *reminder)
+{
+	const char *notifier=getenv("SHELLINGTON_NOTIFIER");
+	if (!notifier || !*notifier) notifier="notify-send";
+	const char *path=resolve_command(notifier);
+	if (!path)
+	{
+		fprintf(stderr, "\r\n[reminder] %s\r\n", reminder->message);
+		return;
+	}
+	char *argv[]={(char *)notifier, reminder->message, NULL};
+	int devnull=open("/dev/null", O_RDONLY|O_CLOEXEC);
+	struct launch_t launch={.path=path, .argv=argv, .fds={devnull, -1, -1}, .pgid=0};
+	launch_command(&launch);
+	if (devnull!=-1) close(devnull);
+}
+// The timer went off: notify every reminder that is due and arm it again.
+void reminders_fire()
+{
+	uint64_t expirations;
+	if (read(reminder_fd, &expirations, sizeof(expirations))==-1 && errno==EAGAIN)
+		return;
+	reminders_sync();
+	// the timer runs on CLOCK_REALTIME, time() reads a coarser clock that can
+	// still be in the second before the deadline
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	time_t now=ts.tv_sec;
+	char line[32];
+	while (reminders.count && reminders.heap[0]->next<=now)
+	{
+		struct reminder_t *reminder=reminders.heap[0];
+		reminder_notify(reminder);
+		if (reminder->period)
+		{
+			reminder->next=reminder_next(reminder, now);
+			reminder_fix(0);
+			continue;
+		}
+		unsigned id=reminder->id;
+		snprintf(line, sizeof(line), "- %u\n", id);
+		if (reminders_log(line)==-1 || (reminder=reminder_find(id)))
+		{
+			// could not be logged, at least not again in this session
+			reminder_unlink(reminder);
+			reminder_free(reminder);
+		}
+	}
+	reminders_compact();
+	reminders_arm();
+}
+// Set up the timer and load the reminders of earlier sessions.
+void reminders_init()
+{
+	reminder_fd=timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK|TFD_CLOEXEC);
+	reminders_sync();
+}
+/**
+ * Parse a duration such as 90, 90s, 15m, 2h or 1d.
+ * @param  text [description]
+ * @return      seconds, 0 if it is not a duration
+ */
+unsigned parse_duration(const char *text)
+{
+	char *end;
+	unsigned long n=strtoul(text, &end, 10);
+	if (end==text) return 0;
+	unsigned long unit=1;
+	if (*end=='m') unit=60;
+	else if (*end=='h') unit=60*60;
+	else if (*end=='d') unit=REMINDER_DAY;
+	else if (*end!='s' && *end!=0) return 0;
+	if (*end && end[1]) return 0;
+	return n*unit;
+}
+/**
+ * Next time the clock shows HH:MM.
+ * @param  text [description]
+ * @return      -1 if it is not a time
+ */
+time_t parse_clock(const char *text)
+{
+	int hours, minutes;
+	char extra;
+	if (sscanf(text, "%d:%d%c", &hours, &minutes, &extra)!=2 || hours<0 || hours>23 || minutes<0 || minutes>59)
+		return -1;
+	time_t now=time(NULL);
+	struct tm tm;
+	localtime_r(&now, &tm);
+	tm.tm_hour=hours;
+	tm.tm_min=minutes;
+	tm.tm_sec=0;
+	time_t when=mktime(&tm);
+	if (when<=now)
+	{
+		tm.tm_mday++;
+		when=mktime(&tm);
+	}
+	return when;
+}
+/**
+ * remindme HH:MM message       every day at HH:MM
+ * remindme once HH:MM message  at the next HH:MM
+ * remindme in 10m message      once, after a delay
+ * remindme every 2h message    repeatedly, starting after one period
+ * remindme list
+ * remindme remove ID|all
+ * Notifications go through $SHELLINGTON_NOTIFIER, notify-send by default,
+ * which gets the message as its argument.
+ * @param  command [description]
+ * @return         [description]
+ */
+int builtin_remindme(struct command_t *command)
+{
+	reminders_sync();
+	if (command->arg_count == 1 && strcmp(command->args[0], "list") == 0) {
+		char when[64];
+		for (size_t i = 0; i < reminders.count; i++) {
+			struct reminder_t *reminder = reminders.heap[i];
+			struct tm tm;
+			localtime_r(&reminder->next, &tm);
+			strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+			if (reminder->period)
+				printf("%u\t%s  every %us\t%s\n", reminder->id, when, reminder->period, reminder->message);
+			else
+				printf("%u\t%s  once\t\t%s\n", reminder->id, when, reminder->message);
+		}
+		return SUCCESS;
+	}
+	if (command->arg_count < 2) { // Return if the args are insufficient.
+		printf("Not enough arguments.\n");
+		return UNKNOWN;
+	}
+
+	// Removing only the reminders shellington made, one or all of them.
+	if(strcmp(command->args[0], "remove") == 0) {	
+		bool all = strcmp(command->args[1], "all") == 0;
+		struct reminder_t *reminder = all ? NULL : reminder_find(strtoul(command->args[1], NULL, 10));
+		if (!all && !reminder) {
+			printf("There is no reminder %s.\n", command->args[1]);
+			return UNKNOWN;
+		}
+		if (!reminders.count)
+			return SUCCESS;
+		// all the removals in one write
+		char *lines = malloc((all ? reminders.count : 1) * 16 + 1), *p = lines;
+		*p = 0;
+		if (reminder)
+			sprintf(p, "- %u\n", reminder->id);
+		else
+			for (size_t i = 0; i < reminders.count; i++)
+				p += sprintf(p, "- %u\n", reminders.heap[i]->id);
+		int r = reminders_log(lines);
+		free(lines);
+		if (r == -1) {
+			printf("-%s: %s: %s\n", sysname, command->name, strerror(errno));
+			return UNKNOWN;
+		}
+		reminders_compact();
+		return SUCCESS;
+	}
+
+	// Working out when it fires first and how often.
+	int skip = 1;
+	time_t first = -1;
+	unsigned period = 0;
+	const char *kind = command->args[0];
+	if (strcmp(kind, "once") == 0 || strcmp(kind, "in") == 0 || strcmp(kind, "every") == 0) {
+		if (command->arg_count < 3) {
+			printf("Not enough arguments.\n");
+			return UNKNOWN;
+		}
+		skip = 2;
+		if (kind[0] == 'o')
+			first = parse_clock(command->args[1]);
+		else if ((period = parse_duration(command->args[1])) > 0)
+			first = time(NULL) + period;
+		if (kind[0] == 'i')
+			period = 0;
+	}
+	else if ((first = parse_clock(kind)) != -1)
+		period = REMINDER_DAY;
+
+	// Print error if the time format was wrong.
+	if (first == -1) {
+		printf("Invalid format, please use format such as 14:30, once 14:30, in 10m or every 2h.\n");
+		return UNKNOWN;
+	}
+
+	size_t size = 64;
+	for (int i = skip; i < command->arg_count; i++)
+		size += strlen(command->args[i]) + 1;
+	char *line = malloc(size), *p = line + 16; // the id goes in front once the log is locked
+	p += sprintf(p, " %lld %u", (long long)first, period);
+	for (int i = skip; i < command->arg_count; i++) {
+		*p++ = ' ';
+		for (const char *c = command->args[i]; *c; c++)
+			*p++ = *c == '\n' ? ' ' : *c;
+	}
+	*p++ = '\n';
+	*p = 0;
+	int r = reminders_lock();
+	if (r == 0) {
+		char id[16];
+		int n = snprintf(id, sizeof(id), "+ %u", reminders.next_id);
+		char *start = line + 16 - n;
+		memcpy(start, id, n);
+		r = reminders_append(start);
+	}
+	free(line);
+	if (r == -1) {
+		printf("-%s: %s: %s\n", sysname, command->name, strerror(errno));
+		return UNKNOWN;
+	}
+	return SUCCESS;
+}
+// Bookmark store. bookmarks.db in init_dir is a header followed by records,
+// each a length, a flags word and the bookmarked line. New bookmarks are
+// appended and deletes only set the record's tombstone flag, so neither
+// rewrites the file. The live records are indexed by an array of offsets,
+// making bookmark N one lookup. Every change bumps a counter in the header,
+// which is how a shell notices that another instance changed the file and
+// reads it again; otherwise the file is read once per session. Each live
+// bookmark run with -i keeps its parsed command, in an arena of its own, for
+// the next time it is run. Once most records are tombstones a child rewrites
+// the live ones to a new file and renames it over the old one.
+#define BOOKMARK_MAGIC 0x4b4d4253 // "SBMK"
+#define BOOKMARK_VERSION 1
+#define BOOKMARK_DELETED 1
+struct bookmark_header_t {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t generation; // bumped when the file is rewritten
+	uint64_t changes; // bumped by every append and delete
+};
+struct bookmark_record_t {
+	uint32_t len;
+	uint32_t flags;
+};
+struct bookmark_store_t {
+	char path[1100];
+	int fd;
+	dev_t dev;
+	ino_t ino;
+	struct bookmark_header_t header; // as of the last read
+	char *data; // the whole file
+	size_t size, data_size;
+	uint64_t *index; // offset of each live record
+	struct command_t **templates; // parsed bookmark i, NULL until it is run
+	size_t count, index_size;
+	size_t dead;
+	pid_t compactor;
+} bookmarks={.fd=-1};
+
+// The line of live bookmark i.
+const char *bookmark_text(size_t i, size_t *len)
+{
+	struct bookmark_record_t record;
+	memcpy(&record, bookmarks.data+bookmarks.index[i], sizeof(record));
+	*len=record.len;
+	return bookmarks.data+bookmarks.index[i]+sizeof(record);
+}
+void bookmark_index_add(uint64_t offset)
+{
+	if (bookmarks.count==bookmarks.index_size)
+	{
+		bookmarks.index_size=bookmarks.index_size?bookmarks.index_size*2:256;
+		bookmarks.index=realloc(bookmarks.index, sizeof(uint64_t)*bookmarks.index_size);
+		bookmarks.templates=realloc(bookmarks.templates, sizeof(struct command_t *)*bookmarks.index_size);
+	}
+	bookmarks.templates[bookmarks.count]=NULL;
+	bookmarks.index[bookmarks.count++]=offset;
+}
+void template_free(struct command_t *template)
+{
+	if (!template) return;
+	struct arena_t *arena=template->arena;
+	arena_free(arena);
+	free(arena);
+}
+/**
+ * Read the whole file and index its live records.
+ * @return -1 if it could not be read
+ */
+int bookmark_read()
+{
+	struct stat st;
+	if (fstat(bookmarks.fd, &st)==-1)
+		return -1;
+	bookmarks.size=st.st_size;
+	if (bookmarks.size>bookmarks.data_size)
+	{
+		bookmarks.data_size=bookmarks.size;
+		bookmarks.data=realloc(bookmarks.data, bookmarks.data_size);
+	}
+	for (size_t done=0; done<bookmarks.size;)
+	{
+		ssize_t n=pread(bookmarks.fd, bookmarks.data+done, bookmarks.size-done, done);
+		if (n<=0)
+		{
+			bookmarks.size=done;
+			break;
+		}
+		done+=n;
+	}
+	for (size_t i=0; i<bookmarks.count; i++)
+		template_free(bookmarks.templates[i]);
+	bookmarks.count=bookmarks.dead=0;
+	memset(&bookmarks.header, 0, sizeof(bookmarks.header));
+	if (bookmarks.size<sizeof(struct bookmark_header_t))
+		return 0;
+	memcpy(&bookmarks.header, bookmarks.data, sizeof(bookmarks.header));
+	if (bookmarks.header.magic!=BOOKMARK_MAGIC)
+	{
+		errno=EINVAL;
+		return -1;
+	}
+	size_t pos=sizeof(struct bookmark_header_t);
+	while (bookmarks.size-pos>=sizeof(struct bookmark_record_t))
+	{
+		struct bookmark_record_t record;
+		memcpy(&record, bookmarks.data+pos, sizeof(record));
+		if (bookmarks.size-pos-sizeof(record)<record.len)
+			break; // cut short
+		if (record.flags&BOOKMARK_DELETED)
+			bookmarks.dead++;
+		else
+			bookmark_index_add(pos);
+		pos+=sizeof(record)+record.len;
+	}
+	bookmarks.size=pos;
+	return 0;
+}
+/**
+ * Open the store, creating it from bookmarks.txt the first time.
+ * @return -1 with errno set on failure
+ */
+int bookmark_open()
+{
+	snprintf(bookmarks.path, sizeof(bookmarks.path), "%s/bookmarks.db", init_dir);
+	bookmarks.fd=open(bookmarks.path, O_RDWR|O_CLOEXEC);
+	if (bookmarks.fd==-1 && errno==ENOENT)
+	{
+		// a new store, with the lines of the old text file if there is one
+		char old[1100], tmp[1110], line[4096];
+		snprintf(old, sizeof(old), "%s/bookmarks.txt", init_dir);
+		snprintf(tmp, sizeof(tmp), "%s.tmp", bookmarks.path);
+		int fd=open(tmp, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+		if (fd==-1) return -1;
+		struct bookmark_header_t header={BOOKMARK_MAGIC, BOOKMARK_VERSION, 1, 0};
+		write_all(fd, (const char *)&header, sizeof(header));
+		FILE *text=fopen(old, "r");
+		while (text && fgets(line, sizeof(line), text))
+		{
+			// old lines could be "quoted" as a whole, and ended with a space
+			char *start=line, *end=line+strcspn(line, "\n");
+			while (end>start && end[-1]==' ') end--;
+			if (end-start>=2 && *start=='"' && end[-1]=='"' && !memchr(start+1, '"', end-start-2))
+				start++, end--;
+			struct bookmark_record_t record={end-start, 0};
+			write_all(fd, (const char *)&record, sizeof(record));
+			write_all(fd, start, record.len);
+		}
+		if (text) fclose(text);
+		if (close(fd)==-1 || rename(tmp, bookmarks.path)==-1)
+			return -1;
+		bookmarks.fd=open(bookmarks.path, O_RDWR|O_CLOEXEC);
+	}
+	if (bookmarks.fd==-1)
+		return -1;
+	struct stat st;
+	fstat(bookmarks.fd, &st);
+	bookmarks.dev=st.st_dev;
+	bookmarks.ino=st.st_ino;
+	return bookmark_read();
+}
+/**
+ * Lock the store and bring the in-memory copy up to date with the file,
+ * reopening it if a compaction replaced it. The caller unlocks.
+ * @param  lock LOCK_SH to read, LOCK_EX to change the file
+ * @return      -1 with errno set on failure
+ */
+int bookmark_sync(int lock)
+{
+	if (bookmarks.fd==-1 && bookmark_open()==-1)
+		return -1;
+	while (1)
+	{
+		if (flock(bookmarks.fd, lock)==-1)
+			return -1;
+		struct stat st;
+		if (stat(bookmarks.path, &st)==0 && (st.st_ino!=bookmarks.ino || st.st_dev!=bookmarks.dev))
+		{
+			close(bookmarks.fd); // drops the lock too
+			if (bookmark_open()==-1)
+				return -1;
+			continue;
+		}
+		break;
+	}
+	struct bookmark_header_t header;
+	if (pread(bookmarks.fd, &header, sizeof(header), 0)!=sizeof(header))
+		return bookmark_read();
+	if (header.generation!=bookmarks.header.generation || header.changes!=bookmarks.header.changes)
+		return bookmark_read();
+	return 0;
+}
+// Record a change in the header, under LOCK_EX.
+void bookmark_changed()
+{
+	bookmarks.header.changes++;
+	pwrite(bookmarks.fd, &bookmarks.header.changes, sizeof(uint64_t), offsetof(struct bookmark_header_t, changes));
+	memcpy(bookmarks.data, &bookmarks.header, sizeof(bookmarks.header));
+}
+/**
+ * Rewrite the store without its tombstones, in a child. Indexes do not
+ * change, as they only count live records.
+ */
+void bookmark_compact()
+{
+	if (bookmarks.compactor>0 && kill(bookmarks.compactor, 0)==0)
+		return;
+	fflush(stdout);
 	pid_t pid=fork();
-	if (pid==0) // child
-	{
-		/// This shows how to do exec with environ (but is not available on MacOs)
-	    // extern char** environ; // environment variables
-		// execvpe(command->name, command->args, environ); // exec+args+path+environ
-
-		/// This shows how to do exec with auto-path resolve
-		// add a NULL argument to the end of args, and the name to the beginning
-		// as required by exec
-
-		//Creating the destination string for execv() command
-		char bin[40] = "/bin/";
-		strcat(bin, command->name);
-
-		// increase args size by 2
-		command->args=(char **)realloc(
-			command->args, sizeof(char *)*(command->arg_count+=2));
-
-		// shift everything forward by 1
-		for (int i=command->arg_count-2;i>0;--i)
-			command->args[i]=command->args[i-1];
-
-		// set args[0] as a copy of name
-		command->args[0]=strdup(command->name);
-		// set args[arg_count-1] (last) to NULL
-		command->args[command->arg_count-1]=NULL;
-
-		// Check if short is called, if so skip child process.
-		if(strcmp(command->name, "short") == 0) {
-			exit(0);
-		}
-		//Check if rps is called, if so close the child process.
-		else if(strcmp(command->name, "rps") == 0) {
-			exit(0);
-		}
-		// Check if the command is remindme.
-		else if(strcmp(command->name, "remindme") == 0){
-			
-			// Getting absolute path of the crontabs.txt file.
-			char crontabs_loc[1024] = "";
-			strcat(crontabs_loc, init_dir);
-			strcat(crontabs_loc, "/crontabs.txt");
-
-			if (command->arg_count < 4) { // Exit if the args are insufficient.
-				printf("Not enough arguments.\n");
-				exit(0);
-			}
-			FILE *crontab_ptr = NULL; 
-			crontab_ptr = fopen(crontabs_loc, "a+"); //Create a .txt file to store data.
-			if(crontab_ptr == NULL) {
-				printf("Error reaching file.\n");
-				exit(0);
-			}
-
-			int var_i = 2;
-			char *hours = NULL;
-			char *minutes = NULL;
-			char *cron_command = "/bin/crontab";
-			char *crontab_args[3];
-			char *time = strdup(command->args[1]);
-			crontab_args[0] = strdup("/bin/crontab");
-			crontab_args[1] = strdup(crontabs_loc);
-			crontab_args[2] = NULL;
-
-			//Extra command, if user inputs remindme remove all, remove all crontabs and delete the .txt file.
-			if(strcmp(command->args[1], "remove") == 0 && strcmp(command->args[2], "all") == 0) {	
-				remove(crontabs_loc);
-				crontab_args[1] = strdup("-r");
-				execv(cron_command, crontab_args);
-				exit(0);
-			}
-
-			//Splitting the first arg to get the time.
-			int token_count = 0;
-			char *token = strtok(time, ":");
-			while (token != NULL) {
-				if(token_count == 0)
-					hours = strdup(token);
-				if(token_count == 1)
-					minutes = strdup(token);
-				token = strtok(NULL, ":");
-				token_count++;
-			}
-
-			// Print error if the time format was wrong.
-			if((hours == NULL) || (minutes == NULL)) {
-				printf("Invalid format, please use format such as 14:30.\n");
-				exit(0);
-			}
-
-			// Writing data to .txt file to pass on to crontab.
-			fputs(minutes, crontab_ptr);
-			fputs(" ", crontab_ptr);
-			fputs(hours, crontab_ptr);
-			fputs(" * * *  XDG_RUNTIME_DIR=/run/user/$(id -u) notify-send ", crontab_ptr);
-			while (command->args[var_i] != NULL) {
-				fputs((command->args[var_i]), crontab_ptr);
-				fputs(" ", crontab_ptr);
-				var_i++;	
-			}
-			fputs("\n", crontab_ptr);
-			fclose(crontab_ptr);
-
-			// Executing crontab with the .txt file we created.
-			execv(cron_command, crontab_args); 
-			exit(0);
-		}
-
-		// Check if bookmark is called, this function works with reading and writing to a .txt file.
-		else if(strcmp(command->name, "bookmark") == 0){
-			FILE *fptr = NULL;
-			FILE *ftemp = NULL;
-
-			// Getting the initial text directory so I can reach it when I change dir on the process. 
-			char bookmark_loc[1024] = "";
-			strcat(bookmark_loc, init_dir);
-			strcat(bookmark_loc, "/bookmarks.txt");
-			
-			//Also creating a temp.txt path for delete operations.		
-			char temp_loc[1024] = "";
-			strcat(temp_loc, init_dir);
-			strcat(temp_loc, "/temp.txt");	
-
-			// Printing the current bookmarks.
-			if(strcmp(command->args[1], "-l") == 0){ 
-				char buffer[256];
-				int line = 0;
-				fptr = fopen(bookmark_loc, "r");
-				if(fptr == NULL) {
-					printf("Error opening bookmarks.\n");	
-					exit(0);
-				}
-				while (fgets(buffer, 256, fptr)){
-					printf("\t%d %s", line, buffer);
-					line++;
-				}
-				fclose(fptr);
-			}
-
-			// Deleting the bookmark according to given index.
-			else if(strcmp(command->args[1], "-d") == 0){ 
-				int index = atoi(command->args[2]);
-				int line = 0;
-				char buffer[256];
-				int currentLine = 0;
-				fptr = fopen(bookmark_loc, "r");
-				ftemp = fopen(temp_loc, "a+");		// Creating a temp .txt file.
-				if(fptr == NULL) {						
-					printf("Error deleting bookmarks.\n");	
-					exit(0);
+	if (pid!=0)
+	{
+		if (pid>0) bookmarks.compactor=pid;
+		return;
+	}
+	// a descriptor of its own, the lock on the inherited one is the parent's
+	bookmarks.fd=open(bookmarks.path, O_RDWR|O_CLOEXEC);
+	if (bookmarks.fd==-1 || flock(bookmarks.fd, LOCK_EX)==-1 || bookmark_read()==-1)
+		_exit(1);
+	char tmp[1110];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", bookmarks.path);
+	int fd=open(tmp, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+	if (fd==-1)
+		_exit(1);
+	struct bookmark_header_t header=bookmarks.header;
+	header.generation++;
+	header.changes=0;
+	char *out=malloc(bookmarks.size), *p=out;
+	memcpy(p, &header, sizeof(header));
+	p+=sizeof(header);
+	for (size_t i=0; i<bookmarks.count; i++)
+	{
+		size_t len;
+		bookmark_text(i, &len);
+		memcpy(p, bookmarks.data+bookmarks.index[i], sizeof(struct bookmark_record_t)+len);
+		p+=sizeof(struct bookmark_record_t)+len;
+	}
+	if (write_all(fd, out, p-out)==-1 || fsync(fd)==-1 || close(fd)==-1 || rename(tmp, bookmarks.path)==-1)
+	{
+		unlink(tmp);
+		_exit(1);
+	}
+	_exit(0);
+}
+/**
+ * Append a bookmark.
+ * @param  text [description]
+ * @param  len  [description]
+ * @return      -1 with errno set on failure
+ */
+int bookmark_add(const char *text, size_t len)
+{
+	if (bookmark_sync(LOCK_EX)==-1)
+		return -1;
+	struct bookmark_record_t record={len, 0};
+	size_t size=sizeof(record)+len;
+	if (bookmarks.size+size>bookmarks.data_size)
+	{
+		while (bookmarks.size+size>bookmarks.data_size)
+			bookmarks.data_size=bookmarks.data_size?bookmarks.data_size*2:4096;
+		bookmarks.data=realloc(bookmarks.data, bookmarks.data_size);
+	}
+	char *p=bookmarks.data+bookmarks.size;
+	memcpy(p, &record, sizeof(record));
+	memcpy(p+sizeof(record), text, len);
+	int r=-1;
+	// one write, at the end the file was read up to
+	if (pwrite(bookmarks.fd, p, size, bookmarks.size)==(ssize_t)size)
+	{
+		bookmark_index_add(bookmarks.size);
+		bookmarks.size+=size;
+		bookmark_changed();
+		r=0;
+	}
+	flock(bookmarks.fd, LOCK_UN);
+	return r;
+}
+/**
+ * Delete bookmark i by marking its record.
+ * @param  i [description]
+ * @return   -1 with errno set on failure, ERANGE if there is no such bookmark
+ */
+int bookmark_delete(size_t i)
+{
+	if (bookmark_sync(LOCK_EX)==-1)
+		return -1;
+	int r=-1;
+	if (i>=bookmarks.count)
+		errno=ERANGE;
+	else
+	{
+		uint32_t flags=BOOKMARK_DELETED;
+		uint64_t offset=bookmarks.index[i]+offsetof(struct bookmark_record_t, flags);
+		if (pwrite(bookmarks.fd, &flags, sizeof(flags), offset)==sizeof(flags))
+		{
+			memcpy(bookmarks.data+offset, &flags, sizeof(flags));
+			template_free(bookmarks.templates[i]);
+			memmove(bookmarks.index+i, bookmarks.index+i+1, sizeof(uint64_t)*(bookmarks.count-i-1));
+			memmove(bookmarks.templates+i, bookmarks.templates+i+1, sizeof(struct command_t *)*(bookmarks.count-i-1));
+			bookmarks.count--;
+			bookmarks.dead++;
+			bookmark_changed();
+			r=0;
+		}
+	}
+	flock(bookmarks.fd, LOCK_UN);
+	if (r==0 && bookmarks.dead>=32 && bookmarks.dead>bookmarks.count)
+		bookmark_compact();
+	return r;
+}
+
+// Bookmark keeps command lines in the bookmark store.
+int builtin_bookmark(struct command_t *command)
+{
+	if (command->arg_count == 0) {
+		printf("Not enough arguments.\n");
+		return UNKNOWN;
+	}
+
+	// Printing the current bookmarks.
+	if(strcmp(command->args[0], "-l") == 0){ 
+		if (bookmark_sync(LOCK_SH) == -1) {
+			printf("Error opening bookmarks: %s\n", strerror(errno));
+			return UNKNOWN;
+		}
+		for (size_t i = 0; i < bookmarks.count; i++) {
+			size_t len;
+			const char *text = bookmark_text(i, &len);
+			printf("\t%zu %.*s\n", i, (int)len, text);
+		}
+		flock(bookmarks.fd, LOCK_UN);
+		return SUCCESS;
+	}
+
+	// Deleting the bookmark according to given index.
+	if(strcmp(command->args[0], "-d") == 0){ 
+		if (command->arg_count < 2) {
+			printf("Not enough arguments.\n");
+			return UNKNOWN;
+		}
+		int index = atoi(command->args[1]);
+		if (index < 0 || bookmark_delete(index) == -1) {
+			if (index < 0 || errno == ERANGE)
+				printf("There is no bookmark at index %d.\n", index);
+			else
+				printf("Error deleting bookmark: %s\n", strerror(errno));
+			return UNKNOWN;
+		}
+		return SUCCESS;
+	}
+	
+	// Executing the command at index i like a typed line, so cd and the
+	// other builtins run in the shell itself.
+	if(strcmp(command->args[0], "-i") == 0){
+		static int depth = 0; // a bookmark may run bookmarks
+		if (command->arg_count < 2) {
+			printf("Not enough arguments.\n");
+			return UNKNOWN;
+		}
+		if (depth >= 16) {
+			printf("-%s: %s: bookmarks nested too deep.\n", sysname, command->name);
+			return UNKNOWN;
+		}
+		int index = atoi(command->args[1]);	
+		if (bookmark_sync(LOCK_SH) == -1) {
+			printf("Error opening bookmarks: %s\n", strerror(errno));
+			return UNKNOWN;
+		}
+		if (index < 0 || (size_t)index >= bookmarks.count) {
+			flock(bookmarks.fd, LOCK_UN);
+			printf("There is no bookmark at index %d.\n", index);
+			return UNKNOWN;
+		}
+		// Taken out of the cache while it runs, a nested bookmark command may reload the store.
+		uint64_t offset = bookmarks.index[index], generation = bookmarks.header.generation;
+		struct command_t *template = bookmarks.templates[index];
+		bookmarks.templates[index] = NULL;
+		if (!template) {
+			size_t len;
+			const char *text = bookmark_text(index, &len);
+			char *line = strndup(text, len);
+			struct arena_t *arena = calloc(1, sizeof(struct arena_t));
+			template = new_command(arena);
+			parse_command(line, template);
+			free(line);
+		}
+		flock(bookmarks.fd, LOCK_UN);
+
+		depth++;
+		int r = process_command(template);
+		depth--;
+		if ((size_t)index < bookmarks.count && bookmarks.index[index] == offset
+			&& bookmarks.header.generation == generation && !bookmarks.templates[index])
+			bookmarks.templates[index] = template;
+		else
+			template_free(template);
+		if (r == EXIT) return EXIT;
+		return last_status == 0 ? SUCCESS : UNKNOWN;
+	}
+
+	// Saving new bookmark, the arguments joined back into one line.
+	size_t size = 1;
+	for (int i = 0; i < command->arg_count; i++)
+		size += strlen(command->args[i]) + 1;
+	char *line = malloc(size), *p = line;
+	for (int i = 0; i < command->arg_count; i++)
+		p += sprintf(p, i ? " %s" : "%s", command->args[i]);
+	int r = bookmark_add(line, p - line);
+	free(line);
+	if (r == -1) {
+		printf("Error inserting bookmark: %s\n", strerror(errno));
+		return UNKNOWN;
+	}
+	return SUCCESS;
+}
+
+// pstraverse: process trees built from /proc. A snapshot reads the stat file
+// of every process, split across a small pool of threads, and indexes it as
+// pid -> slot and slot -> children. Snapshots are reused for PS_SNAPSHOT_TTL
+// so repeated queries cost only the walk.
+#define PS_SNAPSHOT_TTL 1000000000ull
+#define PS_CHUNK 256 // processes a worker takes at a time
+#define PS_MAX_THREADS 8
+struct ps_proc_t {
+	pid_t pid; // 0 if it went away while being read
+	pid_t ppid;
+	char comm[17];
+};
+struct ps_snapshot_t {
+	struct ps_proc_t *procs;
+	size_t count;
+	int32_t *slots; // open addressing, pid -> index into procs, -1 empty
+	size_t slots_size;
+	uint32_t *first_child; // children of i are children[first_child[i]..first_child[i+1])
+	uint32_t *children;
+	uint64_t taken;
+	int proc_fd;
+} ps_snapshot={.proc_fd=-1};
+
+// Workers of the pool run ps_work over chunks of the current snapshot.
+struct ps_pool_t {
+	pthread_mutex_t lock;
+	pthread_cond_t start, done;
+	int threads;
+	pid_t owner; // a forked child has none of the threads, and starts its own
+	unsigned round; // bumped to start a scan
+	int busy;
+	atomic_size_t next;
+} ps_pool;
+
+/**
+ * Read /proc/<pid>/stat with one read and take the command and parent pid.
+ * @param proc with pid set, cleared if the process is gone
+ */
+void ps_read_stat(struct ps_proc_t *proc)
+{
+	char path[32], buf[512];
+	snprintf(path, sizeof(path), "%d/stat", proc->pid);
+	int fd=openat(ps_snapshot.proc_fd, path, O_RDONLY|O_CLOEXEC);
+	ssize_t n=fd==-1?-1:read(fd, buf, sizeof(buf)-1);
+	if (fd!=-1) close(fd);
+	// "pid (comm) state ppid ...", comm may hold spaces and parentheses
+	const char *open=n>0?memchr(buf, '(', n):NULL;
+	const char *close_paren=n>0?memrchr(buf, ')', n):NULL;
+	if (!open || !close_paren || close_paren<open || buf+n-close_paren<5)
+	{
+		proc->pid=0;
+		return;
+	}
+	buf[n]=0;
+	size_t len=close_paren-open-1;
+	if (len>sizeof(proc->comm)-1) len=sizeof(proc->comm)-1;
+	memcpy(proc->comm, open+1, len);
+	proc->comm[len]=0;
+	proc->ppid=atoi(close_paren+4);
+}
+void ps_work()
+{
+	size_t i;
+	while ((i=atomic_fetch_add(&ps_pool.next, PS_CHUNK))<ps_snapshot.count)
+	{
+		size_t end=i+PS_CHUNK<ps_snapshot.count?i+PS_CHUNK:ps_snapshot.count;
+		for (; i<end; i++)
+			ps_read_stat(&ps_snapshot.procs[i]);
+	}
+}
+void *ps_worker(void *arg)
+{
+	unsigned seen=0;
+	(void)arg;
+	pthread_mutex_lock(&ps_pool.lock);
+	while (1)
+	{
+		while (ps_pool.round==seen)
+			pthread_cond_wait(&ps_pool.start, &ps_pool.lock);
+		seen=ps_pool.round;
+		pthread_mutex_unlock(&ps_pool.lock);
+		ps_work();
+		pthread_mutex_lock(&ps_pool.lock);
+		if (--ps_pool.busy==0)
+			pthread_cond_signal(&ps_pool.done);
+	}
+	return NULL;
+}
+// Start the pool, once per process. Workers keep every signal blocked.
+void ps_pool_start()
+{
+	if (ps_pool.owner==getpid()) return;
+	memset(&ps_pool, 0, sizeof(ps_pool));
+	pthread_mutex_init(&ps_pool.lock, NULL);
+	pthread_cond_init(&ps_pool.start, NULL);
+	pthread_cond_init(&ps_pool.done, NULL);
+	ps_pool.owner=getpid();
+	long cpus=sysconf(_SC_NPROCESSORS_ONLN);
+	int threads=cpus>PS_MAX_THREADS?PS_MAX_THREADS:cpus>1?cpus-1:0;
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	for (int i=0; i<threads; i++)
+	{
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, ps_worker, NULL)!=0) break;
+		pthread_detach(thread);
+		ps_pool.threads++;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+// Run ps_work on the pool and on this thread until every process is read.
+void ps_pool_run()
+{
+	ps_pool_start();
+	atomic_store(&ps_pool.next, 0);
+	if (ps_snapshot.count>PS_CHUNK && ps_pool.threads)
+	{
+		pthread_mutex_lock(&ps_pool.lock);
+		ps_pool.busy=ps_pool.threads;
+		ps_pool.round++;
+		pthread_cond_broadcast(&ps_pool.start);
+		pthread_mutex_unlock(&ps_pool.lock);
+		ps_work();
+		pthread_mutex_lock(&ps_pool.lock);
+		while (ps_pool.busy)
+			pthread_cond_wait(&ps_pool.done, &ps_pool.lock);
+		pthread_mutex_unlock(&ps_pool.lock);
+	}
+	else
+		ps_work();
+}
+// Index into the snapshot of a pid, -1 if it is not there.
+int32_t ps_find(pid_t pid)
+{
+	size_t mask=ps_snapshot.slots_size-1;
+	for (size_t i=((uint32_t)pid*2654435761u)&mask; ps_snapshot.slots[i]!=-1; i=(i+1)&mask)
+		if (ps_snapshot.procs[ps_snapshot.slots[i]].pid==pid)
+			return ps_snapshot.slots[i];
+	return -1;
+}
+/**
+ * Take a new snapshot of every process.
+ * @return -1 with errno set if /proc could not be read
+ */
+int ps_snapshot_take()
+{
+	struct ps_snapshot_t *s=&ps_snapshot;
+	if (s->proc_fd==-1 && (s->proc_fd=open("/proc", O_RDONLY|O_DIRECTORY|O_CLOEXEC))==-1)
+		return -1;
+	// the pids are the numeric names in /proc
+	size_t size=s->count?s->count*2:1024;
+	s->procs=realloc(s->procs, sizeof(struct ps_proc_t)*size);
+	s->count=0;
+	_Alignas(struct dirent64) char buf[32768];
+	ssize_t n;
+	lseek(s->proc_fd, 0, SEEK_SET);
+	while ((n=getdents64(s->proc_fd, buf, sizeof(buf)))>0)
+		for (ssize_t pos=0; pos<n;)
+		{
+			struct dirent64 *ent=(struct dirent64 *)(buf+pos);
+			pos+=ent->d_reclen;
+			if (ent->d_name[0]<'1' || ent->d_name[0]>'9') continue;
+			if (s->count==size)
+				s->procs=realloc(s->procs, sizeof(struct ps_proc_t)*(size*=2));
+			s->procs[s->count++].pid=atoi(ent->d_name);
+		}
+	ps_pool_run();
+
+	// drop the ones that exited in the meantime
+	size_t kept=0;
+	for (size_t i=0; i<s->count; i++)
+		if (s->procs[i].pid)
+			s->procs[kept++]=s->procs[i];
+	s->count=kept;
+
+	for (s->slots_size=64; s->slots_size<s->count*2; s->slots_size*=2);
+	s->slots=realloc(s->slots, sizeof(int32_t)*s->slots_size);
+	memset(s->slots, 0xff, sizeof(int32_t)*s->slots_size);
+	size_t mask=s->slots_size-1;
+	for (size_t i=0; i<s->count; i++)
+	{
+		size_t j=((uint32_t)s->procs[i].pid*2654435761u)&mask;
+		while (s->slots[j]!=-1) j=(j+1)&mask;
+		s->slots[j]=i;
+	}
+
+	// children as one array grouped by parent, in pid order
+	s->first_child=realloc(s->first_child, sizeof(uint32_t)*(s->count+1));
+	s->children=realloc(s->children, sizeof(uint32_t)*(s->count?s->count:1));
+	memset(s->first_child, 0, sizeof(uint32_t)*(s->count+1));
+	int32_t *parent=malloc(sizeof(int32_t)*(s->count?s->count:1));
+	for (size_t i=0; i<s->count; i++)
+	{
+		parent[i]=ps_find(s->procs[i].ppid);
+		if (parent[i]!=-1) s->first_child[parent[i]+1]++;
+	}
+	for (size_t i=0; i<s->count; i++)
+		s->first_child[i+1]+=s->first_child[i];
+	uint32_t *fill=malloc(sizeof(uint32_t)*(s->count?s->count:1));
+	memcpy(fill, s->first_child, sizeof(uint32_t)*(s->count?s->count:1));
+	for (size_t i=0; i<s->count; i++)
+		if (parent[i]!=-1)
+			s->children[fill[parent[i]]++]=i;
+	free(fill);
+	free(parent);
+	s->taken=monotonic_ns();
+	return 0;
+}
+/**
+ * Print one process of the walk.
+ * @param i       index into the snapshot
+ * @param depth   levels below the root
+ * @param machine tab separated pid, ppid, depth and command instead of a tree
+ */
+void ps_print(uint32_t i, int depth, bool machine)
+{
+	struct ps_proc_t *proc=&ps_snapshot.procs[i];
+	if (machine)
+		printf("%d\t%d\t%d\t%s\n", proc->pid, proc->ppid, depth, proc->comm);
+	else
+		printf("%*s%d %s\n", depth*2, "", proc->pid, proc->comm);
+}
+/**
+ * pstraverse <pid> [-b|-d] [-m] [-r]: print the processes under pid, depth
+ * first as a tree or breadth first level by level. -m prints tab separated
+ * fields, -r takes a new snapshot even if the last one is recent.
+ * @param  command [description]
+ * @return         [description]
+ */
+int builtin_pstraverse(struct command_t *command)
+{
+	pid_t root=0;
+	bool bfs=false, machine=false, refresh=false;
+	for (int i=0; i<command->arg_count; i++)
+	{
+		const char *arg=command->args[i];
+		if (strcmp(arg, "-b")==0) bfs=true;
+		else if (strcmp(arg, "-d")==0) bfs=false;
+		else if (strcmp(arg, "-m")==0) machine=true;
+		else if (strcmp(arg, "-r")==0) refresh=true;
+		else if (isdigit((unsigned char)arg[0])) root=atoi(arg);
+		else
+		{
+			printf("-%s: %s: %s: invalid option\n", sysname, command->name, arg);
+			return UNKNOWN;
+		}
+	}
+	if (root<=0)
+	{
+		printf("Usage: %s <pid> [-b|-d] [-m] [-r]\n", command->name);
+		return UNKNOWN;
+	}
+	if ((refresh || !ps_snapshot.taken || monotonic_ns()-ps_snapshot.taken>PS_SNAPSHOT_TTL) && ps_snapshot_take()==-1)
+	{
+		printf("-%s: %s: /proc: %s\n", sysname, command->name, strerror(errno));
+		return UNKNOWN;
+	}
+	int32_t start=ps_find(root);
+	if (start==-1)
+	{
+		printf("-%s: %s: %d: no such process\n", sysname, command->name, root);
+		return UNKNOWN;
+	}
+
+	// one array serves as the BFS queue or the DFS stack. The snapshot is
+	// read while processes come and go, so a reused pid can close a loop of
+	// parents; queued marks every entry once and bounds the array.
+	uint32_t *work=malloc(sizeof(uint32_t)*ps_snapshot.count);
+	int *depths=malloc(sizeof(int)*ps_snapshot.count);
+	uint64_t *queued=calloc((ps_snapshot.count+63)/64, sizeof(uint64_t));
+	size_t head=0, tail=0, pushed=1;
+	work[tail]=start;
+	depths[tail++]=0;
+	queued[start/64]|=1ull<<start%64;
+	while (head<tail)
+	{
+		size_t at=bfs?head++:--tail;
+		uint32_t i=work[at];
+		int depth=depths[at];
+		ps_print(i, depth, machine);
+		uint32_t from=ps_snapshot.first_child[i], to=ps_snapshot.first_child[i+1];
+		for (uint32_t c=0; c<to-from; c++)
+		{
+			// pushed in reverse for DFS, so the lowest pid comes off first
+			uint32_t child=ps_snapshot.children[bfs?from+c:to-1-c];
+			if (queued[child/64]&1ull<<child%64 || pushed==ps_snapshot.count)
+				continue;
+			queued[child/64]|=1ull<<child%64;
+			pushed++;
+			work[tail]=child;
+			depths[tail++]=depth+1;
+		}
+	}
+	free(work);
+	free(depths);
+	free(queued);
+	return SUCCESS;
+}
+
+/**
+ * Copy everything readable from in to out, keeping the data in the kernel when
+ * the descriptors allow it: copy_file_range between regular files, splice when
+ * either side is a pipe, sendfile from regular files, read/write otherwise.
+ * @param  in  [description]
+ * @param  out [description]
+ * @return     0, -1 with errno set on failure
+ */
+int move_bytes(int in, int out)
+{
+	struct stat in_st, out_st;
+	if (fstat(in, &in_st)==-1 || fstat(out, &out_st)==-1) return -1;
+	ssize_t n=0;
+	bool moved=false; // once data went through, a fast path failing is a real error
+
+	if (S_ISREG(in_st.st_mode) && S_ISREG(out_st.st_mode))
+	{
+		// both ends are files, let the filesystem copy (or reflink) the data itself
+		while ((n=copy_file_range(in, NULL, out, NULL, 1<<30, 0))>0)
+			moved=true;
+		if (n==0) return 0;
+		if (moved) return -1;
+		// EXDEV, EBADF for O_APPEND outputs and friends: try sendfile next
+	}
+	if (S_ISFIFO(in_st.st_mode) || S_ISFIFO(out_st.st_mode))
+	{
+		while ((n=splice(in, NULL, out, NULL, 1<<20, SPLICE_F_MOVE|SPLICE_F_MORE))>0)
+			moved=true;
+		if (n==0) return 0;
+		if (moved || errno!=EINVAL) return -1;
+	}
+	else if (S_ISREG(in_st.st_mode))
+	{
+		while ((n=sendfile(out, in, NULL, 1<<20))>0)
+			moved=true;
+		if (n==0) return 0;
+		if (moved) return -1;
+	}
+
+	char buf[1<<16];
+	while ((n=read(in, buf, sizeof(buf)))>0)
+		if (write_all(out, buf, n)==-1) return -1;
+	return n==-1?-1:0;
+}
+// The byte moving builtins only take operands, anything with options goes to the real program.
+bool accepts_operands_only(struct command_t *command)
+{
+	for (int i=0;i<command->arg_count;++i)
+		if (command->args[i][0]=='-' && command->args[i][1]!=0)
+			return false;
+	return true;
+}
+// cat builtin: feeds files (or stdin for "-" or no operands) to stdout through move_bytes.
+int builtin_cat(struct command_t *command)
+{
+	int r=SUCCESS;
+	struct stat out_st, in_st;
+	fflush(stdout);
+	if (command->arg_count==0)
+		return move_bytes(STDIN_FILENO, STDOUT_FILENO)==-1?UNKNOWN:SUCCESS;
+	bool out_reg=fstat(STDOUT_FILENO, &out_st)==0 && S_ISREG(out_st.st_mode);
+	for (int i=0;i<command->arg_count;++i)
+	{
+		const char *file=command->args[i];
+		int fd=strcmp(file, "-")==0?STDIN_FILENO:open(file, O_RDONLY|O_CLOEXEC);
+		if (fd!=-1 && out_reg && fstat(fd, &in_st)==0
+			&& in_st.st_dev==out_st.st_dev && in_st.st_ino==out_st.st_ino)
+		{
+			fprintf(stderr, "-%s: %s: %s: input file is output file\n", sysname, command->name, file);
+			r=UNKNOWN;
+		}
+		else if (fd==-1 || move_bytes(fd, STDOUT_FILENO)==-1)
+		{
+			if (errno==EPIPE) return UNKNOWN; // reader went away
+			fprintf(stderr, "-%s: %s: %s: %s\n", sysname, command->name, file, strerror(errno));
+			r=UNKNOWN;
+		}
+		if (fd>STDERR_FILENO) close(fd);
+	}
+	return r;
+}
+bool accepts_tee(struct command_t *command)
+{
+	for (int i=0;i<command->arg_count;++i)
+		if (command->args[i][0]=='-' && strcmp(command->args[i], "-a")!=0)
+			return false;
+	return true;
+}
+/**
+ * tee builtin: copy stdin to stdout and to every file operand, -a appends.
+ * Between two pipes with a single file the data is duplicated with tee(2)
+ * and spliced to the file, so it never reaches userspace.
+ * @param  command [description]
+ * @return         [description]
+ */
+int builtin_tee(struct command_t *command)
+{
+	int flags=O_WRONLY|O_CREAT|O_CLOEXEC|O_TRUNC;
+	int files[command->arg_count+1], count=0, r=SUCCESS;
+	for (int i=0;i<command->arg_count;++i)
+		if (strcmp(command->args[i], "-a")==0)
+			flags=(flags&~O_TRUNC)|O_APPEND;
+	for (int i=0;i<command->arg_count;++i)
+	{
+		if (strcmp(command->args[i], "-a")==0) continue;
+		int fd=open(command->args[i], flags, 0666);
+		if (fd==-1)
+		{
+			fprintf(stderr, "-%s: %s: %s: %s\n", sysname, command->name, command->args[i], strerror(errno));
+			r=UNKNOWN;
+			continue;
+		}
+		files[count++]=fd;
+	}
+	fflush(stdout);
+
+	struct stat in_st, out_st;
+	ssize_t n=-1;
+	if (count==1 && fstat(STDIN_FILENO, &in_st)==0 && fstat(STDOUT_FILENO, &out_st)==0
+		&& S_ISFIFO(in_st.st_mode) && S_ISFIFO(out_st.st_mode))
+	{
+		while ((n=tee(STDIN_FILENO, STDOUT_FILENO, 1<<20, 0))>0)
+		{
+			// tee left the bytes in stdin, splice consumes them into the file
+			for (ssize_t left=n, m;left>0;left-=m)
+				if ((m=splice(STDIN_FILENO, NULL, files[0], NULL, left, SPLICE_F_MOVE))<=0)
+				{
+					n=-1;
+					break;
 				}
-				if(ftemp == NULL) {
-					printf("Error deleting bookmark.\n");	
-					exit(0);
+			if (n==-1) break;
+		}
+		if (n==-1 && errno!=EPIPE)
+			r=UNKNOWN;
+	}
+	else
+	{
+		char buf[1<<16];
+		while (r==SUCCESS && (n=read(STDIN_FILENO, buf, sizeof(buf)))>0)
+		{
+			if (write_all(STDOUT_FILENO, buf, n)==-1)
+				r=UNKNOWN;
+			for (int i=0;i<count;++i)
+				if (write_all(files[i], buf, n)==-1)
+					r=UNKNOWN;
+		}
+	}
+	for (int i=0;i<count;++i)
+		close(files[i]);
+	return r;
+}
+
+// Text builtins: wc, grep -F, head and tail. Their inner loops are vector
+// kernels, AVX2 or SSE2 on x86-64 picked at first use, scalar elsewhere.
+// Regular files are mapped whole, anything else is read in large blocks.
+#define TEXT_BLOCK (1<<20)
+
+size_t count_byte_scalar(const char *p, size_t n, unsigned char c)
+{
+	size_t count=0;
+	for (size_t i=0;i<n;++i)
+		count+=(unsigned char)p[i]==c;
+	return count;
+}
+// Word starts in p, where a non-space follows a space; *in_word carries over between calls.
+size_t count_words_scalar(const char *p, size_t n, bool *in_word)
+{
+	size_t count=0;
+	bool word=*in_word;
+	for (size_t i=0;i<n;++i)
+	{
+		unsigned char c=p[i];
+		bool space=c==' ' || (c>='\t' && c<='\r');
+		count+=!space && !word;
+		word=!space;
+	}
+	*in_word=word;
+	return count;
+}
+const char *find_fixed_scalar(const char *p, size_t n, const char *needle, size_t m)
+{
+	return memmem(p, n, needle, m);
+}
+#if defined(__x86_64__)
+size_t count_byte_sse2(const char *p, size_t n, unsigned char c)
+{
+	__m128i needle=_mm_set1_epi8(c), zero=_mm_setzero_si128(), total=zero;
+	size_t i=0;
+	while (i+16<=n)
+	{
+		// per byte counters, folded into the total before they can wrap
+		__m128i acc=zero;
+		for (int k=0;k<255 && i+16<=n;++k, i+=16)
+			acc=_mm_sub_epi8(acc, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(p+i)), needle));
+		total=_mm_add_epi64(total, _mm_sad_epu8(acc, zero));
+	}
+	return _mm_cvtsi128_si64(total)+_mm_cvtsi128_si64(_mm_unpackhi_epi64(total, total))+count_byte_scalar(p+i, n-i, c);
+}
+__attribute__((target("avx2")))
+size_t count_byte_avx2(const char *p, size_t n, unsigned char c)
+{
+	__m256i needle=_mm256_set1_epi8(c), zero=_mm256_setzero_si256(), total=zero;
+	size_t i=0;
+	while (i+32<=n)
+	{
+		__m256i acc=zero;
+		for (int k=0;k<255 && i+32<=n;++k, i+=32)
+			acc=_mm256_sub_epi8(acc, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p+i)), needle));
+		total=_mm256_add_epi64(total, _mm256_sad_epu8(acc, zero));
+	}
+	return _mm256_extract_epi64(total, 0)+_mm256_extract_epi64(total, 1)+_mm256_extract_epi64(total, 2)
+		+_mm256_extract_epi64(total, 3)+count_byte_scalar(p+i, n-i, c);
+}
+size_t count_words_sse2(const char *p, size_t n, bool *in_word)
+{
+	__m128i space=_mm_set1_epi8(' '), tab=_mm_set1_epi8('\t'), four=_mm_set1_epi8(4);
+	uint32_t carry=*in_word;
+	size_t count=0, i=0;
+	for (;i+16<=n;i+=16)
+	{
+		__m128i v=_mm_loadu_si128((const __m128i *)(p+i)), control=_mm_sub_epi8(v, tab);
+		// space, or \t to \r: v-'\t' is at most 4 unsigned
+		__m128i blank=_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(_mm_min_epu8(control, four), control));
+		uint32_t word=~_mm_movemask_epi8(blank)&0xffff;
+		count+=__builtin_popcount(word&~((word<<1)|carry));
+		carry=word>>15;
+	}
+	*in_word=carry;
+	return count+count_words_scalar(p+i, n-i, in_word);
+}
+__attribute__((target("avx2")))
+size_t count_words_avx2(const char *p, size_t n, bool *in_word)
+{
+	__m256i space=_mm256_set1_epi8(' '), tab=_mm256_set1_epi8('\t'), four=_mm256_set1_epi8(4);
+	uint32_t carry=*in_word;
+	size_t count=0, i=0;
+	for (;i+32<=n;i+=32)
+	{
+		__m256i v=_mm256_loadu_si256((const __m256i *)(p+i)), control=_mm256_sub_epi8(v, tab);
+		__m256i blank=_mm256_or_si256(_mm256_cmpeq_epi8(v, space), _mm256_cmpeq_epi8(_mm256_min_epu8(control, four), control));
+		uint32_t word=~(uint32_t)_mm256_movemask_epi8(blank);
+		count+=__builtin_popcount(word&~((word<<1)|carry));
+		carry=word>>31;
+	}
+	*in_word=carry;
+	return count+count_words_scalar(p+i, n-i, in_word);
+}
+// Candidates are where the needle's first and last bytes both match, only those are compared.
+const char *find_fixed_sse2(const char *p, size_t n, const char *needle, size_t m)
+{
+	if (m<2) return m?memchr(p, needle[0], n):p;
+	__m128i first=_mm_set1_epi8(needle[0]), last=_mm_set1_epi8(needle[m-1]);
+	size_t i=0;
+	for (;i+m-1+16<=n;i+=16)
+	{
+		__m128i a=_mm_loadu_si128((const __m128i *)(p+i)), b=_mm_loadu_si128((const __m128i *)(p+i+m-1));
+		uint32_t mask=_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+		for (;mask;mask&=mask-1)
+		{
+			int bit=__builtin_ctz(mask);
+			if (memcmp(p+i+bit+1, needle+1, m-2)==0)
+				return p+i+bit;
+		}
+	}
+	return i<n?memmem(p+i, n-i, needle, m):NULL;
+}
+__attribute__((target("avx2")))
+const char *find_fixed_avx2(const char *p, size_t n, const char *needle, size_t m)
+{
+	if (m<2) return m?memchr(p, needle[0], n):p;
+	__m256i first=_mm256_set1_epi8(needle[0]), last=_mm256_set1_epi8(needle[m-1]);
+	size_t i=0;
+	for (;i+m-1+32<=n;i+=32)
+	{
+		__m256i a=_mm256_loadu_si256((const __m256i *)(p+i)), b=_mm256_loadu_si256((const __m256i *)(p+i+m-1));
+		uint32_t mask=_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+		for (;mask;mask&=mask-1)
+		{
+			int bit=__builtin_ctz(mask);
+			if (memcmp(p+i+bit+1, needle+1, m-2)==0)
+				return p+i+bit;
+		}
+	}
+	return i<n?memmem(p+i, n-i, needle, m):NULL;
+}
+#endif
+size_t (*count_byte)(const char *p, size_t n, unsigned char c);
+size_t (*count_words)(const char *p, size_t n, bool *in_word);
+const char *(*find_fixed)(const char *p, size_t n, const char *needle, size_t m);
+// Pick the kernels for this CPU, once.
+void text_kernels_init()
+{
+	if (count_byte) return;
+	count_byte=count_byte_scalar;
+	count_words=count_words_scalar;
+	find_fixed=find_fixed_scalar;
+#if defined(__x86_64__)
+	count_byte=count_byte_sse2;
+	count_words=count_words_sse2;
+	find_fixed=find_fixed_sse2;
+	if (getenv("SHELLINGTON_NO_AVX2")==NULL && __builtin_cpu_supports("avx2"))
+	{
+		count_byte=count_byte_avx2;
+		count_words=count_words_avx2;
+		find_fixed=find_fixed_avx2;
+	}
+#endif
+}
+
+// An input of a text builtin: a regular file mapped whole, or a descriptor
+// read block by block into buf.
+struct text_t {
+	const char *name;
+	int fd;
+	char *map; // the unread part of the mapping
+	size_t map_len;
+	void *mapping;
+	size_t mapping_len;
+	char *buf;
+	size_t size, len; // len bytes of buf are filled
+};
+/**
+ * Open a file operand, "-" or NULL for stdin.
+ * @param  text  [description]
+ * @param  file  [description]
+ * @param  whole all of it will be read, so map it in one go instead of page by page
+ * @return       -1 with errno set if it can't be read
+ */
+int text_open(struct text_t *text, const char *file, bool whole)
+{
+	memset(text, 0, sizeof(*text));
+	text->name=file?file:"-";
+	text->fd=file==NULL || strcmp(file, "-")==0?STDIN_FILENO:open(file, O_RDONLY|O_CLOEXEC);
+	if (text->fd==-1) return -1;
+	struct stat st;
+	if (fstat(text->fd, &st)==0 && S_ISDIR(st.st_mode))
+	{
+		if (text->fd!=STDIN_FILENO) close(text->fd);
+		errno=EISDIR;
+		return -1;
+	}
+	// files that report no size (most of /proc) are read like pipes
+	if (S_ISREG(st.st_mode) && st.st_size>0)
+	{
+		off_t at=lseek(text->fd, 0, SEEK_CUR); // stdin may be part way through the file
+		if (at>=0 && at<st.st_size)
+		{
+			void *mapping=mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE|(whole?MAP_POPULATE:0), text->fd, 0);
+			if (mapping!=MAP_FAILED)
+			{
+				madvise(mapping, st.st_size, MADV_SEQUENTIAL);
+				text->mapping=mapping;
+				text->mapping_len=st.st_size;
+				text->map=(char *)mapping+at;
+				text->map_len=st.st_size-at;
+			}
+		}
+	}
+	return 0;
+}
+/**
+ * Read the next block after what is already in buf, growing it when full.
+ * @param  text [description]
+ * @return      bytes read, 0 at the end, -1 on error
+ */
+ssize_t text_fill(struct text_t *text)
+{
+	if (text->len==text->size)
+	{
+		size_t size=text->size?text->size*2:TEXT_BLOCK;
+		char *buf=aligned_alloc(64, size);
+		if (!buf) return -1;
+		if (text->len) memcpy(buf, text->buf, text->len);
+		free(text->buf);
+		text->buf=buf;
+		text->size=size;
+	}
+	ssize_t n;
+	do n=read(text->fd, text->buf+text->len, text->size-text->len);
+	while (n==-1 && errno==EINTR);
+	if (n>0) text->len+=n;
+	return n;
+}
+// Drop the first n bytes of buf, keeping what follows for the next block.
+void text_consume(struct text_t *text, size_t n)
+{
+	memmove(text->buf, text->buf+n, text->len-n);
+	text->len-=n;
+}
+void text_close(struct text_t *text)
+{
+	if (text->mapping)
+		munmap(text->mapping, text->mapping_len);
+	free(text->buf);
+	if (text->fd>STDERR_FILENO) close(text->fd);
+}
+void text_error(struct command_t *command, const char *file)
+{
+	fprintf(stderr, "-%s: %s: %s: %s\n", sysname, command->name, file?file:"-", strerror(errno));
+}
+
+// Output of the text builtins, written to stdout in large pieces.
+struct text_out_t {
+	char buf[1<<16];
+	size_t len;
+	bool failed;
+};
+void text_flush(struct text_out_t *out)
+{
+	if (out->len && !out->failed && write_all(STDOUT_FILENO, out->buf, out->len)==-1)
+		out->failed=true;
+	out->len=0;
+}
+void text_write(struct text_out_t *out, const char *p, size_t n)
+{
+	if (out->len+n>sizeof(out->buf))
+	{
+		text_flush(out);
+		if (n>=sizeof(out->buf))
+		{
+			if (!out->failed && write_all(STDOUT_FILENO, p, n)==-1)
+				out->failed=true;
+			return;
+		}
+	}
+	memcpy(out->buf+out->len, p, n);
+	out->len+=n;
+}
+
+// Options of a text builtin, parsed the same way for accepts and for the run.
+struct text_opts_t {
+	bool flags[128]; // which single letter options were given
+	long long count; // -n or -c of head and tail, -1 if not given
+	bool bytes; // the count is -c
+	const char **operands;
+	int operand_count;
+};
+/**
+ * Parse the options of a text builtin. Anything it doesn't know means the
+ * real program has to run instead.
+ * @param  command [description]
+ * @param  letters option letters that take no value
+ * @param  counted head and tail: -n N, -c N and -N
+ * @param  opts    operands has to have room for every argument
+ * @return         false for options the builtin doesn't handle
+ */
+bool text_options(struct command_t *command, const char *letters, bool counted, struct text_opts_t *opts)
+{
+	memset(opts->flags, 0, sizeof(opts->flags));
+	opts->count=-1;
+	opts->bytes=false;
+	opts->operand_count=0;
+	bool options=true;
+	for (int i=0;i<command->arg_count;++i)
+	{
+		const char *arg=command->args[i];
+		if (!options || arg[0]!='-' || arg[1]==0)
+		{
+			opts->operands[opts->operand_count++]=arg;
+			continue;
+		}
+		if (strcmp(arg, "--")==0)
+		{
+			options=false;
+			continue;
+		}
+		if (counted && (arg[1]=='n' || arg[1]=='c' || isdigit((unsigned char)arg[1])))
+		{
+			const char *value=isdigit((unsigned char)arg[1])?arg+1:arg[2]?arg+2:command->args[++i];
+			if (value==NULL || !isdigit((unsigned char)value[0])) return false; // +N and -N forms differ per tool
+			char *end;
+			opts->count=strtoll(value, &end, 10);
+			if (*end) return false;
+			opts->bytes=arg[1]=='c';
+			continue;
+		}
+		for (const char *p=arg+1;*p;++p)
+		{
+			if ((unsigned char)*p>=128 || !strchr(letters, *p)) return false;
+			opts->flags[(unsigned char)*p]=true;
+		}
+	}
+	return true;
+}
+bool accepts_wc(struct command_t *command)
+{
+	const char *operands[command->arg_count+1];
+	struct text_opts_t opts={.operands=operands};
+	return text_options(command, "lwc", false, &opts);
+}
+/**
+ * wc builtin: lines, words and bytes of each file and their total. Counts
+ * newlines and word starts with the vector kernels; -c alone on a regular
+ * file only looks at its size.
+ * @param  command [description]
+ * @return         [description]
+ */
+int builtin_wc(struct command_t *command)
+{
+	const char *operands[command->arg_count+1];
+	struct text_opts_t opts={.operands=operands};
+	text_options(command, "lwc", false, &opts);
+	bool lines=opts.flags['l'], words=opts.flags['w'], bytes=opts.flags['c'];
+	if (!lines && !words && !bytes)
+		lines=words=bytes=true;
+	int files=opts.operand_count?opts.operand_count:1;
+	uint64_t total[3]={0, 0, 0};
+
+	// columns as wide as the total size of the files needs, 7 if any isn't a file
+	int width=1;
+	if (files>1 || lines+words+bytes>1)
+	{
+		off_t size=0;
+		struct stat st;
+		for (int f=0;f<opts.operand_count && width!=7;++f)
+			if (stat(operands[f], &st)==0 && S_ISREG(st.st_mode))
+				size+=st.st_size;
+			else
+				width=7;
+		if (!opts.operand_count) width=7;
+		for (;width<7 && size>=10;size/=10)
+			width++;
+	}
+	int r=SUCCESS;
+	text_kernels_init();
+	fflush(stdout);
+
+	for (int f=0;f<files+(files>1);++f)
+	{
+		uint64_t counts[3]={0, 0, 0};
+		const char *name=f==files?"total":opts.operand_count?operands[f]:NULL;
+		if (f==files)
+			memcpy(counts, total, sizeof(counts));
+		else
+		{
+			struct text_t text;
+			struct stat st;
+			if (text_open(&text, name, lines || words)==-1)
+			{
+				text_error(command, name);
+				r=UNKNOWN;
+				continue;
+			}
+			bool in_word=false;
+			if (!lines && !words && text.map)
+				counts[2]=text.map_len;
+			else if (text.map)
+			{
+				if (lines) counts[0]=count_byte(text.map, text.map_len, '\n');
+				if (words) counts[1]=count_words(text.map, text.map_len, &in_word);
+				counts[2]=text.map_len;
+			}
+			else if (!lines && !words && fstat(text.fd, &st)==0 && S_ISREG(st.st_mode) && st.st_size>0)
+				counts[2]=st.st_size-lseek(text.fd, 0, SEEK_CUR);
+			else
+			{
+				ssize_t n;
+				while ((n=text_fill(&text))>0)
+				{
+					if (lines) counts[0]+=count_byte(text.buf, text.len, '\n');
+					if (words) counts[1]+=count_words(text.buf, text.len, &in_word);
+					counts[2]+=text.len;
+					text.len=0;
 				}
-				while (fgets(buffer, 256, fptr)){	//Copying the original text to temp text file.
-					if(currentLine == index) {
-						currentLine++;
-						continue;
-					}
-					fputs(buffer, ftemp);
-					currentLine++;
+				if (n==-1)
+				{
+					text_error(command, name);
+					r=UNKNOWN;
 				}
-				fclose(fptr);
-				fclose(ftemp);
-				remove(bookmark_loc);				//Deleting the original one and renaming the temp to intended name.
-				rename(temp_loc, bookmark_loc);
-			}
-			
-			// Executing the command that at index i, if the command is cd, exit and execute it on parent process.
-			else if(strcmp(command->args[1], "-i") == 0){
-				int index = atoi(command->args[2]);	
-				int buffer_counter = 0;
-				char *dir, *to_execute;
-				char buffer[256];
-				char bookmarkBin[256] = "/bin/";
-				int i, j, len, arg_count;
-				fptr = fopen(bookmark_loc, "r");
-
-				// If cannot open the file, exit.
-				if(fptr == NULL) {
-					printf("Error opening bookmarks.\n");	
-					exit(0);
+			}
+			text_close(&text);
+			for (int i=0;i<3;++i)
+				total[i]+=counts[i];
+		}
+		bool shown[3]={lines, words, bytes};
+		bool first=true;
+		for (int i=0;i<3;++i)
+			if (shown[i])
+			{
+				printf("%s%*llu", first?"":" ", width, (unsigned long long)counts[i]);
+				first=false;
+			}
+		printf(name?" %s\n":"\n", name);
+	}
+	return r;
+}
+// Plain grep patterns without regex syntax are fixed strings too.
+bool grep_fixed_pattern(const char *pattern)
+{
+	return strpbrk(pattern, ".[]*^$\\")==NULL;
+}
+bool accepts_grep(struct command_t *command)
+{
+	const char *operands[command->arg_count+1];
+	struct text_opts_t opts={.operands=operands};
+	if (!text_options(command, "Fvcnq", false, &opts) || opts.operand_count==0) return false;
+	return opts.flags['F'] || grep_fixed_pattern(operands[0]);
+}
+// State of one grep over its inputs.
+struct grep_t {
+	const char *pattern;
+	size_t pattern_len;
+	bool invert, count_only, numbers, quiet;
+	const char *prefix; // file name shown before each line, NULL for one input
+	uint64_t line; // number of the first line of the next chunk
+	uint64_t matches;
+	struct text_out_t *out;
+};
+// Print the lines in [p, end), each with its prefix and number.
+void grep_emit(struct grep_t *grep, const char *p, const char *end)
+{
+	if (grep->count_only || grep->quiet || p==end) return;
+	if (!grep->prefix && !grep->numbers)
+	{
+		text_write(grep->out, p, end-p);
+		if (end[-1]!='\n') text_write(grep->out, "\n", 1);
+		return;
+	}
+	while (p<end)
+	{
+		const char *nl=memchr(p, '\n', end-p), *stop=nl?nl+1:end;
+		char number[32];
+		if (grep->prefix)
+		{
+			text_write(grep->out, grep->prefix, strlen(grep->prefix));
+			text_write(grep->out, ":", 1);
+		}
+		if (grep->numbers)
+			text_write(grep->out, number, snprintf(number, sizeof(number), "%llu:", (unsigned long long)grep->line));
+		text_write(grep->out, p, stop-p);
+		if (!nl) text_write(grep->out, "\n", 1);
+		grep->line++;
+		p=stop;
+	}
+}
+// Lines in [p, end), counting a last one without a newline.
+uint64_t text_lines(const char *p, const char *end)
+{
+	return p==end?0:count_byte(p, end-p, '\n')+(end[-1]!='\n');
+}
+/**
+ * Filter a chunk made of whole lines. Only the pattern is searched for, lines
+ * are found around each hit.
+ * @param  grep [description]
+ * @param  p    [description]
+ * @param  n    [description]
+ * @return      false once -q has its answer
+ */
+bool grep_chunk(struct grep_t *grep, const char *p, size_t n)
+{
+	const char *end=p+n;
+	while (p<end)
+	{
+		const char *hit=find_fixed(p, end-p, grep->pattern, grep->pattern_len);
+		const char *start=end, *stop=end;
+		if (hit)
+		{
+			const char *nl=hit>p?memrchr(p, '\n', hit-p):NULL;
+			start=nl?nl+1:p;
+			nl=memchr(hit, '\n', end-hit);
+			stop=nl?nl+1:end;
+		}
+		if (grep->invert)
+		{
+			grep->matches+=text_lines(p, start);
+			grep_emit(grep, p, start);
+			grep->line+=hit!=NULL;
+		}
+		else if (hit)
+		{
+			grep->matches++;
+			if (grep->numbers)
+				grep->line+=count_byte(p, start-p, '\n');
+			grep_emit(grep, start, stop);
+		}
+		if (grep->quiet && grep->matches) return false;
+		p=stop;
+	}
+	return true;
+}
+/**
+ * grep builtin for fixed strings: -F, or a pattern with no regex syntax.
+ * Handles -v, -c, -n and -q, and file names in front of lines for several
+ * files. Anything else runs the real grep.
+ * @param  command [description]
+ * @return         SUCCESS if a line was selected
+ */
+int builtin_grep(struct command_t *command)
+{
+	const char *operands[command->arg_count+1];
+	struct text_opts_t opts={.operands=operands};
+	text_options(command, "Fvcnq", false, &opts);
+	struct text_out_t *out=malloc(sizeof(struct text_out_t));
+	out->len=0;
+	out->failed=false;
+	struct grep_t grep={operands[0], strlen(operands[0]), opts.flags['v'], opts.flags['c'], opts.flags['n'], opts.flags['q'], NULL, 0, 0, out};
+	int files=opts.operand_count-1;
+	bool errors=false, found=false;
+	text_kernels_init();
+	fflush(stdout);
+
+	for (int f=0;f<(files?files:1);++f)
+	{
+		const char *name=files?operands[f+1]:NULL;
+		struct text_t text;
+		if (text_open(&text, name, !opts.flags['q'])==-1)
+		{
+			text_error(command, name);
+			errors=true;
+			continue;
+		}
+		grep.prefix=files>1?text.name:NULL;
+		grep.line=1;
+		grep.matches=0;
+		bool more=true;
+		if (text.map)
+			grep_chunk(&grep, text.map, text.map_len);
+		else
+		{
+			// whole lines go to grep_chunk, a partial one waits for the next block
+			ssize_t n;
+			while (more && (n=text_fill(&text))>0)
+			{
+				char *nl=memrchr(text.buf, '\n', text.len);
+				if (!nl) continue;
+				more=grep_chunk(&grep, text.buf, nl+1-text.buf);
+				text_consume(&text, nl+1-text.buf);
+			}
+			if (more && n==-1)
+			{
+				text_error(command, name);
+				errors=true;
+			}
+			else if (more && text.len)
+				grep_chunk(&grep, text.buf, text.len);
+		}
+		text_close(&text);
+		found|=grep.matches>0;
+		if (grep.count_only && !grep.quiet)
+		{
+			char line[64];
+			if (grep.prefix)
+			{
+				text_write(out, grep.prefix, strlen(grep.prefix));
+				text_write(out, ":", 1);
+			}
+			text_write(out, line, snprintf(line, sizeof(line), "%llu\n", (unsigned long long)grep.matches));
+		}
+		if (grep.quiet && found) break;
+	}
+	text_flush(out);
+	free(out);
+	return found && !errors?SUCCESS:UNKNOWN;
+}
+bool accepts_head_tail(struct command_t *command)
+{
+	const char *operands[command->arg_count+1];
+	struct text_opts_t opts={.operands=operands};
+	return text_options(command, "", true, &opts);
+}
+/**
+ * Where the first count lines (or bytes) of p end.
+ * @param  p     [description]
+ * @param  n     [description]
+ * @param  count lines still wanted, lowered by the ones found
+ * @param  bytes count bytes instead
+ * @return       length of the prefix that is wanted
+ */
+size_t head_prefix(const char *p, size_t n, long long *count, bool bytes)
+{
+	if (bytes)
+	{
+		size_t take=(unsigned long long)*count<n?(size_t)*count:n;
+		*count-=take;
+		return take;
+	}
+	// counted in blocks, so a mapped file is only touched up to where the lines end
+	size_t at=0;
+	while (at<n)
+	{
+		size_t block=n-at<65536?n-at:65536, lines=count_byte(p+at, block, '\n');
+		if (lines>=(unsigned long long)*count)
+		{
+			for (;*count>0;--*count)
+				at=(const char *)memchr(p+at, '\n', n-at)+1-p;
+			return at;
+		}
+		*count-=lines;
+		at+=block;
+	}
+	return n;
+}
+/**
+ * The last count lines (or bytes) of p.
+ * @return offset where they start
+ */
+size_t tail_start(const char *p, size_t n, long long count, bool bytes)
+{
+	if (bytes)
+		return (unsigned long long)count<n?n-count:0;
+	if (count==0) return n;
+	size_t at=n;
+	if (at && p[at-1]=='\n') at--; // the last newline ends the last line
+	while (at>0)
+	{
+		const char *nl=memrchr(p, '\n', at);
+		if (!nl) return 0;
+		if (--count==0) return nl+1-p;
+		at=nl-p;
+	}
+	return 0;
+}
+/**
+ * head and tail builtins: the first or last -n lines (10 by default) or -c
+ * bytes of each file. head stops reading as soon as it has them, tail of a
+ * regular file only looks at its end.
+ * @param  command [description]
+ * @return         [description]
+ */
+int builtin_head_tail(struct command_t *command)
+{
+	const char *operands[command->arg_count+1];
+	struct text_opts_t opts={.operands=operands};
+	text_options(command, "", true, &opts);
+	bool tail=strcmp(command->name, "tail")==0;
+	long long wanted=opts.count==-1?10:opts.count;
+	int files=opts.operand_count?opts.operand_count:1, r=SUCCESS;
+	struct text_out_t *out=malloc(sizeof(struct text_out_t));
+	out->len=0;
+	out->failed=false;
+	text_kernels_init();
+	fflush(stdout);
+
+	for (int f=0;f<files && !out->failed;++f)
+	{
+		const char *name=opts.operand_count?operands[f]:NULL;
+		struct text_t text;
+		if (text_open(&text, name, false)==-1)
+		{
+			text_error(command, name);
+			r=UNKNOWN;
+			continue;
+		}
+		if (files>1)
+		{
+			char header[1100];
+			text_write(out, header, snprintf(header, sizeof(header), "%s==> %s <==\n", f?"\n":"",
+				strcmp(text.name, "-")==0?"standard input":text.name));
+		}
+		long long count=wanted;
+		ssize_t n=0;
+		if (text.map && tail)
+		{
+			size_t start=tail_start(text.map, text.map_len, count, opts.bytes);
+			text_write(out, text.map+start, text.map_len-start);
+		}
+		else if (text.map)
+			text_write(out, text.map, head_prefix(text.map, text.map_len, &count, opts.bytes));
+		else if (tail)
+		{
+			// keep only a little more than the tail once a lot has been read
+			while ((n=text_fill(&text))>0)
+				if (text.len>=TEXT_BLOCK*4)
+				{
+					size_t start=tail_start(text.buf, text.len, count, opts.bytes);
+					if (start) text_consume(&text, start);
 				}
+			size_t start=tail_start(text.buf, text.len, count, opts.bytes);
+			text_write(out, text.buf+start, text.len-start);
+		}
+		else
+			while (count>0 && (n=text_fill(&text))>0)
+			{
+				text_write(out, text.buf, head_prefix(text.buf, text.len, &count, opts.bytes));
+				text.len=0;
+			}
+		if (n==-1)
+		{
+			text_error(command, name);
+			r=UNKNOWN;
+		}
+		text_close(&text);
+	}
+	text_flush(out);
+	if (out->failed) r=UNKNOWN;
+	free(out);
+	return r;
+}
+
+int builtin_parallel(struct command_t *command);
+int builtin_watch(struct command_t *command);
+struct builtin_t {
+	const char *name;
+	int (*fn)(struct command_t *command);
+	bool (*accepts)(struct command_t *command); // NULL if every form of the command is handled
+	bool reads_input; // may read stdin, so the terminal has to be cooked
+	bool job; // can run unbounded, so with job control it forks for ^C and ^Z to reach it
+};
+// Commands handled by the shell itself, checked before any process is created.
+struct builtin_t builtins[] = {
+	{"exit", builtin_exit, NULL, false, false},
+	{"cd", builtin_cd, NULL, false, false},
+	{"hash", builtin_hash, NULL, false, false},
+	{"short", builtin_short, NULL, false, false},
+	{"rps", builtin_rps, NULL, false, false},
+	{"remindme", builtin_remindme, NULL, false, false},
+	{"bookmark", builtin_bookmark, NULL, false, false},
+	{"jobs", builtin_jobs, NULL, false, false},
+	{"fg", builtin_fg, NULL, false, false},
+	{"bg", builtin_bg, NULL, false, false},
+	{"wait", builtin_wait, NULL, false, false},
+	{"pstraverse", builtin_pstraverse, NULL, false, false},
+	{"stats", builtin_stats, NULL, false, false},
+	{"cat", builtin_cat, accepts_operands_only, true, true},
+	{"tee", builtin_tee, accepts_tee, true, true},
+	{"wc", builtin_wc, accepts_wc, true, true},
+	{"grep", builtin_grep, accepts_grep, true, true},
+	{"head", builtin_head_tail, accepts_head_tail, true, true},
+	{"tail", builtin_head_tail, accepts_head_tail, true, true},
+	{"parallel", builtin_parallel, NULL, true, false},
+	{"watch", builtin_watch, NULL, true, false}, // ^C has to reach it
+};
+/**
+ * Look up the builtin that handles this command, NULL if it is external.
+ * @param  command [description]
+ * @return         [description]
+ */
+struct builtin_t *find_builtin(struct command_t *command)
+{
+	for (size_t i=0;i<sizeof(builtins)/sizeof(builtins[0]);++i)
+		if (strcmp(builtins[i].name, command->name)==0)
+		{
+			if (builtins[i].accepts && !builtins[i].accepts(command))
+				return NULL;
+			return &builtins[i];
+		}
+	return NULL;
+}
+// Name of the i'th builtin, NULL past the last one.
+const char *builtin_name(size_t i)
+{
+	return i<sizeof(builtins)/sizeof(builtins[0])?builtins[i].name:NULL;
+}
+
+// Pipes between stages are grown to this size when the system allows it.
+#define PIPE_BUFFER_SIZE (1<<20)
+int pipe_buffer_size()
+{
+	static int size=0;
+	if (size) return size;
+	size=PIPE_BUFFER_SIZE;
+	FILE *f=fopen("/proc/sys/fs/pipe-max-size", "r");
+	if (f)
+	{
+		int max;
+		if (fscanf(f, "%d", &max)==1 && max<size)
+			size=max;
+		fclose(f);
+	}
+	return size;
+}
+void close_redirects(int fds[3])
+{
+	for (int i=0;i<3;++i)
+		if (fds[i]!=-1)
+		{
+			close(fds[i]);
+			fds[i]=-1;
+		}
+}
+/**
+ * Open the files a command redirects to. fds[i] is set to the descriptor that
+ * replaces stdin/stdout, -1 where there is no redirection.
+ * @param  command [description]
+ * @param  fds     [description]
+ * @return         0, -1 after reporting a file that could not be opened
+ */
+int open_redirects(struct command_t *command, int fds[3])
+{
+	fds[0]=fds[1]=fds[2]=-1;
+	const char *file=command->redirects[0];
+	if (file && (fds[0]=open(file, O_RDONLY|O_CLOEXEC))==-1)
+		goto fail;
+	file=command->redirects[1];
+	if (file && (fds[1]=open(file, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0666))==-1)
+		goto fail;
+	file=command->redirects[2];
+	if (file)
+	{
+		if (fds[1]!=-1) close(fds[1]); // ">>" wins, like the last redirection would
+		if ((fds[1]=open(file, O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0666))==-1)
+			goto fail;
+	}
+	return 0;
+fail:
+	printf("-%s: %s: %s\n", sysname, file, strerror(errno));
+	close_redirects(fds);
+	return -1;
+}
+/**
+ * Run a builtin in the shell process with its redirections applied,
+ * putting the shell's own descriptors back afterwards.
+ * @param  builtin [description]
+ * @param  command [description]
+ * @return         [description]
+ */
+int run_builtin(struct builtin_t *builtin, struct command_t *command)
+{
+	int redirects[3], saved[3];
+	if (open_redirects(command, redirects)==-1) return UNKNOWN;
+	fflush(stdout);
+	for (int i=0;i<3;++i)
+	{
+		saved[i]=-2; // not redirected
+		if (redirects[i]==-1) continue;
+		saved[i]=fcntl(i, F_DUPFD_CLOEXEC, 10); // -1 if it was closed to begin with
+		dup2(redirects[i], i);
+	}
+	close_redirects(redirects);
+	if (builtin->reads_input && isatty(STDIN_FILENO))
+		term_set_cooked();
 
-				//Getting the line user wants to execute.
-				while (fgets(buffer, 256, fptr)) {
-					if(buffer_counter == index) {
-						dir = strdup(buffer);
-						break;
-					}
-					buffer_counter++;
-				}
-				//Removing the " and \n from the command we got.
-				len = strlen(dir);					
-				for(i = 0; i < len; i++) {
-        			if((dir[i] == '\"') || (dir[i] == '\n')) {		
-            			for(j = i; j < len; j++){	
-                		dir[j] = dir[j+1];
-            			}
-            		len--;
-            		i--;
-        			}
-    			}
-
-				//Duplicating the command we parsed.
-				to_execute = strdup(dir);
-
-				// Using one of the duplicated commands to determine the arg count.
-				arg_count = 0;
-				char *dir_token = strtok(dir, " ");
-				while (dir_token != NULL) {
-					arg_count++;
-					dir_token = strtok(NULL, " ");
-				}
+	int r=builtin->fn(command);
 
-				// Using the other duplicated command to parse out the args and create **pointer for execv.
-				int index_count = 0;
-				char *bookmark_args[arg_count+1];
-				char *token = strtok(to_execute, " ");
-				while (token != NULL) {
-					bookmark_args[index_count] = strdup(token);
-					token = strtok(NULL, " ");
-					index_count++;
-				}
-				// Exit if the command is cd, which child process cannot execute, carry on in parent process.
-				if(strcmp(bookmark_args[0], "cd") == 0) {
-					exit(0);
-				}
-				bookmark_args[arg_count] = NULL;
-				strcat(bookmarkBin, bookmark_args[0]);
-				fclose(fptr);
-				execv(bookmarkBin, bookmark_args);
-				exit(0);
-			}
-
-			// Saving new bookmark to the bookmarks.txt file.
-			else{
-				int i = 1;				
-				fptr = fopen(bookmark_loc, "a+");
-				if(fptr == NULL) {
-					printf("Error inserting bookmark.\n");	
-					exit(0);
-				}
-				while(command->args[i] != NULL) {
-					fputs(command->args[i], fptr);
-					fputs(" ", fptr);
-					i++;
-				}
-				fprintf(fptr, "\n");
-				fclose(fptr);
-			}
-			exit(0);
+	fflush(stdout);
+	for (int i=0;i<3;++i)
+	{
+		if (saved[i]==-2) continue;
+		if (saved[i]==-1)
+			close(i);
+		else
+		{
+			dup2(saved[i], i);
+			close(saved[i]);
 		}
+	}
+	return r;
+}
+/**
+ * Start one pipeline stage reading from in and writing to out.
+ * Redirections of the command take the place of the pipe ends.
+ * @param  command    [description]
+ * @param  in         [description]
+ * @param  out        [description]
+ * @param  pgid       process group of the job, 0 to start one
+ * @param  foreground [description]
+ * @return            pid of the stage, -1 if it could not be started
+ */
+pid_t launch_stage(struct command_t *command, int in, int out, pid_t pgid, bool foreground)
+{
+	pid_t pid=-1;
+	int redirects[3];
+	if (open_redirects(command, redirects)==-1) return -1;
+	int fds[3]={redirects[0]!=-1?redirects[0]:in, redirects[1]!=-1?redirects[1]:out, -1};
+	if (!job_control) pgid=-1;
 
-		// Executing UNIX commands here.
-		else {
-			execv(bin, command->args); 
-			exit(0);
+	struct builtin_t *builtin=find_builtin(command);
+	if (builtin) // the builtin has to run in the child, so it can't be spawned
+	{
+		fflush(stdout); // don't let the child inherit pending output
+		pid=fork();
+		if (pid==-1)
+			printf("-%s: %s: %s\n", sysname, command->name, strerror(errno));
+		if (pid==0)
+		{
+			child_setup(pgid, foreground);
+			// what the builtin starts stays in its job, and is waited for
+			// through signal_fd as in the shell
+			job_control=false;
+			sigset_t chld;
+			sigemptyset(&chld);
+			sigaddset(&chld, SIGCHLD);
+			sigprocmask(SIG_BLOCK, &chld, NULL);
+			for (int i=0;i<3;++i)
+				if (fds[i]!=-1) dup2(fds[i], i);
+			run_child(run_current);
+			int r=builtin->fn(command);
+			fflush(stdout);
+			_exit(r==SUCCESS?0:1);
 		}
 	}
-	//Parent process.
 	else
 	{
-		if (!command->background) wait(0); // wait for child process to finish
-		
-		// Check if short custom command is called.
-		if(strcmp(command->name, "short") == 0) {
-			// Return if there is not enough args.
-				if(command->arg_count < 2) {
-					printf("Not enough arguments.\n");
-					return UNKNOWN;
-				}
-			if(strcmp(command->args[0], "set") == 0) { // Check if first args is: set
-				int j;
-				char cwd[1024];	
-				getcwd(cwd, sizeof(cwd));	// Getting the current working directory.
-			
-				// Iterating to see if the alias is already saved. If so, update the directory and keep the alias.
-				for(j = 0; j < (*saveCount); j++){ 
-					if(strcmp(command->args[1], alias[j]) == 0){
-						wd[j] = strdup(cwd);
-						printf("An alias named %s already has been found, overriding the path.\n", alias[j]);	
-						return SUCCESS;
-					}
-				}
-				alias[(*saveCount)] = strdup(command->args[1]);	// If alias is new, save to the storage.
-				wd[(*saveCount)] = strdup(cwd);
-				(*saveCount)++;	// Increment to keep track of how many pairs we have.
-				printf("New alias %s is saved. Curent alias number: %d\n", command->args[1], *saveCount);
-			}
-			if(strcmp(command->args[0], "jump") == 0) { // Check if first arg is: jump
-				int i;
-				for(i = 0; i < (*saveCount); i++){
-					if(strcmp(command->args[1], alias[i]) == 0) {	// If alias is saved, jump to the saved directory.
-						chdir(wd[i]);	
-						printf("Alias %s found, changing dir.\n", alias[i]);
-						return SUCCESS;
-					}
-				}
-				printf("There is no such alias as %s, try again.\n", command->args[1]); 	//If there is no alias saved, print error.
+		// Resolve external commands in the parent so the PATH cache outlives the child.
+		const char *bin=resolve_command(command->name);
+		if (bin==NULL)
+			printf("-%s: %s: command not found\n", sysname, command->name);
+		else
+		{
+			struct launch_t launch={.path=bin, .argv=command->argv, .fds={fds[0], fds[1], fds[2]},
+				.pgid=pgid, .foreground=foreground, .run=run_current};
+			pid=launch_command(&launch);
+		}
+	}
+	if (pid>0 && pgid!=-1) // the child does this too, whoever is first wins the race
+		setpgid(pid, pgid?pgid:pid);
+	close_redirects(redirects);
+	return pid;
+}
+/**
+ * Start every stage of a pipeline, connected by close-on-exec pipes, and
+ * add it to the job table.
+ * @param  command    [description]
+ * @param  in         stdin of the first stage, -1 for the shell's; left open
+ * @param  out        stdout of the last stage, -1 for the shell's; left open
+ * @param  foreground give the job the terminal
+ * @param  r          set to UNKNOWN if a stage could not be started
+ * @return            the job, NULL if no stage could be started
+ */
+struct job_t *pipeline_start(struct command_t *command, int in, int out, bool foreground, int *r)
+{
+	int stages=0;
+	for (struct command_t *c=command;c;c=c->next)
+		stages++;
+	pid_t pids[stages], pgid=0;
+	const char *names[stages];
+	int piped=-1, launched=0; // piped is the read end of the previous stage's pipe
+	uint64_t started=monotonic_ns();
+
+	for (struct command_t *c=command;c;c=c->next)
+	{
+		int fds[2]={-1, c->next?-1:out};
+		if (c->next)
+		{
+			if (pipe2(fds, O_CLOEXEC)==-1)
+			{
+				printf("-%s: pipe: %s\n", sysname, strerror(errno));
+				*r=UNKNOWN;
+				break;
 			}
+			fcntl(fds[1], F_SETPIPE_SZ, pipe_buffer_size()); // best effort, the default still works
+		}
+		pid_t pid=launch_stage(c, c==command?in:piped, fds[1], pgid, foreground);
+		if (pid==-1)
+			*r=UNKNOWN;
+		else
+		{
+			if (pgid==0) pgid=pid;
+			names[launched]=c->name;
+			pids[launched++]=pid;
 		}
+		if (piped!=-1) close(piped);
+		if (c->next) close(fds[1]);
+		piped=fds[0];
+	}
+	if (piped!=-1) close(piped);
 
-		//Check if custom command rps is called. (Short for Rock, Paper, Scissors)
-        else if (strcmp(command->name, "rps") == 0) {
-			if(command->arg_count == 0) {
-				printf("Not enough arguments given, try again.\n"); // Return if args are not enough
-				return UNKNOWN;
+	if (launched==0)
+		return NULL;
+	struct job_t *job=job_add(pgid, pids, names, launched, command);
+	job->started=started; // before the first stage, not after the last
+	return job;
+}
+/**
+ * Run a command and everything piped after it as one job. Every stage is
+ * started before any is waited for, connected by close-on-exec pipes.
+ * @param  command [description]
+ * @return         [description]
+ */
+int run_pipeline(struct command_t *command)
+{
+	int r=SUCCESS;
+	if (!command->background)
+		term_set_cooked(); // before the first stage can read from the terminal
+	struct job_t *job=pipeline_start(command, -1, -1, !command->background, &r);
+	if (!job)
+	{
+		last_status=127;
+		return r;
+	}
+	if (command->background)
+	{
+		if (interactive)
+			printf("[%d] %d\n", job->id, job->pgid);
+		return r;
+	}
+	last_status=job_foreground(job); // wait for the whole pipeline
+	return r;
+}
+/**
+ * One word of a parallel template with {} replaced by the item and {.} by
+ * the item without its extension.
+ * @return the word itself if there is nothing to replace
+ */
+char *parallel_subst(struct arena_t *arena, char *word, const char *item)
+{
+	if (!word || !strchr(word, '{')) return word;
+	size_t item_len=strlen(item), stem_len=item_len;
+	const char *dot=strrchr(item, '.'), *slash=strrchr(item, '/');
+	if (dot && dot>item && (!slash || dot>slash+1)) stem_len=dot-item;
+	size_t len=0;
+	for (const char *p=word;*p;)
+		if (strncmp(p, "{}", 2)==0) len+=item_len, p+=2;
+		else if (strncmp(p, "{.}", 3)==0) len+=stem_len, p+=3;
+		else len++, p++;
+	char *out=arena_alloc(arena, len+1), *o=out;
+	for (const char *p=word;*p;)
+		if (strncmp(p, "{}", 2)==0) o=mempcpy(o, item, item_len), p+=2;
+		else if (strncmp(p, "{.}", 3)==0) o=mempcpy(o, item, stem_len), p+=3;
+		else *o++=*p++;
+	*o=0;
+	return out;
+}
+// Whether any word of the template has a place for the item.
+bool parallel_has_slot(struct command_t *template)
+{
+	for (struct command_t *c=template;c;c=c->next)
+	{
+		for (int i=0;i<=c->arg_count;++i)
+			if (strstr(c->argv[i], "{}") || strstr(c->argv[i], "{.}")) return true;
+		for (int i=0;i<3;++i)
+			if (c->redirects[i] && (strstr(c->redirects[i], "{}") || strstr(c->redirects[i], "{.}"))) return true;
+	}
+	return false;
+}
+/**
+ * The template filled in for one item, allocated from arena. The template
+ * itself is left as it is for the next item.
+ * @param  template [description]
+ * @param  item     [description]
+ * @param  append   no slot in the template: the item becomes the last argument
+ * @param  arena    [description]
+ * @return          [description]
+ */
+struct command_t *parallel_instance(struct command_t *template, const char *item, bool append, struct arena_t *arena)
+{
+	struct command_t *first=NULL, **link=&first;
+	for (struct command_t *c=template;c;c=c->next)
+	{
+		struct command_t *stage=new_command(arena);
+		char *words[c->arg_count+2];
+		size_t count=0;
+		for (int i=0;i<=c->arg_count;++i)
+			words[count++]=parallel_subst(arena, c->argv[i], item);
+		if (append && !c->next)
+			words[count++]=(char *)item;
+		parse_finish_stage(stage, words, count);
+		if (c->patterns) // globs are matched after the item is in
+		{
+			stage->patterns=arena_alloc(arena, sizeof(char *)*(count+1));
+			memset(stage->patterns, 0, sizeof(char *)*(count+1));
+			for (int i=0;i<=c->arg_count;++i)
+				stage->patterns[i]=parallel_subst(arena, c->patterns[i], item);
+		}
+		for (int i=0;i<3;++i)
+			stage->redirects[i]=parallel_subst(arena, c->redirects[i], item);
+		*link=stage;
+		link=&stage->next;
+	}
+	return first;
+}
+// With -k a finished task holds its output until every task before it is
+// done, so tasks start at most this many times -j past the oldest unfinished one.
+#define PARALLEL_AHEAD 4
+struct parallel_task_t {
+	struct job_t *job; // NULL before it starts and after it finished
+	int out; // memfd the output is grouped in, -1 if it goes straight through
+	bool done;
+};
+// Copy a finished task's grouped output to stdout.
+void parallel_emit(struct parallel_task_t *task)
+{
+	if (task->out==-1) return;
+	fflush(stdout);
+	lseek(task->out, 0, SEEK_SET);
+	move_bytes(task->out, STDOUT_FILENO);
+	close(task->out);
+	task->out=-1;
+}
+/**
+ * parallel [-j N] [-k] [-u] command [args] [::: items]: run the command once
+ * per item, at most N (the number of CPUs) at a time, starting the next as
+ * soon as one finishes. {} in the command is the item, {.} the item without
+ * its extension, otherwise the item is added as the last argument. A single
+ * quoted command is parsed as a line of its own, so it may have pipes and
+ * redirections. Items are the words after :::, or the lines of stdin.
+ * Each task's output is held back and printed whole when it finishes, in
+ * the order the items were given with -k; -u lets it through as it comes.
+ * @param  command [description]
+ * @return         SUCCESS if every task exited with 0
+ */
+int builtin_parallel(struct command_t *command)
+{
+	long max=sysconf(_SC_NPROCESSORS_ONLN);
+	bool keep=false, grouped=true;
+	int i=0;
+	for (;i<command->arg_count && command->args[i][0]=='-';++i)
+	{
+		const char *arg=command->args[i];
+		if (strcmp(arg, "-k")==0) keep=true;
+		else if (strcmp(arg, "-u")==0) grouped=false;
+		else if (strncmp(arg, "-j", 2)==0 && (arg[2] || i+1<command->arg_count))
+			max=atol(arg[2]?arg+2:command->args[++i]);
+		else
+			break;
+	}
+	int words=0;
+	while (i+words<command->arg_count && strcmp(command->args[i+words], ":::")!=0)
+		words++;
+	if (words==0 || max<1)
+	{
+		printf("Usage: %s [-j N] [-k] [-u] command [args] [::: items]\n", command->name);
+		return UNKNOWN;
+	}
+
+	struct arena_t template_arena={0}, task_arena={0};
+	struct command_t *template=new_command(&template_arena);
+	char *line=NULL;
+	if (words==1) // a command line of its own
+		parse_command(line=strdup(command->args[i]), template);
+	else
+		parse_finish_stage(template, &command->args[i], words);
+	bool append=!parallel_has_slot(template);
+
+	// the items
+	char **items, *input=NULL;
+	int item_count=0;
+	if (i+words<command->arg_count)
+	{
+		items=&command->args[i+words+1];
+		item_count=command->arg_count-i-words-1;
+	}
+	else
+	{
+		size_t len=0, size=0;
+		ssize_t n;
+		do
+		{
+			if (len==size) input=realloc(input, size=size?size*2:65536);
+			n=read(STDIN_FILENO, input+len, size-len);
+			if (n>0) len+=n;
+		} while (n>0 || (n==-1 && errno==EINTR));
+		input=realloc(input, len+1);
+		input[len]=0;
+		items=malloc(sizeof(char *)*(count_byte_scalar(input, len, '\n')+1));
+		for (char *p=input, *end=input+len;p<end;)
+		{
+			char *nl=memchr(p, '\n', end-p);
+			if (nl) *nl=0;
+			if (*p) items[item_count++]=p;
+			p=nl?nl+1:end;
+		}
+	}
+
+	// SIGCHLD is blocked for the signalfd, even in a forked pipeline stage.
+	// ^C is taken through a signalfd too, to stop the tasks and start no more.
+	sigset_t mask, old;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGINT);
+	sigprocmask(SIG_BLOCK, &mask, &old);
+	sigdelset(&mask, SIGCHLD);
+	int interrupt_fd=signalfd(-1, &mask, SFD_NONBLOCK|SFD_CLOEXEC);
+	int devnull=open("/dev/null", O_RDONLY|O_CLOEXEC);
+
+	// each held output is a memfd, so the window also stays inside the descriptor limit
+	long ahead=max<item_count?max*PARALLEL_AHEAD:item_count;
+	struct rlimit nofile;
+	if (grouped && getrlimit(RLIMIT_NOFILE, &nofile)==0 && nofile.rlim_cur!=RLIM_INFINITY
+		&& (rlim_t)ahead>nofile.rlim_cur/2)
+		ahead=nofile.rlim_cur>=4?nofile.rlim_cur/2:1;
+
+	struct parallel_task_t *tasks=calloc(item_count+1, sizeof(struct parallel_task_t));
+	int next=0, running=0, emitted=0, failed=0;
+	bool stop=false;
+	fflush(stdout);
+	while (1)
+	{
+		while (!stop && running<max && next<item_count && (!keep || next-emitted<ahead))
+		{
+			struct parallel_task_t *task=&tasks[next];
+			struct command_t *instance=parallel_instance(template, items[next++], append, &task_arena);
+			if (command_globs(instance))
+				instance=glob_command(instance, &task_arena);
+			task->out=grouped?memfd_create("parallel", MFD_CLOEXEC):-1;
+			int r=SUCCESS;
+			task->job=pipeline_start(instance, devnull, task->out, false, &r);
+			arena_reset(&task_arena);
+			if (task->job)
+				running++;
+			else
+			{
+				task->done=true;
+				failed++;
 			}
-			int i;
-			srand(time(NULL)); 
-			int random_var = rand() % 3;  // Random number generator for shellington to determine the move.
-			char *moves[3];				  // Array containing move names.
-			moves[0] = strdup("rock");	
-			moves[1] = strdup("paper");
-			moves[2] = strdup("scissors");
-			char *linux_move = strdup(moves[random_var]); 	// Picking the move for shellington via random generated number.
-			char *user_move = strdup(command->args[0]);		// Getting the user input.
-			for(i = 0; i < strlen(user_move); i++) {
-				user_move[i] = tolower(user_move[i]);		// lowercase convertion to compare moves.
-			}
-            printf("Rock!\n");								
-			sleep(1);
-			printf("Paper!\n");
-			sleep(1);
-			printf("Scissors!\n");
-			sleep(1);
-			printf("You said: %s!\nShellington said %s!\n", user_move, linux_move);
-
-			//Checking which move wins over the other, printing the result and storing the data.
-			if(strcmp(user_move, moves[0]) == 0) {	
-				if(random_var == 0) printf(COLOR_YELLOW "That's a tie!\n" COLOR_RESET);
-				if(random_var == 1) {
-					printf(COLOR_RED "Paper beats rock! You lost.\n" COLOR_RESET);
-					(*(rps_counter+1))++;	//Incrementing the 1st index of the pointer if user loses.
-					}
-				if(random_var == 2) {
-					printf(COLOR_GREEN "Rock beats Scissors! You won.\n" COLOR_RESET);
-					(*rps_counter)++;	// Incrementing the 0th index of the pointer if user wins.
-				}
+		}
+		// in item order, a finished task waits for the ones before it (only -k has any waiting)
+		for (;emitted<next && tasks[emitted].done;++emitted)
+			parallel_emit(&tasks[emitted]);
+		if (running==0) break;
+
+		struct pollfd fds[2]={{signal_fd, POLLIN, 0}, {interrupt_fd, POLLIN, 0}};
+		if (poll(fds, 2, -1)==-1 && errno!=EINTR) break;
+		struct signalfd_siginfo info;
+		if (fds[1].revents && read(interrupt_fd, &info, sizeof(info))==sizeof(info) && !stop)
+		{
+			stop=true;
+			for (int t=0;t<next;++t)
+				if (tasks[t].job)
+					for (int p=0;p<tasks[t].job->proc_count;++p)
+						kill(tasks[t].job->procs[p].pid, SIGINT);
+		}
+		jobs_reap();
+		for (int t=0;t<next;++t)
+		{
+			struct parallel_task_t *task=&tasks[t];
+			if (!task->job || !job_completed(task->job)) continue;
+			if (job_status(task->job)!=0) failed++;
+			stats_job(task->job);
+			job_remove(task->job);
+			task->job=NULL;
+			task->done=true;
+			running--;
+			if (!keep) parallel_emit(task);
+		}
+	}
+
+	for (int t=0;t<next;++t)
+		parallel_emit(&tasks[t]); // anything left behind by an error
+	if (stop && interactive)
+		printf("\n"); // ^C was echoed without a newline
+	close(devnull);
+	if (interrupt_fd!=-1) close(interrupt_fd);
+	sigprocmask(SIG_SETMASK, &old, NULL);
+	free(tasks);
+	if (input) free(items);
+	free(input);
+	free(line);
+	arena_free(&task_arena);
+	arena_free(&template_arena);
+	return failed || stop?UNKNOWN:SUCCESS;
+}
+
+// watch: a command run again on an interval, or as soon as files it depends
+// on change, reported through inotify instead of polling them.
+#define WATCH_DEBOUNCE_NS 100000000 // a run waits until changes are this quiet
+#define WATCH_DEBOUNCE_MAX_NS 1000000000 // but no longer than this after the first
+#define WATCH_EVENTS (IN_MODIFY|IN_CLOSE_WRITE|IN_ATTRIB|IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_DELETE_SELF|IN_MOVE_SELF)
+struct watch_path_t {
+	const char *path;
+	int wd; // -1 once the file was removed or renamed, added again before the next run
+};
+#define WATCH_DIFF_CELLS (1<<20) // bigger changes are shown as one removed and one added block
+struct watch_line_t {
+	const char *text;
+	size_t len; // without the newline
+};
+// Split text into lines, the last one may lack its newline. Returns a malloc'd array.
+struct watch_line_t *watch_lines(const char *text, size_t len, size_t *count)
+{
+	struct watch_line_t *lines=malloc(sizeof(struct watch_line_t)*(count_byte(text, len, '\n')+1));
+	*count=0;
+	for (const char *p=text, *end=text+len;p<end;)
+	{
+		const char *nl=memchr(p, '\n', end-p);
+		lines[*count].text=p;
+		lines[(*count)++].len=(nl?nl:end)-p;
+		p=nl?nl+1:end;
+	}
+	return lines;
+}
+static inline bool watch_line_eq(const struct watch_line_t *a, const struct watch_line_t *b)
+{
+	return a->len==b->len && memcmp(a->text, b->text, a->len)==0;
+}
+// Print how many lines were left out as unchanged, and start counting again.
+void watch_unchanged(size_t *count)
+{
+	if (*count) printf("  ... %zu unchanged line%s\n", *count, *count==1?"":"s");
+	*count=0;
+}
+/**
+ * Print a run's output as a line diff against the previous run's. Lines
+ * the two share at either end are skipped before a longest common
+ * subsequence table is built over the rest; unchanged lines are only counted.
+ * @param prev     [description]
+ * @param prev_len [description]
+ * @param out      [description]
+ * @param out_len  [description]
+ * @param color    [description]
+ */
+void watch_diff(const char *prev, size_t prev_len, const char *out, size_t out_len, bool color)
+{
+	if (prev_len==out_len && memcmp(prev, out, out_len)==0)
+	{
+		printf("  (output unchanged)\n");
+		return;
+	}
+	size_t n, m;
+	struct watch_line_t *a=watch_lines(prev, prev_len, &n), *b=watch_lines(out, out_len, &m);
+	size_t head=0, tail=0;
+	while (head<n && head<m && watch_line_eq(&a[head], &b[head])) head++;
+	while (tail<n-head && tail<m-head && watch_line_eq(&a[n-1-tail], &b[m-1-tail])) tail++;
+	size_t rows=n-head-tail, cols=m-head-tail;
+	struct watch_line_t *x=a+head, *y=b+head;
+
+	// lcs[i*(cols+1)+j]: longest common subsequence of x[i..] and y[j..]
+	uint32_t *lcs=NULL;
+	if ((rows+1)*(cols+1)<=WATCH_DIFF_CELLS)
+	{
+		lcs=calloc((rows+1)*(cols+1), sizeof(uint32_t));
+		for (size_t i=rows;i-->0;)
+			for (size_t j=cols;j-->0;)
+			{
+				uint32_t down=lcs[(i+1)*(cols+1)+j], right=lcs[i*(cols+1)+j+1];
+				lcs[i*(cols+1)+j]=watch_line_eq(&x[i], &y[j])?lcs[(i+1)*(cols+1)+j+1]+1:down>right?down:right;
 			}
-			else if(strcmp(user_move, moves[1]) == 0) {
-				if(random_var == 1) printf(COLOR_YELLOW "That's a tie!\n" COLOR_RESET);
-				if(random_var == 0) {
-					printf(COLOR_GREEN "Paper beats rock! You won.\n" COLOR_RESET);
-					(*rps_counter)++;
-					}
-				if(random_var == 2) {
-					printf(COLOR_RED "Scissors beats paper! You lost.\n" COLOR_RESET);
-					(*(rps_counter+1))++;
-					}
-				}
-			else if(strcmp(user_move, moves[2]) == 0) {
-				if(random_var == 2) printf(COLOR_YELLOW "That's a tie!\n" COLOR_RESET);
-				if(random_var == 0) {
-					printf(COLOR_RED "Rock beats Scissors! You lost.\n" COLOR_RESET);
-					(*(rps_counter+1))++;
-					}
-				if(random_var == 1) {
-					printf(COLOR_GREEN "Scissors beats paper! You won.\n" COLOR_RESET);
-					(*rps_counter)++;
-					}
-				}
-			else {
-				printf("That move does not exist! Try again.\n");
-				return UNKNOWN;		
-			}
-			printf("SCOREBOARD: You %d, Shellinton %d\n", *rps_counter, *(rps_counter+1));	
-        }
-
-		// Checking if the bookmark -i invokes a cd, command. If so execute, otherwise return.
-		else if ((strcmp(command->name, "bookmark") == 0) && (strcmp(command->args[0], "-i") == 0)) { 
-			FILE *cd_ptr = NULL;
-			int index = atoi(command->args[1]);	
-			int buffer_counter = 0;
-			char *dir, *to_execute;
-			char buffer[256];
-			int i, j, len;
-			
-			// Getting the initial text directory so I can reach it when I change dir on the process. 
-			char bookmark_loc[1024] = "";
-			strcat(bookmark_loc, init_dir);
-			strcat(bookmark_loc, "/bookmarks.txt");		
-			cd_ptr = fopen(bookmark_loc, "r");
-
-			// If cannot open the file, exit.
-			if(cd_ptr == NULL) {
-				printf("Error opening bookmarks.\n");	
-				return UNKNOWN;
+	}
+	size_t unchanged=head, i=0, j=0;
+	while (i<rows || j<cols)
+	{
+		if (lcs && i<rows && j<cols && watch_line_eq(&x[i], &y[j]))
+		{
+			unchanged++;
+			i++, j++;
+			continue;
+		}
+		watch_unchanged(&unchanged);
+		bool removed=j==cols || (i<rows && (!lcs || lcs[(i+1)*(cols+1)+j]>=lcs[i*(cols+1)+j+1]));
+		struct watch_line_t *line=removed?&x[i++]:&y[j++];
+		printf("%s%c%.*s%s\n", color?(removed?COLOR_RED:COLOR_GREEN):"", removed?'-':'+',
+			(int)line->len, line->text, color?COLOR_RESET:"");
+	}
+	unchanged+=tail;
+	watch_unchanged(&unchanged);
+	free(lcs);
+	free(a);
+	free(b);
+}
+/**
+ * watch [-n secs] [-f path]... command [args]: run the command every secs
+ * seconds, 2 by default. With -f it runs when one of the paths (or, for a
+ * directory, an entry in it) changes instead, once the changes have been
+ * quiet for WATCH_DEBOUNCE_NS; changes during a run make one run after it.
+ * -n and -f together run on both. Every run is reported with its exit
+ * status and duration, then its output, from the second run on as a diff
+ * against the run before. A single quoted command is parsed as a line of its
+ * own. Runs until ^C.
+ * @param  command [description]
+ * @return         SUCCESS if the last run exited with 0
+ */
+int builtin_watch(struct command_t *command)
+{
+	uint64_t interval=0;
+	struct watch_path_t *paths=malloc(sizeof(struct watch_path_t)*(command->arg_count+1));
+	int path_count=0, i=0;
+	for (;i+1<command->arg_count && command->args[i][0]=='-';i+=2)
+	{
+		const char *arg=command->args[i], *value=command->args[i+1];
+		char *end;
+		double secs;
+		if (strcmp(arg, "-f")==0)
+			paths[path_count++].path=value;
+		else if (strcmp(arg, "-n")==0 && (secs=strtod(value, &end))>=0.1 && !*end)
+			interval=secs*1e9;
+		else
+			break;
+	}
+	if (i==command->arg_count || command->args[i][0]=='-')
+	{
+		printf("Usage: %s [-n secs] [-f path]... command [args]\n", command->name);
+		free(paths);
+		return UNKNOWN;
+	}
+	if (!interval && !path_count) interval=2000000000ull;
+
+	int inotify_fd=path_count?inotify_init1(IN_NONBLOCK|IN_CLOEXEC):-1;
+	for (int p=0;p<path_count;++p)
+		if ((paths[p].wd=inotify_add_watch(inotify_fd, paths[p].path, WATCH_EVENTS))==-1)
+		{
+			printf("-%s: %s: %s: %s\n", sysname, command->name, paths[p].path, strerror(errno));
+			if (inotify_fd!=-1) close(inotify_fd);
+			free(paths);
+			return UNKNOWN;
+		}
+
+	struct arena_t template_arena={0}, run_arena={0};
+	struct command_t *template=new_command(&template_arena);
+	char *line=NULL;
+	if (i==command->arg_count-1) // a command line of its own
+		parse_command(line=strdup(command->args[i]), template);
+	else
+		parse_finish_stage(template, &command->args[i], command->arg_count-i);
+	char *title=command_string(template);
+	text_kernels_init();
+
+	// as in parallel: SIGCHLD and ^C come through signalfds
+	sigset_t mask, old;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigaddset(&mask, SIGINT);
+	sigprocmask(SIG_BLOCK, &mask, &old);
+	sigdelset(&mask, SIGCHLD);
+	int interrupt_fd=signalfd(-1, &mask, SFD_NONBLOCK|SFD_CLOEXEC);
+	int devnull=open("/dev/null", O_RDONLY|O_CLOEXEC);
+	bool color=isatty(STDOUT_FILENO);
+
+	struct job_t *job=NULL;
+	int out=-1, runs=0, status=0;
+	char *prev=NULL;
+	size_t prev_len=0;
+	bool pending=true, stop=false;
+	uint64_t due=monotonic_ns(), first=due, next_interval=0, started=0;
+	fflush(stdout);
+	while (!stop || job)
+	{
+		uint64_t now=monotonic_ns();
+		if (!job && !stop && interval && now>=next_interval && !pending)
+		{
+			pending=true;
+			first=due=now;
+		}
+		if (!job && !stop && pending && now>=due)
+		{
+			pending=false;
+			for (int p=0;p<path_count;++p) // replaced files are watched again under their name
+				if (paths[p].wd==-1)
+					paths[p].wd=inotify_add_watch(inotify_fd, paths[p].path, WATCH_EVENTS);
+			struct command_t *instance=command_globs(template)?glob_command(template, &run_arena):template;
+			out=memfd_create("watch", MFD_CLOEXEC);
+			int r=SUCCESS;
+			started=now;
+			next_interval=now+interval;
+			job=pipeline_start(instance, devnull, out, false, &r);
+			arena_reset(&run_arena);
+			if (!job) // why was printed already, try again when it is due
+			{
+				close(out);
+				out=-1;
+				status=127;
+				printf("[%d] %s: not started\n", ++runs, title);
+				fflush(stdout);
 			}
+			continue;
+		}
 
-			//Getting the line user wants to execute.
-			while (fgets(buffer, 256, cd_ptr)) {
-				if(buffer_counter == index) {
-				dir = strdup(buffer);
-					break;
+		int timeout=-1;
+		if (!job && !stop)
+		{
+			uint64_t wake=pending?due:interval?next_interval:0;
+			if (wake) timeout=wake>now?(wake-now+999999)/1000000:0;
+		}
+		struct pollfd fds[3]={{signal_fd, POLLIN, 0}, {interrupt_fd, POLLIN, 0}, {inotify_fd, POLLIN, 0}};
+		if (poll(fds, 3, timeout)==-1 && errno!=EINTR) break;
+		struct signalfd_siginfo info;
+		if (fds[1].revents && read(interrupt_fd, &info, sizeof(info))==sizeof(info))
+		{
+			stop=true;
+			for (int p=0;job && p<job->proc_count;++p)
+				kill(job->procs[p].pid, SIGINT);
+		}
+		if (fds[2].revents) // every change moves the run back, up to a limit
+		{
+			_Alignas(struct inotify_event) char buf[4096];
+			ssize_t n;
+			while ((n=read(inotify_fd, buf, sizeof(buf)))>0)
+				for (char *p=buf;p<buf+n;p+=sizeof(struct inotify_event)+((struct inotify_event *)p)->len)
+				{
+					struct inotify_event *event=(struct inotify_event *)p;
+					if (!(event->mask&(IN_IGNORED|IN_MOVE_SELF))) continue;
+					for (int w=0;w<path_count;++w)
+						if (paths[w].wd==event->wd)
+						{
+							// what is watched now is the file under another name
+							if (event->mask&IN_MOVE_SELF)
+								inotify_rm_watch(inotify_fd, event->wd);
+							paths[w].wd=-1;
+						}
 				}
-				buffer_counter++;
-			}
-
-			//Removing the " and \n from the command we got.
-			len = strlen(dir);					
-			for(i = 0; i < len; i++) {
-        		if((dir[i] == '\"') || (dir[i] == '\n')) {		
-        			for(j = i; j < len; j++){	
-            		dir[j] = dir[j+1];
-           			}
-           		len--;
-           		i--;
-    			}
-    		}
-
-			//Duplicating the command we parsed.
-			to_execute = strdup(dir);
-
-			// If the command is not cd, exit the function.
-			char *dir_token = strtok(dir, " ");
-			if ((dir_token == NULL) || (strcmp(dir_token, "cd") != 0)) {
-				return UNKNOWN;
-			}
-			fclose(cd_ptr);
+			now=monotonic_ns();
+			if (!pending) first=now;
+			pending=true;
+			due=now+WATCH_DEBOUNCE_NS<first+WATCH_DEBOUNCE_MAX_NS?now+WATCH_DEBOUNCE_NS:first+WATCH_DEBOUNCE_MAX_NS;
+		}
+		jobs_reap();
+		if (!job || !job_completed(job)) continue;
+
+		// the run is over: report it and diff its output against the last
+		uint64_t ended=started;
+		for (int p=0;p<job->proc_count;++p)
+			if (job->procs[p].ended>ended) ended=job->procs[p].ended;
+		status=job_status(job);
+		stats_job(job);
+		job_remove(job);
+		job=NULL;
+		off_t len=lseek(out, 0, SEEK_END);
+		char *output=len>0?mmap(NULL, len, PROT_READ, MAP_PRIVATE, out, 0):NULL;
+		if (output==MAP_FAILED)
+		{
+			output=NULL;
+			len=0;
+		}
+		char took[32];
+		printf("%s[%d] %s: exit %d in %s%s\n", color?(status?COLOR_RED:COLOR_GREEN):"", ++runs, title, status,
+			format_ns(took, sizeof(took), ended-started), color?COLOR_RESET:"");
+		if (runs==1)
+		{
+			fflush(stdout);
+			write_all(STDOUT_FILENO, output, len);
+		}
+		else
+			watch_diff(prev, prev_len, output?output:"", len, color);
+		fflush(stdout);
+		prev=realloc(prev, len?len:1);
+		memcpy(prev, output, len);
+		prev_len=len;
+		if (output) munmap(output, len);
+		close(out);
+		out=-1;
+	}
+
+	if (stop && interactive)
+		printf("\n"); // ^C was echoed without a newline
+	close(devnull);
+	if (interrupt_fd!=-1) close(interrupt_fd);
+	if (inotify_fd!=-1) close(inotify_fd);
+	sigprocmask(SIG_SETMASK, &old, NULL);
+	free(title);
+	free(line);
+	free(prev);
+	free(paths);
+	arena_free(&run_arena);
+	arena_free(&template_arena);
+	return status==0?SUCCESS:UNKNOWN;
+}
+
+/**
+ * time prefix: run the rest of the line, then report on stderr how long it
+ * took and what it used, and each stage of a pipeline on its own.
+ * @param  command the line, still starting with "time"
+ * @return         what the command returned
+ */
+int run_timed(struct command_t *command)
+{
+	// shifted in place and put back after, the line may be a bookmark's template
+	char *name=command->name, **args=command->args, **argv=command->argv, **patterns=command->patterns;
+	int count=command->arg_count;
+	command->name=args[0];
+	command->args=args+1;
+	command->argv=argv+1;
+	command->patterns=patterns?patterns+1:NULL;
+	command->arg_count=count-1;
+
+	bool timing=stats_timing;
+	stats_timing=true;
+	memset(&stats_last, 0, sizeof(stats_last));
+	uint64_t start=monotonic_ns();
+	int r=process_command(command);
+	struct usage_t usage=stats_last;
+	usage.wall_ns=monotonic_ns()-start;
+	stats_timing=timing;
+
+	command->name=name;
+	command->args=args;
+	command->argv=argv;
+	command->patterns=patterns;
+	command->arg_count=count;
+	fflush(stdout);
+	stats_print_usage("time", &usage);
+	return r;
+}
+/**
+ * run prefix: run the rest of the line with the scheduling settings given
+ * in front of it, or apply them to the processes of a running job.
+ *   run [-c cpus] [-N nodes] [-n nice] [-s batch|idle|other]
+ *       [-i idle|be[:level]|rt[:level]] [-l limit=value]... command [args] | %job
+ * Builtins that run in the shell itself are left alone, the processes they
+ * start get the settings.
+ * @param  command the line, still starting with "run"
+ * @return         what the command returned
+ */
+int run_prefixed(struct command_t *command)
+{
+	// nested runs start from the outer settings, CPUs given here replace its
+	struct run_t run={.policy=-1, .ioprio=-1};
+	if (run_current) run=*run_current;
+	bool cpus_given=false;
+	int i=0;
+	for (;i<command->arg_count && command->args[i][0]=='-';i+=2)
+	{
+		const char *opt=command->args[i], *value=command->args[i+1];
+		if (strcmp(opt, "--")==0)
+		{
+			i++;
+			break;
+		}
+		if (strlen(opt)!=2 || !strchr("cNnsil", opt[1]))
+		{
+			printf("-%s: %s: %s: invalid option\n", sysname, command->name, opt);
+			last_status=1;
+			return UNKNOWN;
+		}
+		if (!value) // nothing to run either
+		{
+			i=command->arg_count;
+			break;
+		}
+		bool ok=true;
+		char *end;
+		if (opt[1]=='c' || opt[1]=='N')
+		{
+			if (!cpus_given) CPU_ZERO(&run.cpus);
+			cpus_given=run.affinity=true;
+			ok=opt[1]=='c'?run_cpu_list(value, &run.cpus):run_node_list(value, &run.cpus);
+		}
+		else if (opt[1]=='n')
+		{
+			run.nice=true;
+			run.nice_value=strtol(value, &end, 10);
+			ok=*value && !*end && run.nice_value>=-20 && run.nice_value<=19;
+		}
+		else if (opt[1]=='s')
+		{
+			if (strcmp(value, "batch")==0) run.policy=SCHED_BATCH;
+			else if (strcmp(value, "idle")==0) run.policy=SCHED_IDLE;
+			else if (strcmp(value, "other")==0) run.policy=SCHED_OTHER;
+			else ok=false;
+		}
+		else if (opt[1]=='i')
+			ok=run_ioprio(&run, value);
+		else
+			ok=run_limit(&run, value);
+		if (!ok)
+		{
+			printf("-%s: %s: %s %s: invalid value\n", sysname, command->name, opt, value);
+			last_status=1;
+			return UNKNOWN;
+		}
+	}
+	if (i>=command->arg_count)
+	{
+		printf("Usage: %s [-c cpus] [-N nodes] [-n nice] [-s batch|idle|other] [-i idle|be[:level]|rt[:level]] [-l limit=value]... command|%%job\n", command->name);
+		last_status=1;
+		return UNKNOWN;
+	}
 
-			// Tokenizing the args to get the directory intended to change.
-			int index_count = 0;
-			char *cd_args[2];
-			char *token = strtok(to_execute, " ");
-			while (token != NULL) {
-				if(index_count == 2) break;
-				cd_args[index_count] = strdup(token);
-				token = strtok(NULL, " ");
-				index_count++;
+	if (i==command->arg_count-1 && command->args[i][0]=='%')
+	{
+		jobs_reap();
+		struct job_t *job=builtin_job(command, command->args[i]);
+		int r=job?SUCCESS:UNKNOWN;
+		for (int j=0;job && j<job->proc_count;++j)
+		{
+			struct process_t *proc=&job->procs[j];
+			const char *failed=proc->completed?NULL:run_apply(&run, proc->pid);
+			if (failed)
+			{
+				printf("-%s: %s: %d: %s: %s\n", sysname, command->name, proc->pid, failed, strerror(errno));
+				r=UNKNOWN;
 			}
-			chdir(cd_args[1]);
-		}	
-		return SUCCESS;
+		}
+		last_status=r==SUCCESS?0:1;
+		return r;
+	}
+
+	// shifted in place and put back after, as for time
+	char *name=command->name, **args=command->args, **argv=command->argv, **patterns=command->patterns;
+	int count=command->arg_count;
+	command->name=args[i];
+	command->args=args+i+1;
+	command->argv=argv+i+1;
+	command->patterns=patterns?patterns+i+1:NULL;
+	command->arg_count=count-i-1;
+
+	struct run_t *outer=run_current;
+	run_current=&run;
+	int r=process_command(command);
+	run_current=outer;
+
+	command->name=name;
+	command->args=args;
+	command->argv=argv;
+	command->patterns=patterns;
+	command->arg_count=count;
+	return r;
+}
+int process_command(struct command_t *command)
+{
+	if (strcmp(command->name, "")==0) return SUCCESS;
+	if (strcmp(command->name, "time")==0 && command->arg_count>0)
+		return run_timed(command);
+	if (strcmp(command->name, "run")==0)
+		return run_prefixed(command);
+	if (command_globs(command)) // run a copy, the line may be a bookmark's template
+	{
+		struct arena_t arena={0};
+		int r=process_command(glob_command(command, &arena));
+		arena_free(&arena);
+		return r;
 	}
-	printf("-%s: %s: command not found\n", sysname, command->name);
-	return UNKNOWN;
-}
\ No newline at end of file
+
+	// Builtins run in the shell itself unless they have to run alongside it,
+	// or could run until interrupted while the shell ignores ^C.
+	struct builtin_t *builtin=find_builtin(command);
+	if (builtin && !command->background && !command->next && !(builtin->job && job_control))
+	{
+		struct rusage start, end;
+		uint64_t started=monotonic_ns();
+		getrusage(RUSAGE_SELF, &start);
+		int r=run_builtin(builtin, command);
+		getrusage(RUSAGE_SELF, &end);
+		if (r!=EXIT) // exit sets its own status
+			last_status=r==SUCCESS?0:1;
+		usage_from(&stats_last, &end, &start, monotonic_ns()-started);
+		stats_add(command->name, last_status, &stats_last);
+		return r;
+	}
+	return run_pipeline(command);
+}